@@ -6,10 +6,25 @@
 #include "NavigationSystem.h"
 #include "NavMesh/RecastNavMesh.h"
 #include "Engine/Texture2D.h"
+#include "Async/Async.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "TimerManager.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+#include "GAGridBake.h"
+#include "GAGridLayerFile.h"
 
 
 FCellRef FCellRef::Invalid(INDEX_NONE, INDEX_NONE);
 
+// Offsets of the 8 neighbors, in the order GetNeighbors visits them (and NeighborMasks numbers them)
+static const FIntPoint NeighborOffsets[8] =
+{
+	FIntPoint(-1, -1), FIntPoint(0, -1), FIntPoint(1, -1),
+	FIntPoint(-1, 0),                    FIntPoint(1, 0),
+	FIntPoint(-1, 1),  FIntPoint(0, 1),  FIntPoint(1, 1)
+};
+
 
 AGAGridActor::AGAGridActor(const FObjectInitializer& ObjectInitializer)
 : Super(ObjectInitializer)
@@ -17,6 +32,16 @@ AGAGridActor::AGAGridActor(const FObjectInitializer& ObjectInitializer)
 	XCount = 100;
 	YCount = 100;
 	CellScale = 100.0f;
+	Layout = EGridLayout::RowMajor;
+	bCacheCellPositions = false;
+	bBuildClearanceMap = true;
+	MaxClearance = 500.0f;
+	VisibilityMinLevel = 1;
+	VisibilityMemoryBudgetMB = 32.0f;
+	bBakeVisibilityOnGridReady = false;
+	VisibilityRebakeBudgetMs = 2.0f;
+	OccluderTraceHeight = 1000.0f;
+	bBakeOccluderHeightsOnGridReady = false;
 	RefreshDerivedValues();
 
 	SceneComponent = CreateDefaultSubobject<USceneComponent>(TEXT("Root"));
@@ -38,6 +63,10 @@ AGAGridActor::AGAGridActor(const FObjectInitializer& ObjectInitializer)
 
 	DebugMeshZOffset = 30.0f;
 
+	bRefreshFromNavOnBeginPlay = false;
+	bRefreshOnNavChange = true;
+	bUseGridCache = true;
+	GridVersion = 0;
 }
 
 void AGAGridActor::PostLoad()
@@ -48,6 +77,71 @@ void AGAGridActor::PostLoad()
 
 	RefreshDerivedValues();
 	Super::PostLoad();
+
+	// The derived tables aren't saved with the level
+	RefreshDerivedTables();
+}
+
+void AGAGridActor::PostRegisterAllComponents()
+{
+	Super::PostRegisterAllComponents();
+
+	// Keep the cached transform in step with the actor
+	if (RootComponent && !TransformUpdatedHandle.IsValid())
+	{
+		TransformUpdatedHandle = RootComponent->TransformUpdated.AddUObject(this, &AGAGridActor::OnRootTransformUpdated);
+	}
+	RefreshGridTransform();
+}
+
+void AGAGridActor::PostUnregisterAllComponents()
+{
+	if (RootComponent && TransformUpdatedHandle.IsValid())
+	{
+		RootComponent->TransformUpdated.Remove(TransformUpdatedHandle);
+	}
+	TransformUpdatedHandle.Reset();
+
+	Super::PostUnregisterAllComponents();
+}
+
+void AGAGridActor::OnRootTransformUpdated(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	RefreshGridTransform();
+}
+
+void AGAGridActor::BeginPlay()
+{
+	Super::BeginPlay();
+
+	UNavigationSystemV1* NavSystem = UNavigationSystemV1::GetNavigationSystem(this);
+	if (NavSystem)
+	{
+		NavSystem->OnNavigationGenerationFinishedDelegate.AddUniqueDynamic(this, &AGAGridActor::OnNavigationGenerationFinished);
+	}
+
+	if (bRefreshFromNavOnBeginPlay)
+	{
+		RefreshDataFromNavAsync();
+	}
+}
+
+void AGAGridActor::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	// Let any in-flight bake know not to bother
+	if (PendingBake.IsValid())
+	{
+		PendingBake->Cancelled.Set(1);
+		PendingBake.Reset();
+	}
+
+	UNavigationSystemV1* NavSystem = UNavigationSystemV1::GetNavigationSystem(this);
+	if (NavSystem)
+	{
+		NavSystem->OnNavigationGenerationFinishedDelegate.RemoveDynamic(this, &AGAGridActor::OnNavigationGenerationFinished);
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 
@@ -62,8 +156,20 @@ void AGAGridActor::PostEditChangeProperty(FPropertyChangedEvent& PropertyChanged
 		RefreshBoxComponent();
 	}
 
+	FGAGridIndexer OldIndexer = Indexer;
 	RefreshDerivedValues();
 
+	// Shuffle the existing cells into the new layout, rather than making everyone re-bake
+	if ((ChangedPropertyName == FName("Layout")) && (OldIndexer.Width == XCount) && (OldIndexer.Height == YCount))
+	{
+		FGAGridIndexer::Relayout(OldIndexer, Indexer, Data, ECellData::CellDataNone);
+		RefreshDerivedTables();
+	}
+	else if ((ChangedPropertyName == FName("MaxClearance")) || (ChangedPropertyName == FName("bBuildClearanceMap")))
+	{
+		RefreshClearanceMap(NULL);
+	}
+
 	Super::PostEditChangeProperty(PropertyChangedEvent);
 }
 
@@ -86,18 +192,62 @@ void AGAGridActor::RefreshDerivedValues()
 	// Refresh HalfExtents
 	HalfExtents.X = 0.5f * CellScale * float(XCount);
 	HalfExtents.Y = 0.5f * CellScale * float(YCount);
+
+	Indexer = FGAGridIndexer::Make(Layout, XCount, YCount);
+
+	RefreshGridTransform();
+}
+
+void AGAGridActor::RefreshGridTransform()
+{
+	// Actor space -> world
+	const FMatrix ActorToWorld = GetActorTransform().ToMatrixWithScale();
+
+	// Normalized grid space is actor space, shifted by HalfExtents and scaled by CellScale
+	GridOrigin = ActorToWorld.TransformPosition(FVector(-HalfExtents.X, -HalfExtents.Y, 0.0));
+	GridAxisX = ActorToWorld.TransformVector(FVector(CellScale, 0.0, 0.0));
+	GridAxisY = ActorToWorld.TransformVector(FVector(0.0, CellScale, 0.0));
+
+	// And back. Inverse() hands back the identity if the transform is degenerate (e.g. zero scale).
+	const FMatrix WorldToActor = ActorToWorld.Inverse();
+	const double InvCellScale = (CellScale > 0.0f) ? 1.0 / CellScale : 0.0;
+
+	WorldToGridX = FVector(WorldToActor.M[0][0], WorldToActor.M[1][0], WorldToActor.M[2][0]) * InvCellScale;
+	WorldToGridY = FVector(WorldToActor.M[0][1], WorldToActor.M[1][1], WorldToActor.M[2][1]) * InvCellScale;
+	WorldToGridOffset.X = (WorldToActor.M[3][0] + HalfExtents.X) * InvCellScale;
+	WorldToGridOffset.Y = (WorldToActor.M[3][1] + HalfExtents.Y) * InvCellScale;
+
+	// Heights are world Z, so they don't survive the grid moving
+	OccluderHeights.Empty();
+
+	if (bCacheCellPositions && (GetStorageCount() > 0))
+	{
+		CellPositions.SetNumUninitialized(GetStorageCount());
+		Indexer.ForEachSpan([this](int32 X, int32 Y, int32 Index, int32 Count)
+		{
+			const FVector RowStart = GridOrigin + GridAxisX * (X + 0.5) + GridAxisY * (Y + 0.5);
+			for (int32 I = 0; I < Count; I++)
+			{
+				CellPositions[Index + I] = RowStart + GridAxisX * double(I);
+			}
+		});
+	}
+	else
+	{
+		CellPositions.Empty();
+	}
 }
 
 
 bool AGAGridActor::ResetData()
 {
 	bool Result = false;
-	Data.SetNum(GetCellCount());
+	Data.SetNum(GetStorageCount());
 
 	ECellData* GridData = GetData();
 	if (GridData)
 	{
-		memset(GridData, 0, GetCellCount() * sizeof(ECellData));
+		memset(GridData, 0, GetStorageCount() * sizeof(ECellData));
 	}
 
 	return Result;
@@ -109,46 +259,121 @@ bool AGAGridActor::ResetData()
 
 FCellRef AGAGridActor::GetCellRef(const FVector& Point, bool bClamp) const
 {
-	// First, transform the point into grid-local space
-	// note, we drop the Z dimension at this point, by casting to a FVector2D
-	FTransform GridTransform = GetActorTransform();
-	FVector2D LocalPoint = FVector2D(GridTransform.InverseTransformPosition(Point));
+	// Straight into normalized grid space, where a cell is 1 unit wide and (0, 0) is the min corner of the grid
+	// note, we drop the Z dimension at this point
+	double GX = (WorldToGridX | Point) + WorldToGridOffset.X;
+	double GY = (WorldToGridY | Point) + WorldToGridOffset.Y;
 
 	if (bClamp)
 	{
-		LocalPoint.X = FMath::Clamp(LocalPoint.X, -HalfExtents.X, HalfExtents.X);
-		LocalPoint.Y = FMath::Clamp(LocalPoint.Y, -HalfExtents.Y, HalfExtents.Y);
+		GX = FMath::Clamp(GX, 0.0, double(XCount));
+		GY = FMath::Clamp(GY, 0.0, double(YCount));
 	}
-	else if (FMath::Abs(LocalPoint.X) > HalfExtents.X || FMath::Abs(LocalPoint.Y) > HalfExtents.Y)
+	else if ((GX < 0.0) || (GX > double(XCount)) || (GY < 0.0) || (GY > double(YCount)))
 	{
 		return FCellRef::Invalid;
 	}
 
-	LocalPoint += HalfExtents;		// Now LocalPoint is relative the to the (0, 0) corner of grid
-
-	// Discretize by dividing by scale and flooring
+	// Discretize by flooring
 	// Out of an abundance of caution we also clamp the result to a valid index, to avoid any floating-point issues
 
 	FCellRef Result(
-		FMath::Clamp(FMath::FloorToInt32(LocalPoint.X / CellScale), 0, XCount - 1),
-		FMath::Clamp(FMath::FloorToInt32(LocalPoint.Y / CellScale), 0, YCount - 1)
+		FMath::Clamp(FMath::FloorToInt32(GX), 0, XCount - 1),
+		FMath::Clamp(FMath::FloorToInt32(GY), 0, YCount - 1)
 	);
 	return Result;
 }
 
 FVector AGAGridActor::GetCellPosition(const FCellRef& CellRef) const
 {
-	float HalfScale = 0.5f * CellScale;
+	if (IsValidCell(CellRef) && (CellPositions.Num() == GetStorageCount()))
+	{
+		return CellPositions[CellRefToIndex(CellRef)];
+	}
 
-	// Grab the center of the cell, then offset by -HalfExtents, so that it is relative to the center of the grid
-	FVector LocalResult;
-	LocalResult.X = CellRef.X * CellScale + HalfScale - HalfExtents.X;
-	LocalResult.Y = CellRef.Y * CellScale + HalfScale - HalfExtents.Y;
-	LocalResult.Z = 0.0f;
+	// The center of the cell is half a cell in from its min corner
+	return GridOrigin + GridAxisX * (CellRef.X + 0.5) + GridAxisY * (CellRef.Y + 0.5);
+}
 
-	FTransform ActorTransform = GetActorTransform();
-	FVector Result = ActorTransform.TransformPosition(LocalResult);
-	return Result;
+void AGAGridActor::GetCellPositions(TArrayView<const int32> CellX, TArrayView<const int32> CellY, TArrayView<double> WorldX, TArrayView<double> WorldY, TArrayView<double> WorldZ) const
+{
+	const int32 Count = CellX.Num();
+	check((CellY.Num() == Count) && (WorldX.Num() == Count) && (WorldY.Num() == Count) && (WorldZ.Num() == Count));
+
+	// Fold the half-cell offset into the origin
+	const FVector Origin = GridOrigin + 0.5 * (GridAxisX + GridAxisY);
+
+	const int32* RESTRICT InX = CellX.GetData();
+	const int32* RESTRICT InY = CellY.GetData();
+	double* RESTRICT OutX = WorldX.GetData();
+	double* RESTRICT OutY = WorldY.GetData();
+	double* RESTRICT OutZ = WorldZ.GetData();
+
+	for (int32 I = 0; I < Count; I++)
+	{
+		const double X = InX[I];
+		const double Y = InY[I];
+		OutX[I] = Origin.X + GridAxisX.X * X + GridAxisY.X * Y;
+		OutY[I] = Origin.Y + GridAxisX.Y * X + GridAxisY.Y * Y;
+		OutZ[I] = Origin.Z + GridAxisX.Z * X + GridAxisY.Z * Y;
+	}
+}
+
+void AGAGridActor::GetCellRefs(TArrayView<const double> WorldX, TArrayView<const double> WorldY, TArrayView<const double> WorldZ, TArrayView<int32> CellX, TArrayView<int32> CellY, bool bClamp) const
+{
+	const int32 Count = WorldX.Num();
+	check((WorldY.Num() == Count) && (WorldZ.Num() == Count) && (CellX.Num() == Count) && (CellY.Num() == Count));
+
+	const double* RESTRICT InX = WorldX.GetData();
+	const double* RESTRICT InY = WorldY.GetData();
+	const double* RESTRICT InZ = WorldZ.GetData();
+	int32* RESTRICT OutX = CellX.GetData();
+	int32* RESTRICT OutY = CellY.GetData();
+
+	const double MaxX = double(XCount);
+	const double MaxY = double(YCount);
+
+	for (int32 I = 0; I < Count; I++)
+	{
+		double GX = WorldToGridX.X * InX[I] + WorldToGridX.Y * InY[I] + WorldToGridX.Z * InZ[I] + WorldToGridOffset.X;
+		double GY = WorldToGridY.X * InX[I] + WorldToGridY.Y * InY[I] + WorldToGridY.Z * InZ[I] + WorldToGridOffset.Y;
+
+		// Same rules as GetCellRef
+		const bool bInside = (GX >= 0.0) && (GX <= MaxX) && (GY >= 0.0) && (GY <= MaxY);
+
+		GX = FMath::Clamp(GX, 0.0, MaxX);
+		GY = FMath::Clamp(GY, 0.0, MaxY);
+
+		const int32 X = FMath::Clamp(FMath::FloorToInt32(GX), 0, XCount - 1);
+		const int32 Y = FMath::Clamp(FMath::FloorToInt32(GY), 0, YCount - 1);
+
+		OutX[I] = (bInside || bClamp) ? X : INDEX_NONE;
+		OutY[I] = (bInside || bClamp) ? Y : INDEX_NONE;
+	}
+}
+
+void AGAGridActor::GetCellPositions(TArrayView<const FCellRef> Cells, TArrayView<FVector> PositionsOut) const
+{
+	check(PositionsOut.Num() == Cells.Num());
+
+	const bool bUseTable = (CellPositions.Num() == GetStorageCount());
+	const FVector Origin = GridOrigin + 0.5 * (GridAxisX + GridAxisY);
+
+	for (int32 I = 0; I < Cells.Num(); I++)
+	{
+		const FCellRef& Cell = Cells[I];
+		PositionsOut[I] = (bUseTable && IsValidCell(Cell)) ? CellPositions[CellRefToIndex(Cell)] : Origin + GridAxisX * double(Cell.X) + GridAxisY * double(Cell.Y);
+	}
+}
+
+void AGAGridActor::GetCellRefs(TArrayView<const FVector> Points, TArrayView<FCellRef> CellsOut, bool bClamp) const
+{
+	check(CellsOut.Num() == Points.Num());
+
+	for (int32 I = 0; I < Points.Num(); I++)
+	{
+		CellsOut[I] = GetCellRef(Points[I], bClamp);
+	}
 }
 
 FVector2D AGAGridActor::GetCellGridSpacePosition(const FCellRef& CellRef) const
@@ -187,11 +412,24 @@ bool AGAGridActor::GridSpaceBoundsToRect2D(const FBox2D& Box, FIntRect &RectOut)
 
 void AGAGridActor::GetNeighbors(const FCellRef& Cell, bool OnlyTraversable, TArray<FCellRef> &Neighbors) const
 {
+	if (OnlyTraversable && HasDerivedTables() && IsValidCell(Cell))
+	{
+		// Fast path -- the traversable neighbors are already sitting in a bitmask
+		uint32 Mask = NeighborMasks[CellRefToIndex(Cell)];
+		while (Mask)
+		{
+			int32 Bit = FMath::CountTrailingZeros(Mask);
+			Mask &= Mask - 1;
+			Neighbors.Add(FCellRef(Cell.X + NeighborOffsets[Bit].X, Cell.Y + NeighborOffsets[Bit].Y));
+		}
+		return;
+	}
+
 	for (int32 Y = Cell.Y -1; Y <= Cell.Y + 1; Y++)
 	{
 		for (int32 X = Cell.X - 1; X <= Cell.X + 1; X++)
 		{
-			if ((X != 0) || (Y != 0))
+			if ((X != Cell.X) || (Y != Cell.Y))
 			{
 				FCellRef NCell(X, Y);
 				if (IsValidCell(NCell))
@@ -209,125 +447,242 @@ void AGAGridActor::GetNeighbors(const FCellRef& Cell, bool OnlyTraversable, TArr
 
 void AGAGridActor::TransformPointToNormalizedGridSpace(const FVector& WorldPosition, FVector2D& UniformGridSpacePosition) const
 {
-	// First, transform the point into grid-local space
-	// note, we drop the Z dimension at this point, by casting to a FVector2D
-	FTransform GridTransform = GetActorTransform();
-	FVector2D LocalPoint = FVector2D(GridTransform.InverseTransformPosition(WorldPosition));
-
-	LocalPoint += HalfExtents;		// Now LocalPoint is relative the to the (0, 0) corner of grid
-
-	UniformGridSpacePosition.Set(LocalPoint.X / CellScale, LocalPoint.Y / CellScale);
+	// note, we drop the Z dimension
+	UniformGridSpacePosition.Set((WorldToGridX | WorldPosition) + WorldToGridOffset.X, (WorldToGridY | WorldPosition) + WorldToGridOffset.Y);
 }
 
 
 void AGAGridActor::TransformNormalizedGridSpaceToWorld(const FVector2D& UniformGridSpacePosition, FVector& WorldPosition) const
 {
-	FVector2D GridSpacePoint = UniformGridSpacePosition * CellScale;
-
-	GridSpacePoint -= HalfExtents;
-
-	// First, transform the point into grid-local space
-	// note, we drop the Z dimension at this point, by casting to a FVector2D
-	FTransform GridTransform = GetActorTransform();
-
-	FVector LocalPoint3D(GridSpacePoint, 0.0f);
-
-	WorldPosition = GridTransform.TransformPosition(LocalPoint3D);
+	WorldPosition = GridOrigin + GridAxisX * UniformGridSpacePosition.X + GridAxisY * UniformGridSpacePosition.Y;
 }
 
 
 // Spatial Queries --------------------------------
 
 
-bool AGAGridActor::TraceLine(const FVector& Start, const FVector& End, FVector& HitLocationOut) const
-{
-	FCellRef StartCell = GetCellRef(Start);
-	FCellRef EndCell = GetCellRef(End);
+// The grid DDA, for up to four rays from a common start at once, one ray per SIMD lane.
+// Positions are in normalized grid space relative to StartCell's min corner, which keeps the floats small and the
+// cell coordinates exact. (VX, VY) is each ray's unit direction and L its length; lanes with L ~ 0 are skipped.
+// Returns a mask of the lanes that hit, and for those, how far along the ray the hit was in THit.
+// bSupercover also stops a ray that squeezes diagonally between two cells if either of them is blocked.
+// If Z0 is given, the rays also have a height, Z0 + ZSlope * T, and can pass over a blocked cell when they're above its
+// occluder height (blocked cells are infinitely tall if the heights aren't baked).
+// Whenever a ray is inside a block that the traversability pyramid says is all open, it jumps straight to the
+// block's exit rather than stepping through it, so long traces over open ground take a handful of steps.
 
-	if (StartCell.IsValid())
+static uint32 TraceRays4(const AGAGridActor& Grid, const FCellRef& StartCell, float P0X, float P0Y, const float* VX, const float* VY, const float* L, bool bSupercover, float* THit,
+	const float* Z0 = NULL, const float* ZSlope = NULL)
+{
+	const bool bUseBits = (Grid.TraversableBits.Num() == Grid.XCount * Grid.YCount);
+	const bool bUseHeights = (Z0 != NULL) && Grid.HasOccluderHeights();
+	const FGAGridPyramid& Pyramid = Grid.GetTraversabilityPyramid();
+	const bool bUsePyramid = bUseBits && Pyramid.IsInitialized() && (Pyramid.GetLevelSize(0) == FIntPoint(Grid.XCount, Grid.YCount));
+	const int32 TopLevel = bUsePyramid ? Pyramid.GetLevelCount() - 1 : 0;
+	auto IsClear = [&Grid, bUseBits, bUseHeights](int32 X, int32 Y, float RayZ)
 	{
-		FCellRef CurrentCell = StartCell;
-		FVector2D P0, P1, V;
-		TransformPointToNormalizedGridSpace(Start, P0);
-		TransformPointToNormalizedGridSpace(End, P1);
-
-		V = P1 - P0;
-		float L = V.Size();
-		V.Normalize();
-
-		if (L > UE_KINDA_SMALL_NUMBER)
+		if (!Grid.IsValidCell(FCellRef(X, Y)))
+		{
+			return false;
+		}
+		if (bUseBits ? bool(Grid.TraversableBits[Y * Grid.XCount + X]) : EnumHasAllFlags(Grid.GetCellData(FCellRef(X, Y)), ECellData::CellDataTraversable))
+		{
+			return true;
+		}
+		return bUseHeights && (RayZ > Grid.OccluderHeights[Grid.CellRefToIndex(FCellRef(X, Y))]);
+	};
+
+	const VectorRegister4Float Zero = VectorZeroFloat();
+	const VectorRegister4Float One = VectorOneFloat();
+	const VectorRegister4Float FltMax = VectorSetFloat1(FLT_MAX);
+	const VectorRegister4Float SmallNumber = VectorSetFloat1(UE_SMALL_NUMBER);
+	const VectorRegister4Float KindaSmallNumber = VectorSetFloat1(UE_KINDA_SMALL_NUMBER);
+
+	const VectorRegister4Float P0XVec = VectorSetFloat1(P0X);
+	const VectorRegister4Float P0YVec = VectorSetFloat1(P0Y);
+	const VectorRegister4Float VXVec = VectorLoad(VX);
+	const VectorRegister4Float VYVec = VectorLoad(VY);
+	const VectorRegister4Float LVec = VectorLoad(L);
+
+	// The plane each ray breaks next is on the far side of its cell (a zero component heads for the +1 plane, but
+	// never gets there), and each step moves one cell towards it
+	const VectorRegister4Float DX = VectorSelect(VectorCompareGE(VXVec, Zero), One, Zero);
+	const VectorRegister4Float DY = VectorSelect(VectorCompareGE(VYVec, Zero), One, Zero);
+	const VectorRegister4Float StepX = VectorSelect(VectorCompareGT(VXVec, Zero), One, VectorNegate(One));
+	const VectorRegister4Float StepY = VectorSelect(VectorCompareGT(VYVec, Zero), One, VectorNegate(One));
+	const VectorRegister4Float XMoves = VectorCompareGT(VectorAbs(VXVec), KindaSmallNumber);
+	const VectorRegister4Float YMoves = VectorCompareGT(VectorAbs(VYVec), KindaSmallNumber);
+
+	alignas(16) float StepXLanes[4];
+	alignas(16) float StepYLanes[4];
+	VectorStoreAligned(StepX, StepXLanes);
+	VectorStoreAligned(StepY, StepYLanes);
+
+	VectorRegister4Float CX = Zero;
+	VectorRegister4Float CY = Zero;
+
+	uint32 Active = VectorMaskBits(VectorCompareGT(LVec, KindaSmallNumber));
+	uint32 Hits = 0;
+
+	alignas(16) float CellX[4];
+	alignas(16) float CellY[4];
+	alignas(16) float T[4];
+
+	while (Active)
+	{
+		if (TopLevel > 0)
 		{
-			int32 DX = (V.X >= 0) ? 1 : 0;
-			int32 DY = (V.Y >= 0) ? 1 : 0;
+			VectorStoreAligned(CX, CellX);
+			VectorStoreAligned(CY, CellY);
 
-			while (true)
+			bool bJumped = false;
+			for (uint32 Lanes = Active; Lanes; Lanes &= Lanes - 1)
 			{
-				float XPlaneToBreak = float(CurrentCell.X + DX);
-				float YPlaneToBreak = float(CurrentCell.Y + DY);
+				const int32 Lane = FMath::CountTrailingZeros(Lanes);
+				const int32 X = StartCell.X + int32(CellX[Lane]);
+				const int32 Y = StartCell.Y + int32(CellY[Lane]);
 
-				float TX, TY;
-
-				// We need to figure out where the ray (P0, V) breaks the plane at x = XPlaneToBreak
-				// and where it breaks the plane at y = YPlaneToBreak
-
-				// The following equations hold at the intersections in question
-				// P0x + VxT = Xp		==>		T = (Xp - P0x) / Vx
-				// P0y + VyT = Yp		==>		T = (Yp - P0y) / Vy
-
-				if (FMath::Abs(V.X) > UE_KINDA_SMALL_NUMBER)
-				{
-					TX = (XPlaneToBreak - P0.X) / V.X;
-				}
-				else
+				// Find the biggest open block we're in
+				int32 Level = 0;
+				while ((Level < TopLevel) && (Pyramid.GetBlockCoverage(Level + 1, X, Y) == EGridCoverage::Open))
 				{
-					TX = FLT_MAX;
+					Level++;
 				}
 
-				if (FMath::Abs(V.Y) > UE_KINDA_SMALL_NUMBER)
-				{
-					TY = (YPlaneToBreak - P0.Y) / V.Y;
-				}
-				else
+				if (Level == 0)
 				{
-					TY = FLT_MAX;
+					continue;
 				}
 
-				float T = FMath::Min(TX, TY);
-				if (T >= L)
-				{
-					// We got to the destination!
-					return false;
-				}
+				// Nothing in the block can stop us, so skip to where the ray leaves it
+				const float BX0 = float(((X >> Level) << Level) - StartCell.X);
+				const float BY0 = float(((Y >> Level) << Level) - StartCell.Y);
+				const float BX1 = BX0 + float(1 << Level);
+				const float BY1 = BY0 + float(1 << Level);
 
-				if (FMath::Abs(TX - TY) < UE_SMALL_NUMBER)
-				{
-					// advance both
-					CurrentCell.X = (V.X > 0) ? CurrentCell.X + 1 : CurrentCell.X - 1;
-					CurrentCell.Y = (V.Y > 0) ? CurrentCell.Y + 1 : CurrentCell.Y - 1;
-				}
-				else if (TX <= TY)
-				{
-					// advance X
-					CurrentCell.X = (V.X > 0) ? CurrentCell.X + 1 : CurrentCell.X - 1;
-				}
-				else
+				const float TX = (FMath::Abs(VX[Lane]) > UE_KINDA_SMALL_NUMBER) ? (((VX[Lane] >= 0.0f) ? BX1 : BX0) - P0X) / VX[Lane] : FLT_MAX;
+				const float TY = (FMath::Abs(VY[Lane]) > UE_KINDA_SMALL_NUMBER) ? (((VY[Lane] >= 0.0f) ? BY1 : BY0) - P0Y) / VY[Lane] : FLT_MAX;
+
+				if (FMath::Min(TX, TY) >= L[Lane])
 				{
-					// advance Y
-					CurrentCell.Y = (V.Y > 0) ? CurrentCell.Y + 1 : CurrentCell.Y - 1;
+					// The end point is in the block too, so we're clear
+					Active &= ~(1 << Lane);
+					continue;
 				}
 
-				if (IsValidCell(CurrentCell) && EnumHasAllFlags(GetCellData(CurrentCell), ECellData::CellDataTraversable))
+				// Put the ray in the last cell it touches before it leaves, and let the DDA take the step out.
+				// The clamp keeps rounding from pushing us out of the block when the exit is right at a corner.
+				if (TX <= TY)
 				{
-					// we're good, iterate
+					CellX[Lane] = (VX[Lane] >= 0.0f) ? BX1 - 1.0f : BX0;
+					CellY[Lane] = FMath::Clamp(FMath::FloorToFloat(P0Y + VY[Lane] * TX), BY0, BY1 - 1.0f);
 				}
 				else
 				{
-					// nope we hit
-					FVector2D HitLocationLocal = P0 + V * T;
-					TransformNormalizedGridSpaceToWorld(HitLocationLocal, HitLocationOut);
-					return true;
+					CellX[Lane] = FMath::Clamp(FMath::FloorToFloat(P0X + VX[Lane] * TY), BX0, BX1 - 1.0f);
+					CellY[Lane] = (VY[Lane] >= 0.0f) ? BY1 - 1.0f : BY0;
 				}
+				bJumped = true;
+			}
+
+			if (bJumped)
+			{
+				CX = VectorLoadAligned(CellX);
+				CY = VectorLoadAligned(CellY);
+			}
+
+			if (!Active)
+			{
+				break;
+			}
+		}
+
+		// Where the ray (P0, V) breaks the next X plane and the next Y plane:
+		// P0x + VxT = Xp		==>		T = (Xp - P0x) / Vx
+		const VectorRegister4Float TX = VectorSelect(XMoves, VectorDivide(VectorSubtract(VectorAdd(CX, DX), P0XVec), VXVec), FltMax);
+		const VectorRegister4Float TY = VectorSelect(YMoves, VectorDivide(VectorSubtract(VectorAdd(CY, DY), P0YVec), VYVec), FltMax);
+		const VectorRegister4Float TMin = VectorMin(TX, TY);
+
+		// Anybody who gets to their end point first is clear
+		Active &= ~uint32(VectorMaskBits(VectorCompareGE(TMin, LVec)));
+
+		// Step X, Y, or (if the ray goes through the corner) both
+		const VectorRegister4Float Both = VectorCompareLT(VectorAbs(VectorSubtract(TX, TY)), SmallNumber);
+		const VectorRegister4Float AdvanceX = VectorBitwiseOr(Both, VectorCompareLE(TX, TY));
+		const VectorRegister4Float AdvanceY = VectorBitwiseOr(Both, VectorCompareGT(TX, TY));
+		CX = VectorAdd(CX, VectorBitwiseAnd(AdvanceX, StepX));
+		CY = VectorAdd(CY, VectorBitwiseAnd(AdvanceY, StepY));
+
+		const uint32 Diagonal = VectorMaskBits(Both);
+		VectorStoreAligned(CX, CellX);
+		VectorStoreAligned(CY, CellY);
+		VectorStoreAligned(TMin, T);
+
+		// The grid lookups are the one part that doesn't vectorize
+		for (uint32 Lanes = Active; Lanes; Lanes &= Lanes - 1)
+		{
+			const int32 Lane = FMath::CountTrailingZeros(Lanes);
+			const int32 X = StartCell.X + int32(CellX[Lane]);
+			const int32 Y = StartCell.Y + int32(CellY[Lane]);
+
+			// The lowest the ray gets while it's in the cell. It can't be in there for more than a diagonal.
+			float RayZ = 0.0f;
+			if (bUseHeights)
+			{
+				RayZ = Z0[Lane] + ZSlope[Lane] * ((ZSlope[Lane] >= 0.0f) ? T[Lane] : FMath::Min(T[Lane] + UE_SQRT_2, L[Lane]));
+			}
+
+			bool bBlocked = !IsClear(X, Y, RayZ);
+			if (!bBlocked && bSupercover && (Diagonal & (1 << Lane)))
+			{
+				bBlocked = !IsClear(X - int32(StepXLanes[Lane]), Y, RayZ) || !IsClear(X, Y - int32(StepYLanes[Lane]), RayZ);
 			}
+
+			if (bBlocked)
+			{
+				Hits |= 1 << Lane;
+				Active &= ~(1 << Lane);
+				THit[Lane] = T[Lane];
+			}
+		}
+	}
+
+	return Hits;
+}
+
+
+static bool TraceOneLine(const AGAGridActor& Grid, const FVector& Start, const FVector& End, bool bUseHeights, FVector& HitLocationOut)
+{
+	FCellRef StartCell = Grid.GetCellRef(Start);
+
+	if (StartCell.IsValid())
+	{
+		FVector2D P0, P1, V;
+		Grid.TransformPointToNormalizedGridSpace(Start, P0);
+		Grid.TransformPointToNormalizedGridSpace(End, P1);
+
+		V = P1 - P0;
+		float L = V.Size();
+		V.Normalize();
+
+		if (L > UE_KINDA_SMALL_NUMBER)
+		{
+			// One lane of the batched trace, so that TraceLine and TraceLines always agree
+			const FVector2D Origin(StartCell.X, StartCell.Y);
+			alignas(16) float VX[4] = { float(V.X), 0.0f, 0.0f, 0.0f };
+			alignas(16) float VY[4] = { float(V.Y), 0.0f, 0.0f, 0.0f };
+			alignas(16) float Lengths[4] = { L, 0.0f, 0.0f, 0.0f };
+			alignas(16) float Z0[4] = { float(Start.Z), 0.0f, 0.0f, 0.0f };
+			alignas(16) float ZSlope[4] = { float(End.Z - Start.Z) / L, 0.0f, 0.0f, 0.0f };
+			float T[4];
+
+			if (TraceRays4(Grid, StartCell, float(P0.X - Origin.X), float(P0.Y - Origin.Y), VX, VY, Lengths, false, T, bUseHeights ? Z0 : NULL, ZSlope) & 1)
+			{
+				FVector2D HitLocationLocal = P0 + V * T[0];
+				Grid.TransformNormalizedGridSpaceToWorld(HitLocationLocal, HitLocationOut);
+				return true;
+			}
+			return false;
 		}
 		else
 		{
@@ -343,127 +698,1356 @@ bool AGAGridActor::TraceLine(const FVector& Start, const FVector& End, FVector&
 }
 
 
+static int32 TraceManyLines(const AGAGridActor& Grid, const FVector& Start, TArrayView<const FVector> Ends, TBitArray<>& HitsOut, TArray<float>* DistancesOut, bool bSupercover, bool bUseHeights)
+{
+	const int32 Count = Ends.Num();
+	const FCellRef StartCell = Grid.GetCellRef(Start);
 
+	if (!StartCell.IsValid())
+	{
+		// Same as TraceLine, starting off the grid is an immediate hit
+		HitsOut.Init(true, Count);
+		if (DistancesOut)
+		{
+			DistancesOut->Init(0.0f, Count);
+		}
+		return Count;
+	}
 
-// Data from NavSystem --------------------------------
+	HitsOut.Init(false, Count);
+	if (DistancesOut)
+	{
+		DistancesOut->SetNumUninitialized(Count);
+	}
 
-bool AGAGridActor::RefreshDataFromNav()
-{
-	bool Result = false;
-	UNavigationSystemV1 *NavSystem = UNavigationSystemV1::GetNavigationSystem(this);
-	if (NavSystem)
+	FVector2D P0;
+	Grid.TransformPointToNormalizedGridSpace(Start, P0);
+	const FVector2D P0Local = P0 - FVector2D(StartCell.X, StartCell.Y);
+
+	int32 HitCount = 0;
+
+	for (int32 First = 0; First < Count; First += 4)
 	{
-		INavigationDataInterface* NavData = NavSystem->GetMainNavData();		// Note: only using the default nav data here
-		const ARecastNavMesh* NavMesh = Cast<ARecastNavMesh>(NavData);
-		FTransform ActorTransform = GetActorTransform();
+		const int32 LaneCount = FMath::Min(Count - First, 4);
 
-		// Allocate the array and set to 0
-		ResetData();
+		alignas(16) float VX[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		alignas(16) float VY[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		alignas(16) float Lengths[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		alignas(16) float Z0[4] = { float(Start.Z), float(Start.Z), float(Start.Z), float(Start.Z) };
+		alignas(16) float ZSlope[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float T[4];
 
-		ECellData* CellData = GetData();
+		for (int32 Lane = 0; Lane < LaneCount; Lane++)
+		{
+			FVector2D P1;
+			Grid.TransformPointToNormalizedGridSpace(Ends[First + Lane], P1);
+
+			FVector2D V = P1 - P0;
+			Lengths[Lane] = V.Size();
+			V.Normalize();
+			VX[Lane] = V.X;
+			VY[Lane] = V.Y;
+			ZSlope[Lane] = (Lengths[Lane] > UE_KINDA_SMALL_NUMBER) ? float(Ends[First + Lane].Z - Start.Z) / Lengths[Lane] : 0.0f;
+		}
 
-		// Code for extracting nav polys taken from here:
-		// https://nerivec.github.io/old-ue4-wiki/pages/ai-navigation-in-c-customize-path-following-every-tick.html
+		const uint32 Hits = TraceRays4(Grid, StartCell, P0Local.X, P0Local.Y, VX, VY, Lengths, bSupercover, T, bUseHeights ? Z0 : NULL, ZSlope);
 
-		for (int32 TileIndex = 0; TileIndex < NavMesh->GetNavMeshTilesCount(); TileIndex++)
+		for (int32 Lane = 0; Lane < LaneCount; Lane++)
 		{
-			const FBox TileBounds = NavMesh->GetNavMeshTileBounds(TileIndex);
-			if (TileBounds.IsValid)			// reportedly will crash if this is not checked
+			const bool bHit = (Hits & (1 << Lane)) != 0;
+			HitsOut[First + Lane] = bHit;
+			HitCount += bHit ? 1 : 0;
+
+			if (DistancesOut)
 			{
-				TArray<FNavPoly> Polys;
+				// T is in grid cells along the ray; scale it back to the world-space segment
+				const float WorldLength = FVector::Dist(Start, Ends[First + Lane]);
+				(*DistancesOut)[First + Lane] = bHit ? WorldLength * (T[Lane] / Lengths[Lane]) : WorldLength;
+			}
+		}
+	}
 
-				if (NavMesh->GetPolysInTile(TileIndex, Polys))
-				{
-					for (FNavPoly& NavPoly : Polys)
-					{
-						TArray<FVector> PolyVerts;
-						TArray<FVector2D> PolyVerts2D;
-						NavNodeRef Ref = NavPoly.Ref;
+	return HitCount;
+}
 
-						NavMesh->GetPolyVerts(Ref, PolyVerts);
-						PolyVerts2D.SetNum(PolyVerts.Num());
 
-						// transform verts to local space
-						for (int32 VertexIndex = 0; VertexIndex < PolyVerts.Num(); VertexIndex++)
-						{
-							PolyVerts2D[VertexIndex] = FVector2D(ActorTransform.InverseTransformPosition(PolyVerts[VertexIndex])) + HalfExtents;
-						}
+bool AGAGridActor::TraceLine(const FVector& Start, const FVector& End, FVector& HitLocationOut) const
+{
+	return TraceOneLine(*this, Start, End, false, HitLocationOut);
+}
 
-						{
-							FBox2D PolyBounds(EForceInit::ForceInit);
-							for (const FVector2D& Vert : PolyVerts2D)
-							{
-								PolyBounds += Vert;
-							}
+int32 AGAGridActor::TraceLines(const FVector& Start, TArrayView<const FVector> Ends, TBitArray<>& HitsOut, TArray<float>* DistancesOut, bool bSupercover) const
+{
+	return TraceManyLines(*this, Start, Ends, HitsOut, DistancesOut, bSupercover, false);
+}
 
-							FIntRect GridBox;
-							if (GridSpaceBoundsToRect2D(PolyBounds, GridBox))
-							{
-								TArray<FVector2D> OutsideVectors;
-								OutsideVectors.SetNum(PolyVerts2D.Num());
-
-								// Cache off a set of "outside vectors", so that we can test each cell in the box against the
-								// bounds of the polygons
-
-								for (int32 V0Index = 0; V0Index < PolyVerts2D.Num(); V0Index++)
-								{
-									int32 V1Index = (V0Index + 1) % PolyVerts2D.Num();
-									FVector2D& V0 = PolyVerts2D[V0Index];
-									FVector2D& V1 = PolyVerts2D[V1Index];
-									FVector2D V0V1 = V1 - V0;
-
-									// Rotate 90 degrees
-									FVector2D &OutsideVector = OutsideVectors[V0Index];
-									OutsideVector.X = -V0V1.Y;
-									OutsideVector.Y = V0V1.X;
-								}
-
-								// Grid box now represents the intersection between Grid and the poly in question.
-								// Check each cell in the box to see if it's inside the poly
-
-								// Note, this is way inefficient
-								// A smarter way would be to use some kind of rasterization approach
-
-								for (int Y = GridBox.Min.Y; Y <= GridBox.Max.Y; Y++)
-								{
-									for (int X = GridBox.Min.X; X <= GridBox.Max.X; X++)
-									{
-										FCellRef CellRef(X, Y);
-										FVector2D CellCenter = GetCellGridSpacePosition(CellRef);
-										bool IsOutside = false;
-
-										for (int32 V0Index = 0; (V0Index < PolyVerts2D.Num()) && !IsOutside; V0Index++)
-										{
-											FVector2D& V0 = PolyVerts2D[V0Index];
-											FVector2D &OutsideVector = OutsideVectors[V0Index];
-											FVector2D V0Cell = CellCenter - V0;
-
-											if ((V0Cell | OutsideVector) > 0.0f)		// Dot product
-											{
-												// the cell is outside this edge
-												IsOutside = true;
-											}
-										}
-
-										int32 CellIndex = CellRefToIndex(CellRef);
-										if (!IsOutside)
-										{
-											// turn on the traversable bit
-											EnumAddFlags(CellData[CellIndex], ECellData::CellDataTraversable);
-										}
-									}
-								}
-							}
-						}
-					}
-				}
+bool AGAGridActor::TraceLineOfSight(const FVector& Start, const FVector& End, FVector& HitLocationOut) const
+{
+	return TraceOneLine(*this, Start, End, true, HitLocationOut);
+}
+
+int32 AGAGridActor::TraceLinesOfSight(const FVector& Start, TArrayView<const FVector> Ends, TBitArray<>& HitsOut) const
+{
+	return TraceManyLines(*this, Start, Ends, HitsOut, NULL, false, true);
+}
+
+
+
+
+// Data from NavSystem --------------------------------
+
+ARecastNavMesh* AGAGridActor::GetNavMesh()
+{
+	UNavigationSystemV1 *NavSystem = UNavigationSystemV1::GetNavigationSystem(this);
+	if (NavSystem)
+	{
+		INavigationDataInterface* NavData = NavSystem->GetMainNavData();		// Note: only using the default nav data here
+		return Cast<ARecastNavMesh>(NavData);
+	}
+	return NULL;
+}
+
+FGAGridRasterParams AGAGridActor::MakeRasterParams() const
+{
+	FGAGridRasterParams Params;
+	Params.XCount = XCount;
+	Params.YCount = YCount;
+	Params.CellScale = CellScale;
+	Params.Clip = FIntRect(0, 0, XCount - 1, YCount - 1);
+	return Params;
+}
+
+void AGAGridActor::ApplyRasterizedCells(const FGAGridRasterParams& Params, const uint8* Cells)
+{
+	ECellData* CellData = GetData();
+	int32 Index = 0;
+
+	for (int32 Y = Params.Clip.Min.Y; Y <= Params.Clip.Max.Y; Y++)
+	{
+		for (int32 X = Params.Clip.Min.X; X <= Params.Clip.Max.X; X++)
+		{
+			int32 CellIndex = CellRefToIndex(FCellRef(X, Y));
+			if (Cells[Index])
+			{
+				// turn on the traversable bit
+				EnumAddFlags(CellData[CellIndex], ECellData::CellDataTraversable);
+			}
+			else
+			{
+				EnumRemoveFlags(CellData[CellIndex], ECellData::CellDataTraversable);
 			}
+			Index++;
 		}
 	}
+}
 
+bool AGAGridActor::RefreshDataFromNav()
+{
+	const ARecastNavMesh* NavMesh = GetNavMesh();
+	if (NavMesh == NULL)
+	{
+		return false;
+	}
+
+	// A blocking refresh supersedes anything in flight
+	if (PendingBake.IsValid())
+	{
+		PendingBake->Cancelled.Set(1);
+		PendingBake.Reset();
+	}
+
+	FGAGridCacheKey CacheKey;
+	bool bHasCacheKey = MakeGridCacheKey(NavMesh, CacheKey);
+	if (bUseGridCache && bHasCacheKey && LoadGridCache(CacheKey))
+	{
+		// Nothing changed since the last bake
+		BuildTileStamps(NavMesh, TileStamps);
+		OnBakeFinished(true);
+		return true;
+	}
+
+	// Code for extracting nav polys originally taken from here:
+	// https://nerivec.github.io/old-ue4-wiki/pages/ai-navigation-in-c-customize-path-following-every-tick.html
+
+	FGANavPolySoup Soup;
+	if (!FGANavRasterizer::GatherNavPolys(NavMesh, GetActorTransform(), HalfExtents, NULL, Soup))
+	{
+		return false;
+	}
+
+	BuildTileStamps(NavMesh, TileStamps);
+
+	FGAGridRasterParams Params = MakeRasterParams();
+	TArray<uint8> Cells;
+	Cells.SetNumZeroed(GetCellCount());
+
+	FGANavRasterizer::RasterizeTiles(Soup, Params, Cells.GetData());
+
+	// Allocate the array and set to 0
+	ResetData();
+	ApplyRasterizedCells(Params, Cells.GetData());
+
+	OnBakeFinished();
+
+	if (bUseGridCache && bHasCacheKey)
+	{
+		SaveGridCache(CacheKey);
+	}
+	return true;
+}
+
+bool AGAGridActor::RefreshDataFromNavAsync()
+{
+	if (PendingBake.IsValid())
+	{
+		return false;
+	}
+
+	const ARecastNavMesh* NavMesh = GetNavMesh();
+	if (NavMesh == NULL)
+	{
+		return false;
+	}
+
+	TSharedPtr<FGAGridBakeState, ESPMode::ThreadSafe> BakeState = MakeShared<FGAGridBakeState, ESPMode::ThreadSafe>();
+
+	BakeState->bHasCacheKey = MakeGridCacheKey(NavMesh, BakeState->CacheKey);
+	if (bUseGridCache && BakeState->bHasCacheKey && LoadGridCache(BakeState->CacheKey))
+	{
+		// Nothing changed since the last bake, so there's no need to go wide. Loading is quick.
+		BuildTileStamps(NavMesh, TileStamps);
+		OnBakeFinished(true);
+		return true;
+	}
+
+	// Snapshot the nav mesh now, on the game thread. After this point the workers never look at it.
+	if (!FGANavRasterizer::GatherNavPolys(NavMesh, GetActorTransform(), HalfExtents, NULL, BakeState->Soup))
+	{
+		return false;
+	}
+
+	BuildTileStamps(NavMesh, BakeState->TileStamps);
+
+	BakeState->Params = MakeRasterParams();
+	BakeState->Cells.SetNumZeroed(GetCellCount());
+	PendingBake = BakeState;
+
+	TWeakObjectPtr<AGAGridActor> WeakThis(this);
+
+	Async(EAsyncExecution::ThreadPool, [BakeState, WeakThis]()
+	{
+		FGANavRasterizer::RasterizeTiles(BakeState->Soup, BakeState->Params, BakeState->Cells.GetData(), &BakeState->TilesDone, &BakeState->Cancelled);
+
+		// Hand the results back to the game thread. The actor may be gone by then.
+		AsyncTask(ENamedThreads::GameThread, [BakeState, WeakThis]()
+		{
+			AGAGridActor* GridActor = WeakThis.Get();
+			if (GridActor)
+			{
+				GridActor->FinishBake(BakeState);
+			}
+		});
+	});
+
+	return true;
+}
+
+void AGAGridActor::FinishBake(TSharedPtr<FGAGridBakeState, ESPMode::ThreadSafe> BakeState)
+{
+	if ((PendingBake != BakeState) || (BakeState->Cancelled.GetValue() != 0))
+	{
+		// Superseded or cancelled while we were working
+		return;
+	}
+
+	PendingBake.Reset();
+
+	if ((BakeState->Params.XCount != XCount) || (BakeState->Params.YCount != YCount) || (BakeState->Params.CellScale != CellScale))
+	{
+		// The grid was resized out from under us, so the results don't line up anymore
+		UE_LOG(LogTemp, Warning, TEXT("AGAGridActor: grid dimensions changed during a nav bake, discarding the results."));
+		return;
+	}
+
+	ResetData();
+	ApplyRasterizedCells(BakeState->Params, BakeState->Cells.GetData());
+	TileStamps = MoveTemp(BakeState->TileStamps);
+
+	OnBakeFinished();
+
+	if (bUseGridCache && BakeState->bHasCacheKey)
+	{
+		SaveGridCache(BakeState->CacheKey);
+	}
+
+	// We skipped any nav changes that came in while we were baking -- catch up on them now
+	if (bRefreshOnNavChange)
+	{
+		RefreshDataFromNavChangedTiles();
+	}
+}
+
+void AGAGridActor::OnBakeFinished(bool bDerivedTablesValid)
+{
+	TArray<FIntRect> AllCells;
+	AllCells.Add(FIntRect(0, 0, XCount - 1, YCount - 1));
+	NotifyCellsChanged(AllCells, !bDerivedTablesValid);
+
+	if (bBakeVisibilityOnGridReady)
+	{
+		BakeVisibility();
+	}
+
+	if (bBakeOccluderHeightsOnGridReady)
+	{
+		BakeOccluderHeights();
+	}
+
+	OnGridReady.Broadcast(this);
+}
+
+
+// Incremental refresh --------------------------------
+
+// Add Rect to Rects, merging it with anything it overlaps or touches
+static void AddDirtyRect(TArray<FIntRect>& Rects, FIntRect Rect)
+{
+	bool bMerged = true;
+	while (bMerged)
+	{
+		bMerged = false;
+		for (int32 Index = 0; Index < Rects.Num(); Index++)
+		{
+			const FIntRect& Other = Rects[Index];
+			if ((Rect.Min.X <= Other.Max.X + 1) && (Other.Min.X <= Rect.Max.X + 1) &&
+				(Rect.Min.Y <= Other.Max.Y + 1) && (Other.Min.Y <= Rect.Max.Y + 1))
+			{
+				// the merged rect may now overlap something we already looked at, so start over
+				Rect.Union(Other);
+				Rects.RemoveAtSwap(Index);
+				bMerged = true;
+				break;
+			}
+		}
+	}
+
+	Rects.Add(Rect);
+}
+
+static bool CellRectsIntersect(const FIntRect& A, const FIntRect& B)
+{
+	return (A.Min.X <= B.Max.X) && (B.Min.X <= A.Max.X) && (A.Min.Y <= B.Max.Y) && (B.Min.Y <= A.Max.Y);
+}
+
+bool AGAGridActor::TileBoundsToCellRect(const FBox& TileBounds, FIntRect& RectOut) const
+{
+	FTransform ActorTransform = GetActorTransform();
+	FBox2D GridSpaceBounds(EForceInit::ForceInit);
+
+	for (int32 Corner = 0; Corner < 8; Corner++)
+	{
+		FVector CornerPoint(
+			(Corner & 1) ? TileBounds.Max.X : TileBounds.Min.X,
+			(Corner & 2) ? TileBounds.Max.Y : TileBounds.Min.Y,
+			(Corner & 4) ? TileBounds.Max.Z : TileBounds.Min.Z);
+
+		GridSpaceBounds += FVector2D(ActorTransform.InverseTransformPosition(CornerPoint)) + HalfExtents;
+	}
+
+	// Pad by a cell, so that float noise along the tile borders can't leave a cell out
+	return GridSpaceBoundsToRect2D(GridSpaceBounds.ExpandBy(CellScale), RectOut);
+}
+
+bool AGAGridActor::BuildTileStamps(const ARecastNavMesh* NavMesh, TArray<FGANavTileStamp>& StampsOut) const
+{
+	TArray<uint32> Salts;
+	if (!FGANavRasterizer::GatherTileSalts(NavMesh, Salts))
+	{
+		StampsOut.Reset();
+		return false;
+	}
+
+	StampsOut.SetNum(Salts.Num());
+	for (int32 TileIndex = 0; TileIndex < Salts.Num(); TileIndex++)
+	{
+		FGANavTileStamp& Stamp = StampsOut[TileIndex];
+		Stamp.Salt = Salts[TileIndex];
+		Stamp.bHasCells = false;
+
+		if (Stamp.Salt != 0)
+		{
+			const FBox TileBounds = NavMesh->GetNavMeshTileBounds(TileIndex);
+			if (TileBounds.IsValid)
+			{
+				Stamp.bHasCells = TileBoundsToCellRect(TileBounds, Stamp.CellRect);
+			}
+		}
+	}
+
+	return true;
+}
+
+void AGAGridActor::OnNavigationGenerationFinished(ANavigationData* NavData)
+{
+	// While a full bake is in flight, FinishBake will catch up on the changes
+	if (bRefreshOnNavChange && !PendingBake.IsValid() && (NavData != NULL) && (NavData == GetNavMesh()))
+	{
+		RefreshDataFromNavChangedTiles();
+	}
+}
+
+bool AGAGridActor::RefreshDataFromNavChangedTiles()
+{
+	if (!IsGridReady() || (TileStamps.Num() == 0))
+	{
+		return false;
+	}
+
+	const ARecastNavMesh* NavMesh = GetNavMesh();
+	TArray<FGANavTileStamp> NewStamps;
+	if (!BuildTileStamps(NavMesh, NewStamps))
+	{
+		return false;
+	}
+
+	// A tile whose salt changed was removed, added or rebuilt. Either way, both where it used to be
+	// and where it is now need another look.
+	TArray<FIntRect> DirtyRects;
+	int32 SlotCount = FMath::Max(TileStamps.Num(), NewStamps.Num());
+
+	for (int32 TileIndex = 0; TileIndex < SlotCount; TileIndex++)
+	{
+		FGANavTileStamp OldStamp = TileStamps.IsValidIndex(TileIndex) ? TileStamps[TileIndex] : FGANavTileStamp();
+		FGANavTileStamp NewStamp = NewStamps.IsValidIndex(TileIndex) ? NewStamps[TileIndex] : FGANavTileStamp();
+
+		if (OldStamp.Salt != NewStamp.Salt)
+		{
+			if (OldStamp.bHasCells)
+			{
+				AddDirtyRect(DirtyRects, OldStamp.CellRect);
+			}
+			if (NewStamp.bHasCells)
+			{
+				AddDirtyRect(DirtyRects, NewStamp.CellRect);
+			}
+		}
+	}
+
+	TileStamps = MoveTemp(NewStamps);
+
+	if (DirtyRects.Num() > 0)
+	{
+		return RefreshDataFromNavRects(DirtyRects);
+	}
+	return true;
+}
+
+bool AGAGridActor::RefreshDataFromNavRects(const TArray<FIntRect>& CellRects)
+{
+	const ARecastNavMesh* NavMesh = GetNavMesh();
+	if ((NavMesh == NULL) || !IsGridReady())
+	{
+		return false;
+	}
+
+	FTransform ActorTransform = GetActorTransform();
+	FGANavPolySoup Soup;
+	TArray<int32> TileIndices;
+	TArray<uint8> Cells;
+
+	for (const FIntRect& CellRect : CellRects)
+	{
+		// Only the tiles that can put cells in this rect
+		TileIndices.Reset();
+		for (int32 TileIndex = 0; TileIndex < TileStamps.Num(); TileIndex++)
+		{
+			const FGANavTileStamp& Stamp = TileStamps[TileIndex];
+			if ((Stamp.Salt != 0) && Stamp.bHasCells && CellRectsIntersect(Stamp.CellRect, CellRect))
+			{
+				TileIndices.Add(TileIndex);
+			}
+		}
+
+		FGAGridRasterParams Params = MakeRasterParams();
+		Params.Clip = CellRect;
+
+		Cells.Reset();
+		Cells.SetNumZeroed(Params.GetClipWidth() * Params.GetClipHeight());
+
+		if (TileIndices.Num() > 0)
+		{
+			FGANavRasterizer::GatherNavPolys(NavMesh, ActorTransform, HalfExtents, &TileIndices, Soup);
+			FGANavRasterizer::RasterizeTiles(Soup, Params, Cells.GetData());
+		}
+
+		// Note, with no tiles left the whole rect just goes untraversable
+		ApplyRasterizedCells(Params, Cells.GetData());
+	}
+
+	NotifyCellsChanged(CellRects);
+	return true;
+}
+
+void AGAGridActor::NotifyCellsChanged(const TArray<FIntRect>& CellRects, bool bRefreshDerivedTables)
+{
+	if (bRefreshDerivedTables)
+	{
+		RefreshDerivedTables(&CellRects);
+	}
+	else
+	{
+		RefreshTraversabilityTables(&CellRects);
+	}
+
+	// Any change can open or close lines of sight anywhere, so a baked table has to be redone
+	if (Visibility.IsBaked() || Visibility.IsBaking())
+	{
+		StartVisibilityRebake();
+	}
+
+	GridVersion++;
+
+	OnCellsChangedNative.Broadcast(this, CellRects);
+
+	if (OnCellsChanged.IsBound())
+	{
+		TArray<FGridBox> ChangedBoxes;
+		for (const FIntRect& CellRect : CellRects)
+		{
+			ChangedBoxes.Add(FGridBox(CellRect));
+		}
+		OnCellsChanged.Broadcast(this, ChangedBoxes);
+	}
+}
+
+bool AGAGridActor::IsGridReady() const
+{
+	return !PendingBake.IsValid() && (XCount * YCount > 0) && (Data.Num() == GetStorageCount());
+}
+
+float AGAGridActor::GetBakeProgress() const
+{
+	if (PendingBake.IsValid())
+	{
+		return PendingBake->GetProgress();
+	}
+	return IsGridReady() ? 1.0f : 0.0f;
+}
+
+
+// Grid Cache --------------------------------
+
+FString AGAGridActor::GetGridCachePath() const
+{
+	UWorld* World = GetWorld();
+	FString MapName = World ? UWorld::RemovePIEPrefix(World->GetMapName()) : FString(TEXT("NoWorld"));
+
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("GridCache"), FString::Printf(TEXT("%s_%s.gagrid"), *MapName, *GetName()));
+}
+
+bool AGAGridActor::MakeGridCacheKey(const ARecastNavMesh* NavMesh, FGAGridCacheKey& KeyOut) const
+{
+	if (!FGANavRasterizer::HashNavMesh(NavMesh, KeyOut.NavHash))
+	{
+		return false;
+	}
+
+	KeyOut.XCount = XCount;
+	KeyOut.YCount = YCount;
+	KeyOut.CellScale = CellScale;
+	KeyOut.Layout = Layout;
+	KeyOut.GridTransform = GetActorTransform();
+	return true;
+}
+
+// File layout:
+//		uint32 FileMagic, int32 FileVersion, FGAGridCacheKey, int32 CellCount
+// CellCount is the storage count, padding included, and the tables are in the grid's layout
+//		ECellData Data[CellCount]
+//		uint8 NeighborMasks[CellCount]
+//		int32 ComponentLabels[CellCount]
+
+bool AGAGridActor::SaveGridCache(const FGAGridCacheKey& Key) const
+{
+	const int32 CellCount = GetStorageCount();
+	if ((Data.Num() != CellCount) || !HasDerivedTables())
+	{
+		return false;
+	}
+
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*GetGridCachePath()));
+	if (!Writer)
+	{
+		return false;
+	}
+
+	FArchive& Ar = *Writer;
+	uint32 Magic = FGAGridCacheKey::FileMagic;
+	int32 Version = FGAGridCacheKey::FileVersion;
+	FGAGridCacheKey KeyCopy = Key;
+	int32 CellCountCopy = CellCount;
+
+	Ar << Magic;
+	Ar << Version;
+	Ar << KeyCopy;
+	Ar << CellCountCopy;
+
+	// The tables are all plain old data, so they go out (and come back in) as raw blocks
+	Ar.Serialize(const_cast<ECellData*>(Data.GetData()), CellCount * sizeof(ECellData));
+	Ar.Serialize(const_cast<uint8*>(NeighborMasks.GetData()), CellCount * sizeof(uint8));
+	Ar.Serialize(const_cast<int32*>(ComponentLabels.GetData()), CellCount * sizeof(int32));
+
+	return Writer->Close();
+}
+
+bool AGAGridActor::LoadGridCache(const FGAGridCacheKey& Key)
+{
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*GetGridCachePath(), FILEREAD_Silent));
+	if (!Reader)
+	{
+		return false;
+	}
+
+	FArchive& Ar = *Reader;
+	uint32 Magic = 0;
+	int32 Version = 0;
+
+	Ar << Magic;
+	Ar << Version;
+	if (Ar.IsError() || (Magic != FGAGridCacheKey::FileMagic) || (Version != FGAGridCacheKey::FileVersion))
+	{
+		return false;
+	}
+
+	FGAGridCacheKey FileKey;
+	int32 CellCount = 0;
+
+	Ar << FileKey;
+	Ar << CellCount;
+	if (Ar.IsError() || !FileKey.Matches(Key) || (CellCount != GetStorageCount()))
+	{
+		return false;
+	}
+
+	const int64 PayloadSize = int64(CellCount) * (sizeof(ECellData) + sizeof(uint8) + sizeof(int32));
+	if (Ar.TotalSize() - Ar.Tell() != PayloadSize)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("AGAGridActor: grid cache %s is truncated, ignoring it."), *GetGridCachePath());
+		return false;
+	}
+
+	// Straight into memory, no per-cell work
+	Data.SetNumUninitialized(CellCount);
+	NeighborMasks.SetNumUninitialized(CellCount);
+	ComponentLabels.SetNumUninitialized(CellCount);
+
+	Ar.Serialize(Data.GetData(), CellCount * sizeof(ECellData));
+	Ar.Serialize(NeighborMasks.GetData(), CellCount * sizeof(uint8));
+	Ar.Serialize(ComponentLabels.GetData(), CellCount * sizeof(int32));
+	NextComponentLabel = 0;
+	for (int32 Label : ComponentLabels)
+	{
+		NextComponentLabel = FMath::Max(NextComponentLabel, Label + 1);
+	}
+
+	if (Ar.IsError())
+	{
+		ResetData();
+		RefreshDerivedTables();
+		return false;
+	}
+
+	return true;
+}
+
+
+bool AGAGridActor::WriteTraversabilityLayer(const FString& Path) const
+{
+	return FGAMappedGridLayer::Write(Path, *this);
+}
+
+bool AGAGridActor::ReadTraversabilityLayer(const FString& Path)
+{
+	FGAGridMap Layer;
+	if (!Layer.MapFromFile(Path))
+	{
+		return false;
+	}
+
+	if ((XCount * YCount <= 0) || (Layer.XCount != XCount) || (Layer.YCount != YCount) ||
+		(Layer.GridBounds.MinX != 0) || (Layer.GridBounds.MaxX != XCount - 1) ||
+		(Layer.GridBounds.MinY != 0) || (Layer.GridBounds.MaxY != YCount - 1) ||
+		(Layer.MappedLayer->GetHeader().ElementType != EGAGridLayerElement::UInt8))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("AGAGridActor: %s isn't a traversability layer for this %d x %d grid, ignoring it."), *Path, XCount, YCount);
+		return false;
+	}
+
+	// A bake in flight would stomp what we're about to read
+	if (PendingBake.IsValid())
+	{
+		PendingBake->Cancelled.Set(1);
+		PendingBake.Reset();
+	}
+
+	Data.SetNumZeroed(GetStorageCount());
+	ECellData* CellData = GetData();
+	const FGAMappedGridLayer& Mapped = *Layer.MappedLayer;
+
+	for (int32 Y = 0; Y < YCount; Y++)
+	{
+		for (int32 X = 0; X < XCount; X++)
+		{
+			CellData[CellRefToIndex(FCellRef(X, Y))] = ECellData(uint8(Mapped.GetValue(X, Y)));
+		}
+	}
+
+	TArray<FIntRect> AllCells;
+	AllCells.Add(FIntRect(0, 0, XCount - 1, YCount - 1));
+	NotifyCellsChanged(AllCells);
+	return true;
+}
+
+
+// Derived Tables --------------------------------
+
+bool AGAGridActor::HasDerivedTables() const
+{
+	return (Data.Num() > 0) && (NeighborMasks.Num() == Data.Num()) && (ComponentLabels.Num() == Data.Num());
+}
+
+void AGAGridActor::RefreshNeighborMasks(const FIntRect& CellRect)
+{
+	for (int32 Y = CellRect.Min.Y; Y <= CellRect.Max.Y; Y++)
+	{
+		for (int32 X = CellRect.Min.X; X <= CellRect.Max.X; X++)
+		{
+			uint8 Mask = 0;
+			for (int32 Bit = 0; Bit < 8; Bit++)
+			{
+				FCellRef NCell(X + NeighborOffsets[Bit].X, Y + NeighborOffsets[Bit].Y);
+				if (IsValidCell(NCell) && EnumHasAllFlags(GetCellData(NCell), ECellData::CellDataTraversable))
+				{
+					Mask |= uint8(1 << Bit);
+				}
+			}
+			NeighborMasks[CellRefToIndex(FCellRef(X, Y))] = Mask;
+		}
+	}
+}
+
+void AGAGridActor::RefreshDerivedTables(const TArray<FIntRect>* CellRects)
+{
+	const int32 CellCount = GetStorageCount();
+	if ((XCount * YCount <= 0) || (Data.Num() != CellCount))
+	{
+		NeighborMasks.Empty();
+		ComponentLabels.Empty();
+		TraversableBits.Empty();
+		TraversabilityPyramid.Reset();
+		ClearanceMap = FGAGridMapU16();
+		return;
+	}
+
+	RefreshTraversabilityTables(CellRects);
+
+	// A cell's neighbor mask can only change if something within one cell of it changed
+	if ((CellRects == NULL) || (NeighborMasks.Num() != CellCount))
+	{
+		NeighborMasks.SetNumZeroed(CellCount);
+		RefreshNeighborMasks(FIntRect(0, 0, XCount - 1, YCount - 1));
+	}
+	else
+	{
+		for (const FIntRect& CellRect : *CellRects)
+		{
+			FIntRect Expanded(
+				FMath::Max(CellRect.Min.X - 1, 0), FMath::Max(CellRect.Min.Y - 1, 0),
+				FMath::Min(CellRect.Max.X + 1, XCount - 1), FMath::Min(CellRect.Max.Y + 1, YCount - 1));
+			RefreshNeighborMasks(Expanded);
+		}
+	}
+
+	RefreshComponentLabels(CellRects);
+}
+
+void AGAGridActor::FloodComponentLabel(const FCellRef& Seed, int32 Label, TArray<FCellRef>& Stack)
+{
+	ComponentLabels[CellRefToIndex(Seed)] = Label;
+	Stack.Reset();
+	Stack.Add(Seed);
+
+	while (Stack.Num() > 0)
+	{
+		FCellRef Cell = Stack.Pop(false);
+		uint32 Mask = NeighborMasks[CellRefToIndex(Cell)];
+
+		while (Mask)
+		{
+			int32 Bit = FMath::CountTrailingZeros(Mask);
+			Mask &= Mask - 1;
+
+			FCellRef NCell(Cell.X + NeighborOffsets[Bit].X, Cell.Y + NeighborOffsets[Bit].Y);
+			int32 NIndex = CellRefToIndex(NCell);
+			if (ComponentLabels[NIndex] == INDEX_NONE)
+			{
+				ComponentLabels[NIndex] = Label;
+				Stack.Add(NCell);
+			}
+		}
+	}
+}
+
+void AGAGridActor::RefreshComponentLabels(const TArray<FIntRect>* CellRects)
+{
+	const int32 CellCount = GetStorageCount();
+	TArray<FCellRef> Stack;
+
+	if ((CellRects == NULL) || (ComponentLabels.Num() != CellCount))
+	{
+		ComponentLabels.Init(INDEX_NONE, CellCount);
+		NextComponentLabel = 0;
+
+		for (int32 Y = 0; Y < YCount; Y++)
+		{
+			for (int32 X = 0; X < XCount; X++)
+			{
+				FCellRef Seed(X, Y);
+				int32 SeedIndex = CellRefToIndex(Seed);
+				if ((ComponentLabels[SeedIndex] == INDEX_NONE) && EnumHasAllFlags(Data[SeedIndex], ECellData::CellDataTraversable))
+				{
+					FloodComponentLabel(Seed, NextComponentLabel++, Stack);
+				}
+			}
+		}
+		return;
+	}
+
+	// Incremental: only the components that had a cell next to a changed cell can split or merge.
+	// Edges only ever change between cells within one cell of a changed cell, so every other component keeps its label.
+	// Wipe the touched components (walking their old labels), then flood them again from whatever got wiped.
+	TArray<FIntRect> Expanded;
+	for (const FIntRect& CellRect : *CellRects)
+	{
+		Expanded.Add(FIntRect(
+			FMath::Max(CellRect.Min.X - 1, 0), FMath::Max(CellRect.Min.Y - 1, 0),
+			FMath::Min(CellRect.Max.X + 1, XCount - 1), FMath::Min(CellRect.Max.Y + 1, YCount - 1)));
+	}
+
+	TArray<FCellRef> Wiped;
+	for (const FIntRect& Rect : Expanded)
+	{
+		for (int32 Y = Rect.Min.Y; Y <= Rect.Max.Y; Y++)
+		{
+			for (int32 X = Rect.Min.X; X <= Rect.Max.X; X++)
+			{
+				FCellRef Seed(X, Y);
+				int32 SeedIndex = CellRefToIndex(Seed);
+				int32 OldLabel = ComponentLabels[SeedIndex];
+
+				// Newly traversable cells have no label yet, they just need flooding
+				Wiped.Add(Seed);
+				if (OldLabel == INDEX_NONE)
+				{
+					continue;
+				}
+
+				// Can't use NeighborMasks here, they already describe the new grid
+				ComponentLabels[SeedIndex] = INDEX_NONE;
+				Stack.Reset();
+				Stack.Add(Seed);
+				while (Stack.Num() > 0)
+				{
+					FCellRef Cell = Stack.Pop(false);
+					for (int32 Bit = 0; Bit < 8; Bit++)
+					{
+						FCellRef NCell(Cell.X + NeighborOffsets[Bit].X, Cell.Y + NeighborOffsets[Bit].Y);
+						if (IsValidCell(NCell))
+						{
+							int32 NIndex = CellRefToIndex(NCell);
+							if (ComponentLabels[NIndex] == OldLabel)
+							{
+								ComponentLabels[NIndex] = INDEX_NONE;
+								Stack.Add(NCell);
+								Wiped.Add(NCell);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	for (const FCellRef& Seed : Wiped)
+	{
+		int32 SeedIndex = CellRefToIndex(Seed);
+		if ((ComponentLabels[SeedIndex] == INDEX_NONE) && EnumHasAllFlags(Data[SeedIndex], ECellData::CellDataTraversable))
+		{
+			FloodComponentLabel(Seed, NextComponentLabel++, Stack);
+		}
+	}
+}
+
+bool AGAGridActor::AreCellsConnected(const FCellRef& CellA, const FCellRef& CellB) const
+{
+	if (!HasDerivedTables() || !IsValidCell(CellA) || !IsValidCell(CellB))
+	{
+		return true;
+	}
+
+	int32 LabelA = ComponentLabels[CellRefToIndex(CellA)];
+	return (LabelA != INDEX_NONE) && (LabelA == ComponentLabels[CellRefToIndex(CellB)]);
+}
+
+
+// Traversability Tables --------------------------------
+
+void AGAGridActor::RefreshTraversabilityTables(const TArray<FIntRect>* CellRects)
+{
+	const int32 CellCount = GetStorageCount();
+	if ((XCount * YCount <= 0) || (Data.Num() != CellCount))
+	{
+		TraversableBits.Empty();
+		TraversabilityPyramid.Reset();
+		ClearanceMap = FGAGridMapU16();
+		return;
+	}
+
+	const FIntRect AllCells(0, 0, XCount - 1, YCount - 1);
+	const FIntPoint BaseSize = TraversabilityPyramid.IsInitialized() ? TraversabilityPyramid.GetLevelSize(0) : FIntPoint::ZeroValue;
+	const bool bFullRebuild = (CellRects == NULL) || (BaseSize != FIntPoint(XCount, YCount)) || (TraversableBits.Num() != XCount * YCount);
+
+	if (bFullRebuild)
+	{
+		TraversableBits.Init(false, XCount * YCount);
+		TraversabilityPyramid.Init(XCount, YCount);
+	}
+
+	TArrayView<const FIntRect> Rects = bFullRebuild ? TArrayView<const FIntRect>(&AllCells, 1) : TArrayView<const FIntRect>(*CellRects);
+	for (const FIntRect& CellRect : Rects)
+	{
+		for (int32 Y = CellRect.Min.Y; Y <= CellRect.Max.Y; Y++)
+		{
+			for (int32 X = CellRect.Min.X; X <= CellRect.Max.X; X++)
+			{
+				const bool bTraversable = EnumHasAllFlags(GetCellData(FCellRef(X, Y)), ECellData::CellDataTraversable);
+				TraversableBits[Y * XCount + X] = bTraversable;
+				TraversabilityPyramid.SetCell(X, Y, bTraversable);
+			}
+		}
+
+		TraversabilityPyramid.RebuildParents(CellRect);
+	}
+
+	RefreshClearanceMap(bFullRebuild ? NULL : CellRects);
+}
+
+EGridCoverage AGAGridActor::GetCellCoverage(const FCellRef& Cell, int32 Level) const
+{
+	if (!IsValidCell(Cell) || (Level < 0) || (Level >= TraversabilityPyramid.GetLevelCount()))
+	{
+		return EGridCoverage::Blocked;
+	}
+
+	return TraversabilityPyramid.GetBlockCoverage(Level, Cell.X, Cell.Y);
+}
+
+EGridCoverage AGAGridActor::GetBoxCoverage(const FGridBox& Box) const
+{
+	if (!Box.IsValid())
+	{
+		return EGridCoverage::Blocked;
+	}
+
+	return TraversabilityPyramid.GetRectCoverage(FIntRect(Box.MinX, Box.MinY, Box.MaxX, Box.MaxY));
+}
+
+
+// Clearance --------------------------------
+
+// Felzenszwalb & Huttenlocher's 1D squared distance transform: D[Q] = min over P of (Q - P)^2 + F[P], in linear time.
+// It works out the lower envelope of the parabolas rooted at each sample, then reads it back off.
+// V (the samples in the envelope) and Z (where each one takes over) are scratch, of size N and N + 1.
+static void DistanceTransform1D(const float* F, int32 N, float* D, int32* V, float* Z)
+{
+	int32 K = 0;
+	V[0] = 0;
+	Z[0] = -FLT_MAX;
+	Z[1] = FLT_MAX;
+
+	for (int32 Q = 1; Q < N; Q++)
+	{
+		// Pop parabolas that the new one hides. Z[0] is -inf, so this always stops by K = 0.
+		float S;
+		while (true)
+		{
+			const int32 P = V[K];
+			S = ((F[Q] + float(Q * Q)) - (F[P] + float(P * P))) / float(2 * (Q - P));
+			if (S > Z[K])
+			{
+				break;
+			}
+			K--;
+		}
+
+		K++;
+		V[K] = Q;
+		Z[K] = S;
+		Z[K + 1] = FLT_MAX;
+	}
+
+	K = 0;
+	for (int32 Q = 0; Q < N; Q++)
+	{
+		while (Z[K + 1] < float(Q))
+		{
+			K++;
+		}
+		const float Delta = float(Q - V[K]);
+		D[Q] = Delta * Delta + F[V[K]];
+	}
+}
+
+int32 AGAGridActor::GetClearanceReach() const
+{
+	// A blocked cell further than this (in cells) can't pull anybody's clearance under MaxClearance
+	return (CellScale > 0.0f) ? FMath::CeilToInt32(MaxClearance / CellScale + 0.5f) : 0;
+}
+
+void AGAGridActor::RefreshClearanceMap(const TArray<FIntRect>* CellRects)
+{
+	if (!bBuildClearanceMap || (TraversableBits.Num() != XCount * YCount) || (XCount * YCount <= 0))
+	{
+		ClearanceMap = FGAGridMapU16();
+		return;
+	}
+
+	if ((CellRects == NULL) || !HasClearanceMap() || (ClearanceMap.Layout != Layout))
+	{
+		ClearanceMap = FGAGridMapU16(this, 0.0f, 0.0f, MaxClearance);
+		RefreshClearanceWindow(FIntRect(0, 0, XCount - 1, YCount - 1));
+		return;
+	}
+
+	// Because the values are clamped, a change can only reach cells within GetClearanceReach() of it
+	const int32 Reach = GetClearanceReach();
+	for (const FIntRect& CellRect : *CellRects)
+	{
+		RefreshClearanceWindow(FIntRect(
+			FMath::Max(CellRect.Min.X - Reach, 0), FMath::Max(CellRect.Min.Y - Reach, 0),
+			FMath::Min(CellRect.Max.X + Reach, XCount - 1), FMath::Min(CellRect.Max.Y + Reach, YCount - 1)));
+	}
+}
+
+void AGAGridActor::RefreshClearanceWindow(const FIntRect& Window)
+{
+	// Every blocked cell that could matter to the window is within Reach of it
+	const int32 Reach = GetClearanceReach();
+	const FIntRect Region(
+		FMath::Max(Window.Min.X - Reach, 0), FMath::Max(Window.Min.Y - Reach, 0),
+		FMath::Min(Window.Max.X + Reach, XCount - 1), FMath::Min(Window.Max.Y + Reach, YCount - 1));
+
+	// The region, plus one sample on each side. The edge of the grid counts as a wall, so a padding sample that's
+	// off the grid is blocked. One that's on the grid is more than Reach from the window, so it may as well be empty.
+	const int32 W = Region.Width() + 3;
+	const int32 H = Region.Height() + 3;
+	const int32 X0 = Region.Min.X - 1;
+	const int32 Y0 = Region.Min.Y - 1;
+	const float Far = 1e20f;
+
+	TArray<float> Columns;			// column-major, W columns of H samples
+	TArray<float> F, D, Z;
+	TArray<int32> V;
+	Columns.SetNumUninitialized(W * H);
+	F.SetNumUninitialized(FMath::Max(W, H));
+	D.SetNumUninitialized(FMath::Max(W, H));
+	Z.SetNumUninitialized(FMath::Max(W, H) + 1);
+	V.SetNumUninitialized(FMath::Max(W, H));
+
+	// Down the columns
+	for (int32 I = 0; I < W; I++)
+	{
+		const int32 X = X0 + I;
+		const bool bWallColumn = (X < 0) || (X >= XCount);
+
+		for (int32 J = 0; J < H; J++)
+		{
+			const int32 Y = Y0 + J;
+			if (bWallColumn || (Y < 0) || (Y >= YCount))
+			{
+				F[J] = 0.0f;
+			}
+			else if ((I == 0) || (I == W - 1) || (J == 0) || (J == H - 1))
+			{
+				F[J] = Far;
+			}
+			else
+			{
+				F[J] = TraversableBits[Y * XCount + X] ? Far : 0.0f;
+			}
+		}
+
+		DistanceTransform1D(F.GetData(), H, &Columns[I * H], V.GetData(), Z.GetData());
+	}
+
+	// Then across the rows, but only the ones in the window
+	for (int32 Y = Window.Min.Y; Y <= Window.Max.Y; Y++)
+	{
+		const int32 J = Y - Y0;
+		for (int32 I = 0; I < W; I++)
+		{
+			F[I] = Columns[I * H + J];
+		}
+
+		DistanceTransform1D(F.GetData(), W, D.GetData(), V.GetData(), Z.GetData());
+
+		for (int32 X = Window.Min.X; X <= Window.Max.X; X++)
+		{
+			// D is the squared distance (in cells) between cell centers. Take half a cell off so it's the
+			// distance to the edge of the blocked cell instead.
+			const float Cells = FMath::Max(FMath::Sqrt(D[X - X0]) - 0.5f, 0.0f);
+			ClearanceMap.Data[CellRefToIndex(FCellRef(X, Y))] = ClearanceMap.Encode(Cells * CellScale);
+		}
+	}
+}
+
+bool AGAGridActor::HasClearanceMap() const
+{
+	return ClearanceMap.IsValid() && (ClearanceMap.Data.Num() == Data.Num());
+}
+
+float AGAGridActor::GetCellClearance(const FCellRef& Cell) const
+{
+	if (!IsValidCell(Cell) || (Data.Num() != GetStorageCount()))
+	{
+		return 0.0f;
+	}
+
+	const int32 Index = CellRefToIndex(Cell);
+	if (HasClearanceMap())
+	{
+		return ClearanceMap.Decode(ClearanceMap.Data[Index]);
+	}
+
+	// Not built, so all we know is whether the cell itself is blocked
+	return EnumHasAllFlags(Data[Index], ECellData::CellDataTraversable) ? MaxClearance : 0.0f;
+}
+
+FGAGridMap AGAGridActor::GetClearanceGridMap() const
+{
+	FGAGridMap Result;
+	if (HasClearanceMap())
+	{
+		ClearanceMap.ToGridMap(Result);
+	}
 	return Result;
 }
 
+void AGAGridActor::GetNeighborsWithClearance(const FCellRef& Cell, float Radius, TArray<FCellRef>& Neighbors) const
+{
+	const int32 FirstNeighbor = Neighbors.Num();
+	GetNeighbors(Cell, true, Neighbors);
+
+	if ((Radius > 0.0f) && HasClearanceMap())
+	{
+		// Clearance tops out at MaxClearance, so that's as picky as we can be.
+		// Compare the stored codes, so that a cell at MaxClearance always passes despite the rounding.
+		const uint16 Required = ClearanceMap.Encode(FMath::Min(Radius, MaxClearance));
+		for (int32 Index = Neighbors.Num() - 1; Index >= FirstNeighbor; Index--)
+		{
+			if (ClearanceMap.Data[CellRefToIndex(Neighbors[Index])] < Required)
+			{
+				Neighbors.RemoveAt(Index, 1, false);
+			}
+		}
+	}
+}
+
+
+// Visibility --------------------------------
+
+FString AGAGridActor::GetVisibilityCachePath() const
+{
+	return FPaths::ChangeExtension(GetGridCachePath(), TEXT("gapvs"));
+}
+
+bool AGAGridActor::BakeVisibility()
+{
+	const int64 Budget = int64(double(VisibilityMemoryBudgetMB) * 1024.0 * 1024.0);
+	const FGAGridVisibilityKey Key = FGAGridVisibility::MakeKey(*this, VisibilityMinLevel, Budget);
+
+	if (LoadVisibilityCache(Key))
+	{
+		return true;
+	}
+
+	if (!Visibility.Bake(*this, VisibilityMinLevel, Budget))
+	{
+		return false;
+	}
+
+	if (bUseGridCache)
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*GetVisibilityCachePath()));
+		if (!Writer || !Visibility.Save(*Writer) || !Writer->Close())
+		{
+			UE_LOG(LogTemp, Warning, TEXT("AGAGridActor: couldn't write visibility cache %s."), *GetVisibilityCachePath());
+		}
+	}
+
+	return true;
+}
+
+bool AGAGridActor::LoadVisibilityCache(const FGAGridVisibilityKey& Key)
+{
+	if (!bUseGridCache)
+	{
+		return false;
+	}
+
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*GetVisibilityCachePath(), FILEREAD_Silent));
+	return Reader && Visibility.Load(*Reader, Key);
+}
+
+void AGAGridActor::StartVisibilityRebake()
+{
+	// Same level as before, so the rebake costs what the last bake did
+	const int32 RebakeLevel = Visibility.GetLevel();
+	const int64 Budget = int64(double(VisibilityMemoryBudgetMB) * 1024.0 * 1024.0);
+
+	// Changes that undo each other (a door opening and shutting again) can land back on the table in the cache.
+	// Rebakes aren't written to it though, so that it keeps the table for the grid as it was baked.
+	if (LoadVisibilityCache(FGAGridVisibility::MakeKey(*this, VisibilityMinLevel, Budget)))
+	{
+		return;
+	}
+
+	if (!Visibility.BeginBake(*this, RebakeLevel, VisibilityMinLevel, Budget))
+	{
+		return;
+	}
+
+	UWorld* World = GetWorld();
+	if (World == NULL)
+	{
+		while (!Visibility.ContinueBake(*this, MAX_int32))
+		{
+		}
+	}
+	else if (!bVisibilityRebakeScheduled)
+	{
+		bVisibilityRebakeScheduled = true;
+		World->GetTimerManager().SetTimerForNextTick(this, &AGAGridActor::ContinueVisibilityRebake);
+	}
+}
+
+void AGAGridActor::ContinueVisibilityRebake()
+{
+	bVisibilityRebakeScheduled = false;
+	if (!Visibility.IsBaking())
+	{
+		return;
+	}
+
+	// The grid went away underneath us
+	if (!IsGridReady() || (TraversableBits.Num() != XCount * YCount))
+	{
+		Visibility.Reset();
+		return;
+	}
+
+	// A few rows per worker at a time, until this frame's budget is used up
+	const int32 BatchSize = (FTaskGraphInterface::Get().GetNumWorkerThreads() + 1) * 4;
+	const double EndTime = FPlatformTime::Seconds() + double(VisibilityRebakeBudgetMs) / 1000.0;
+	do
+	{
+		if (Visibility.ContinueBake(*this, BatchSize))
+		{
+			return;
+		}
+	} while (FPlatformTime::Seconds() < EndTime);
+
+	if (UWorld* World = GetWorld())
+	{
+		bVisibilityRebakeScheduled = true;
+		World->GetTimerManager().SetTimerForNextTick(this, &AGAGridActor::ContinueVisibilityRebake);
+	}
+}
+
+bool AGAGridActor::IsCellVisible(const FCellRef& From, const FCellRef& To) const
+{
+	if (!IsValidCell(From) || !IsValidCell(To))
+	{
+		return false;
+	}
+
+	if (Visibility.IsBaked())
+	{
+		return Visibility.IsVisible(From.X, From.Y, To.X, To.Y);
+	}
+
+	FVector HitLocation;
+	return !TraceLine(GetCellPosition(From), GetCellPosition(To), HitLocation);
+}
+
+
+// Occluder heights --------------------------------
+
+bool AGAGridActor::BakeOccluderHeights()
+{
+	UWorld* World = GetWorld();
+	if ((World == NULL) || (GetStorageCount() <= 0) || (Data.Num() != GetStorageCount()))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("AGAGridActor: can't bake occluder heights before the grid is built."));
+		return false;
+	}
+
+	// Static geometry only, so that whatever pawns are standing around at bake time don't get baked in
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(GAOccluderHeights), false, this);
+	FCollisionObjectQueryParams ObjectParams(ECollisionChannel::ECC_WorldStatic);
+
+	OccluderHeights.SetNumUninitialized(GetStorageCount());
+
+	int32 HitCount = 0;
+	for (int32 Y = 0; Y < YCount; Y++)
+	{
+		for (int32 X = 0; X < XCount; X++)
+		{
+			const FCellRef CellRef(X, Y);
+			const FVector CellPosition = GetCellPosition(CellRef);
+			const FVector Top = CellPosition + FVector(0.0f, 0.0f, OccluderTraceHeight);
+			const FVector Bottom = CellPosition - FVector(0.0f, 0.0f, OccluderTraceHeight);
+
+			float Height = Bottom.Z;
+			FHitResult HitResult;
+			if (World->LineTraceSingleByObjectType(HitResult, Top, Bottom, ObjectParams, Params))
+			{
+				// Starting inside something means it's taller than we can see
+				Height = HitResult.bStartPenetrating ? Top.Z : HitResult.ImpactPoint.Z;
+				HitCount++;
+			}
+			OccluderHeights[CellRefToIndex(CellRef)] = Height;
+		}
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("AGAGridActor: baked occluder heights for %d cells (%d with geometry)."), XCount * YCount, HitCount);
+	return true;
+}
+
+bool AGAGridActor::HasOccluderHeights() const
+{
+	return (OccluderHeights.Num() > 0) && (OccluderHeights.Num() == Data.Num());
+}
+
+float AGAGridActor::GetCellOccluderHeight(const FCellRef& Cell) const
+{
+	if (!IsValidCell(Cell) || !HasOccluderHeights())
+	{
+		return FLT_MAX;
+	}
+	return OccluderHeights[CellRefToIndex(Cell)];
+}
+
 
 // Debugging and Visualization --------------------------------
 
@@ -2,13 +2,20 @@
 
 #include "CoreMinimal.h"
 #include "Math/MathFwd.h"
+#include "Components/SceneComponent.h"
 #include "GAGridMap.h"
+#include "GATypedGridMap.h"
+#include "GAGridBake.h"
+#include "GAGridPyramid.h"
+#include "GAGridVisibility.h"
 #include "GAGridActor.generated.h"
 
 class UBoxComponent;
 class USceneComponent;
 class UProceduralMeshComponent;
 class UTexture2D;
+class ARecastNavMesh;
+class ANavigationData;
 
 UENUM(BlueprintType, meta = (Bitflags, UseEnumValuesAsMaskValuesInEditor = "true"))
 enum class ECellData : uint8
@@ -62,6 +69,13 @@ struct FCellRef
 };
 
 
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FGAGridReadyDelegate, AGAGridActor*, GridActor);
+
+// Cell rects here are inclusive on both ends, same as GridSpaceBoundsToRect2D
+DECLARE_MULTICAST_DELEGATE_TwoParams(FGACellsChangedNativeDelegate, AGAGridActor*, const TArray<FIntRect>&);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FGACellsChangedDelegate, AGAGridActor*, GridActor, const TArray<FGridBox>&, ChangedBoxes);
+
+
 UCLASS(BlueprintType, Blueprintable)
 class AGAGridActor : public AActor 
 {
@@ -91,11 +105,19 @@ class AGAGridActor : public AActor
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
 	TObjectPtr<USceneComponent> SceneComponent;
 
+	// Memory layout of Data (and of the derived tables, and of grid maps built on this grid)
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	EGridLayout Layout;
+
 	// Data
 	UPROPERTY(VisibleAnywhere, BlueprintReadWrite)
 	TArray<ECellData> Data;
 
 	virtual void PostLoad() override;
+	virtual void PostRegisterAllComponents() override;
+	virtual void PostUnregisterAllComponents() override;
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 #if WITH_EDITORONLY_DATA
 	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
@@ -110,8 +132,69 @@ private:
 	ECellData* GetData() { return Data.GetData(); }
 	int32 GetCellCount() { return XCount*YCount; }
 
+	// Local (X, Y) to Data index. Rebuilt by RefreshDerivedValues.
+	FGAGridIndexer Indexer;
+
 	void RefreshDerivedValues();
 
+	// Recompute the cached grid <-> world transform (and the cell position table, if we keep one)
+	void RefreshGridTransform();
+
+	void OnRootTransformUpdated(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport);
+
+	// Normalized grid space -> world: P = GridOrigin + GridAxisX * X + GridAxisY * Y
+	FVector GridOrigin;
+	FVector GridAxisX;
+	FVector GridAxisY;
+
+	// World -> normalized grid space: X = WorldToGridX | P + WorldToGridOffset.X, same for Y
+	FVector WorldToGridX;
+	FVector WorldToGridY;
+	FVector2D WorldToGridOffset;
+
+	// World position of every cell center, same indexing as Data. Only kept if bCacheCellPositions is set.
+	TArray<FVector> CellPositions;
+
+	FDelegateHandle TransformUpdatedHandle;
+
+	// Nav bake helpers
+	ARecastNavMesh* GetNavMesh();
+	FGAGridRasterParams MakeRasterParams() const;
+	void ApplyRasterizedCells(const FGAGridRasterParams& Params, const uint8* Cells);
+	void FinishBake(TSharedPtr<FGAGridBakeState, ESPMode::ThreadSafe> BakeState);
+	void OnBakeFinished(bool bDerivedTablesValid = false);
+	void RefreshNeighborMasks(const FIntRect& CellRect);
+	void RefreshComponentLabels(const TArray<FIntRect>* CellRects);
+	void FloodComponentLabel(const FCellRef& Seed, int32 Label, TArray<FCellRef>& Stack);
+	void RefreshTraversabilityTables(const TArray<FIntRect>* CellRects);
+	void RefreshClearanceMap(const TArray<FIntRect>* CellRects);
+	void RefreshClearanceWindow(const FIntRect& Window);
+	int32 GetClearanceReach() const;
+	bool BuildTileStamps(const ARecastNavMesh* NavMesh, TArray<FGANavTileStamp>& StampsOut) const;
+	bool MakeGridCacheKey(const ARecastNavMesh* NavMesh, FGAGridCacheKey& KeyOut) const;
+	bool SaveGridCache(const FGAGridCacheKey& Key) const;
+	bool LoadGridCache(const FGAGridCacheKey& Key);
+	bool TileBoundsToCellRect(const FBox& TileBounds, FIntRect& RectOut) const;
+
+	UFUNCTION()
+	void OnNavigationGenerationFinished(ANavigationData* NavData);
+
+	// The background bake currently in flight, if any
+	TSharedPtr<FGAGridBakeState, ESPMode::ThreadSafe> PendingBake;
+
+	// Per nav tile slot, what the tile looked like when we last rasterized it
+	TArray<FGANavTileStamp> TileStamps;
+
+	FGAGridPyramid TraversabilityPyramid;
+
+	FGAGridVisibility Visibility;
+
+	// Time-sliced visibility rebake after cells change (see VisibilityRebakeBudgetMs)
+	bool bVisibilityRebakeScheduled = false;
+	void StartVisibilityRebake();
+	void ContinueVisibilityRebake();
+	bool LoadVisibilityCache(const FGAGridVisibilityKey& Key);
+
 public:
 	bool ResetData();
 
@@ -127,6 +210,26 @@ public:
 	UFUNCTION(BlueprintCallable)
 	FVector GetCellPosition(const FCellRef& CellRef) const;
 
+	// Into normalized grid space, where a cell is 1 unit wide and (0, 0) is the min corner of the grid. Z is dropped.
+	// WorldToGridVector is the same for directions (e.g. a velocity), so there's no offset.
+	FVector2D WorldToGrid(const FVector& Point) const { return FVector2D((WorldToGridX | Point) + WorldToGridOffset.X, (WorldToGridY | Point) + WorldToGridOffset.Y); }
+	FVector2D WorldToGridVector(const FVector& Vector) const { return FVector2D(WorldToGridX | Vector, WorldToGridY | Vector); }
+
+	// Batched versions of GetCellPosition and GetCellRef, for when there are a lot of cells to convert.
+	// Structure-of-arrays so the loops vectorize. Every view must be the same length.
+	// Unclamped GetCellRefs sets cells outside of the grid to (INDEX_NONE, INDEX_NONE).
+	void GetCellPositions(TArrayView<const int32> CellX, TArrayView<const int32> CellY, TArrayView<double> WorldX, TArrayView<double> WorldY, TArrayView<double> WorldZ) const;
+	void GetCellRefs(TArrayView<const double> WorldX, TArrayView<const double> WorldY, TArrayView<const double> WorldZ, TArrayView<int32> CellX, TArrayView<int32> CellY, bool bClamp = false) const;
+
+	// Same, for callers that already have FCellRefs or FVectors lying around
+	void GetCellPositions(TArrayView<const FCellRef> Cells, TArrayView<FVector> PositionsOut) const;
+	void GetCellRefs(TArrayView<const FVector> Points, TArrayView<FCellRef> CellsOut, bool bClamp = false) const;
+
+	// Keep a table of every cell's world position, so GetCellPosition is a lookup.
+	// Costs 24 bytes a cell, and gets rebuilt whenever the grid moves.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	bool bCacheCellPositions;
+
 	// Get the grid-space position of the center of the given cell
 	// Note, grid-space is a bit of a weird idea.
 	// In actor space, (0, 0) is the center of the grid
@@ -137,12 +240,18 @@ public:
 
 
 	// Return the flattened index of the cell
-	// The assumes a X-major ordering of the data array.
+	// With the RowMajor layout, this assumes a X-major ordering of the data array.
 	// i.e. if we had a three by three grid, the flattened array would have the data in this order
 	//		(0, 0), (1, 0), (2, 0), (0, 1), (1, 1), (2, 1), (0, 2), (1, 2), (2, 2)
 	// Put another way, all the values in a given X-row are stored in consecutive spans of memory
+	// With the tiled layouts, see EGridLayout.
 	UFUNCTION(BlueprintCallable)
-	FORCEINLINE int32 CellRefToIndex(const FCellRef& CellRef) const { return CellRef.Y * XCount + CellRef.X; }
+	FORCEINLINE int32 CellRefToIndex(const FCellRef& CellRef) const { return Indexer.Index(CellRef.X, CellRef.Y); }
+
+	const FGAGridIndexer& GetIndexer() const { return Indexer; }
+
+	// Size of Data. More than XCount * YCount with a tiled layout, because of the padding.
+	int32 GetStorageCount() const { return Indexer.GetStorageCount(); }
 
 	// Get the flags associated with the given cell reference
 	UFUNCTION(BlueprintCallable)
@@ -173,15 +282,243 @@ public:
 
 	// Return true if there was a hit, false if it was clear
 	// If return value is true, HitLocationOut will be valid
+	// Open stretches of the grid are crossed a whole pyramid block at a time (see GetTraversabilityPyramid), so the
+	// cost grows with the number of obstacles the ray passes near, not with its length.
 	UFUNCTION(BlueprintCallable)
 	bool TraceLine(const FVector &Start, const FVector &End, FVector &HitLocationOut) const;
 
+	// Trace a ray from Start to each of Ends, four at a time. HitsOut gets a bit per ray, set if it was blocked,
+	// and DistancesOut (if given) how far along the ray the hit was, or the full length if it was clear.
+	// Gives the same answers as calling TraceLine on each. bSupercover is the conservative version: a ray that
+	// slips diagonally between two cells is also blocked if either of them is.
+	// Returns the number of rays that hit.
+	int32 TraceLines(const FVector& Start, TArrayView<const FVector> Ends, TBitArray<>& HitsOut, TArray<float>* DistancesOut = NULL, bool bSupercover = false) const;
+
+	// Same as TraceLine, but the ray has a height: it passes over a blocked cell if it's above the cell's occluder
+	// height all the way across (see BakeOccluderHeights). A line of sight check that never touches physics.
+	// Without baked heights, blocked cells block at any height.
+	UFUNCTION(BlueprintCallable)
+	bool TraceLineOfSight(const FVector& Start, const FVector& End, FVector& HitLocationOut) const;
+
+	// Batched TraceLineOfSight, as TraceLines
+	int32 TraceLinesOfSight(const FVector& Start, TArrayView<const FVector> Ends, TBitArray<>& HitsOut) const;
+
 
 	// Data from NavSystem --------------------------------
 
+	// Rebuild the grid from the nav mesh, blocking until it's done.
+	// Tiles are still rasterized in parallel, it's just that the caller waits for them.
 	UFUNCTION(BlueprintCallable)
 	bool RefreshDataFromNav();
 
+	// Rebuild the grid from the nav mesh on worker threads.
+	// The nav polys are snapshotted right away, and the new Data is swapped in on the game thread once
+	// every tile has been rasterized, at which point OnGridReady fires.
+	// Returns false if there's no nav mesh, or if a bake is already in flight.
+	UFUNCTION(BlueprintCallable)
+	bool RefreshDataFromNavAsync();
+
+	// True once the grid has data that matches its dimensions, and no bake is in flight.
+	// Agents should check this rather than assuming the grid has been built.
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	bool IsGridReady() const;
+
+	// 0 to 1 progress of the current background bake. 1 if there's nothing in flight and the grid is ready.
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	float GetBakeProgress() const;
+
+	// Kick off RefreshDataFromNavAsync() from BeginPlay
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	bool bRefreshFromNavOnBeginPlay;
+
+	// Fires whenever a bake (sync or async) finishes and the new data is in place
+	UPROPERTY(BlueprintAssignable)
+	FGAGridReadyDelegate OnGridReady;
+
+	// Re-rasterize only the nav tiles that changed since the last bake.
+	// Returns false if there's nothing to compare against (i.e. we've never baked), in which case use RefreshDataFromNav.
+	UFUNCTION(BlueprintCallable)
+	bool RefreshDataFromNavChangedTiles();
+
+	// Re-rasterize the given (inclusive) cell rects from the nav mesh, and publish them as changed
+	bool RefreshDataFromNavRects(const TArray<FIntRect>& CellRects);
+
+	// Bump GridVersion, refresh the derived tables, and let everyone know which cells changed.
+	// Anything that modifies Data should call this.
+	// bRefreshDerivedTables = false skips the tables that came out of the grid cache (the pyramid is always refreshed).
+	void NotifyCellsChanged(const TArray<FIntRect>& CellRects, bool bRefreshDerivedTables = true);
+
+	// When the nav system finishes regenerating (e.g. because a barrier moved), refresh the tiles that changed
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	bool bRefreshOnNavChange;
+
+	// Bumped every time any cell changes. Handy for invalidating anything cached off the grid.
+	UPROPERTY(Transient, BlueprintReadOnly)
+	int32 GridVersion;
+
+	// Fires with the changed cell rects, so that caches can invalidate selectively
+	FGACellsChangedNativeDelegate OnCellsChangedNative;
+
+	UPROPERTY(BlueprintAssignable)
+	FGACellsChangedDelegate OnCellsChanged;
+
+	// Grid Cache --------------------------------
+
+	// Save full bakes to a cache file in Saved/GridCache, and load from it instead of baking when the
+	// nav mesh and grid parameters haven't changed since
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	bool bUseGridCache;
+
+	UFUNCTION(BlueprintCallable)
+	FString GetGridCachePath() const;
+
+	// Write the cell flags out as a memory-mappable layer file (see GAGridLayerFile.h), for tools or
+	// processes that want to read the grid without baking it. FGAGridMap::MapFromFile will read it back.
+	UFUNCTION(BlueprintCallable)
+	bool WriteTraversabilityLayer(const FString& Path) const;
+
+	// The other direction: map a layer written by WriteTraversabilityLayer and take its cell flags, instead of baking.
+	// The file has to cover this grid exactly (same XCount/YCount, full bounds), otherwise nothing changes and this returns false.
+	UFUNCTION(BlueprintCallable)
+	bool ReadTraversabilityLayer(const FString& Path);
+
+	// Derived Tables --------------------------------
+	// These are rebuilt from Data whenever cells change, and stored in the grid cache alongside it.
+	// Same indexing as Data.
+
+	// For each cell, bit i is set if the i'th neighbor is traversable
+	// Neighbors are numbered in the same order GetNeighbors visits them, i.e. row by row, skipping the cell itself
+	TArray<uint8> NeighborMasks;
+
+	// For each traversable cell, the id of the 8-connected region it belongs to. INDEX_NONE for untraversable cells.
+	TArray<int32> ComponentLabels;
+
+	// Labels aren't compacted after incremental relabels, so this only ever grows until the next full rebuild
+	int32 NextComponentLabel = 0;
+
+	// If CellRects is null, rebuild everything
+	void RefreshDerivedTables(const TArray<FIntRect>* CellRects = NULL);
+
+	bool HasDerivedTables() const;
+
+	// Can you walk from A to B at all? Cheap, just compares component labels.
+	// If the derived tables aren't built, this optimistically returns true.
+	UFUNCTION(BlueprintCallable)
+	bool AreCellsConnected(const FCellRef& CellA, const FCellRef& CellB) const;
+
+	// Traversability Tables --------------------------------
+	// Kept up to date along with the derived tables, but not stored in the grid cache -- they're cheap to rebuild.
+
+	// One bit per cell, set if the cell is traversable. Always row-major (whatever the Layout), XCount bits per row.
+	// This is the mask the grid map kernels take (see GAGridMapKernels.h).
+	TBitArray<> TraversableBits;
+
+	// A mip chain over the traversable flag (see GAGridPyramid.h). Level 0 is the grid, and a cell at level L
+	// covers a (1 << L) x (1 << L) block of grid cells.
+
+	const FGAGridPyramid& GetTraversabilityPyramid() const { return TraversabilityPyramid; }
+
+	// Is the block at the given level that contains Cell all traversable, all blocked, or a mix?
+	UFUNCTION(BlueprintCallable)
+	EGridCoverage GetCellCoverage(const FCellRef& Cell, int32 Level) const;
+
+	// Is everything in the box traversable, nothing, or a mix? Cells off the grid count as blocked.
+	UFUNCTION(BlueprintCallable)
+	EGridCoverage GetBoxCoverage(const FGridBox& Box) const;
+
+	// Clearance --------------------------------
+	// How far each cell's center is from the edge of the nearest blocked cell (or of the grid), in world units. Built with an
+	// exact Euclidean distance transform from TraversableBits, and kept up to date along with it. Values are clamped
+	// to MaxClearance, which is what keeps the updates local: a change can only affect cells within MaxClearance of it.
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	bool bBuildClearanceMap;
+
+	// Bigger costs more to update when cells change. Should be at least the radius of the biggest agent.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = "0"))
+	float MaxClearance;
+
+	// Same indexing as Data. Blocked cells are 0.
+	// Fixed-point over [0, MaxClearance], so 2 bytes a cell instead of 4, and the rounding is far below anything an agent could notice.
+	FGAGridMapU16 ClearanceMap;
+
+	bool HasClearanceMap() const;
+
+	// Distance from the center of the cell to the nearest edge of a blocked cell (or of the grid), up to MaxClearance.
+	// So a cell right next to a wall has half a cell of clearance.
+	// 0 for blocked or invalid cells. If the map isn't built, traversable cells get MaxClearance.
+	UFUNCTION(BlueprintCallable)
+	float GetCellClearance(const FCellRef& Cell) const;
+
+	// The whole clearance map as floats, e.g. for the debug view. Invalid if it isn't built.
+	UFUNCTION(BlueprintCallable)
+	FGAGridMap GetClearanceGridMap() const;
+
+	// GetNeighbors(Cell, true, ...), minus any neighbor that an agent of the given radius wouldn't fit in
+	void GetNeighborsWithClearance(const FCellRef& Cell, float Radius, TArray<FCellRef>& Neighbors) const;
+
+	// Visibility --------------------------------
+	// A baked cell-to-cell line of sight table (see GAGridVisibility.h). Once baked, it's kept up to date: when cells
+	// change it's rebaked at the same level, a slice per frame, and IsCellVisible traces in the meantime.
+
+	// Finest pyramid level to bake visibility at. 0 is one visibility cell per grid cell, which is exact but costs
+	// (XCount * YCount)^2 rays to bake.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = "0"))
+	int32 VisibilityMinLevel;
+
+	// The bake goes to coarser levels until the table fits in this much memory
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = "0"))
+	float VisibilityMemoryBudgetMB;
+
+	// Bake visibility (or load it from the cache) every time the grid is rebuilt
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	bool bBakeVisibilityOnGridReady;
+
+	// How long to spend rebaking visibility each frame after cells change. The rows are baked on worker threads,
+	// this is how long the game thread waits for them.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = "0"))
+	float VisibilityRebakeBudgetMs;
+
+	// Bake the visibility table on worker threads, blocking until it's done.
+	// If bUseGridCache is set, a matching table on disk is loaded instead, and a fresh bake is saved.
+	UFUNCTION(BlueprintCallable)
+	bool BakeVisibility();
+
+	// Is there a clear line between the centers of the two cells? O(1) if visibility is baked (at the
+	// baked level's resolution), otherwise a TraceLine.
+	UFUNCTION(BlueprintCallable)
+	bool IsCellVisible(const FCellRef& From, const FCellRef& To) const;
+
+	const FGAGridVisibility& GetVisibility() const { return Visibility; }
+
+	UFUNCTION(BlueprintCallable)
+	FString GetVisibilityCachePath() const;
+
+	// Occluder heights --------------------------------
+	// The world Z of the top of whatever is in each cell, found by tracing down against static geometry. This is what
+	// lets TraceLineOfSight see over low walls and cover. Thrown away if the grid moves.
+
+	// Traces start this far above the grid, and go as far below it
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta = (ClampMin = "0"))
+	float OccluderTraceHeight;
+
+	// Bake occluder heights every time the grid is rebuilt
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	bool bBakeOccluderHeightsOnGridReady;
+
+	// Same indexing as Data
+	TArray<float> OccluderHeights;
+
+	// One downward physics trace per cell, on the game thread
+	UFUNCTION(BlueprintCallable)
+	bool BakeOccluderHeights();
+
+	bool HasOccluderHeights() const;
+
+	// FLT_MAX if the heights aren't baked
+	UFUNCTION(BlueprintCallable)
+	float GetCellOccluderHeight(const FCellRef& Cell) const;
+
 	// Debugging and Visualization --------------------------------
 
 	UPROPERTY(EditAnywhere)
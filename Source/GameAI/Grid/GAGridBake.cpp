@@ -0,0 +1,273 @@
+#include "GAGridBake.h"
+#include "NavMesh/RecastNavMesh.h"
+#include "NavMesh/RecastHelpers.h"
+#include "Async/ParallelFor.h"
+
+#if WITH_RECAST
+#include "Detour/DetourNavMesh.h"
+#endif // WITH_RECAST
+
+
+void FGANavPolySoup::Reset()
+{
+	Verts.Reset();
+	PolyVertStart.Reset();
+	TilePolyStart.Reset();
+	TileIndices.Reset();
+}
+
+
+bool FGANavRasterizer::GatherNavPolys(const ARecastNavMesh* NavMesh, const FTransform& GridTransform, const FVector2D& HalfExtents,
+	const TArray<int32>* TileIndicesIn, FGANavPolySoup& SoupOut)
+{
+	SoupOut.Reset();
+
+	if (NavMesh == NULL)
+	{
+		return false;
+	}
+
+#if WITH_RECAST
+	// Note: we go straight to the detour mesh here instead of using GetPolysInTile/GetPolyVerts. Those
+	// allocate a couple of arrays per tile and per poly, which adds up fast on a big map.
+	const dtNavMesh* DetourMesh = NavMesh->GetRecastMesh();
+	if (DetourMesh == NULL)
+	{
+		return false;
+	}
+
+	const int32 MaxTiles = DetourMesh->getMaxTiles();
+	const int32 GatherCount = TileIndicesIn ? TileIndicesIn->Num() : MaxTiles;
+
+	SoupOut.PolyVertStart.Add(0);
+	SoupOut.TilePolyStart.Add(0);
+
+	for (int32 GatherIndex = 0; GatherIndex < GatherCount; GatherIndex++)
+	{
+		int32 TileIndex = TileIndicesIn ? (*TileIndicesIn)[GatherIndex] : GatherIndex;
+		if ((TileIndex < 0) || (TileIndex >= MaxTiles))
+		{
+			continue;
+		}
+
+		const dtMeshTile* Tile = DetourMesh->getTile(TileIndex);
+		if ((Tile == NULL) || (Tile->header == NULL))
+		{
+			// Empty slot, nothing to gather
+			continue;
+		}
+
+		for (int32 PolyIndex = 0; PolyIndex < Tile->header->polyCount; PolyIndex++)
+		{
+			const dtPoly& Poly = Tile->polys[PolyIndex];
+			if (Poly.getType() != DT_POLYTYPE_GROUND)
+			{
+				// off-mesh connections are not something you can stand on
+				continue;
+			}
+
+			for (int32 VertexIndex = 0; VertexIndex < Poly.vertCount; VertexIndex++)
+			{
+				const FVector WorldVert = Recast2UnrealPoint(&Tile->verts[Poly.verts[VertexIndex] * 3]);
+
+				// transform verts to grid space
+				SoupOut.Verts.Add(FVector2D(GridTransform.InverseTransformPosition(WorldVert)) + HalfExtents);
+			}
+
+			SoupOut.PolyVertStart.Add(SoupOut.Verts.Num());
+		}
+
+		SoupOut.TileIndices.Add(TileIndex);
+		SoupOut.TilePolyStart.Add(SoupOut.PolyVertStart.Num() - 1);
+	}
+
+	return true;
+#else
+	return false;
+#endif // WITH_RECAST
+}
+
+
+bool FGANavRasterizer::GatherTileSalts(const ARecastNavMesh* NavMesh, TArray<uint32>& SaltsOut)
+{
+	SaltsOut.Reset();
+
+	if (NavMesh == NULL)
+	{
+		return false;
+	}
+
+#if WITH_RECAST
+	const dtNavMesh* DetourMesh = NavMesh->GetRecastMesh();
+	if (DetourMesh == NULL)
+	{
+		return false;
+	}
+
+	SaltsOut.SetNumZeroed(DetourMesh->getMaxTiles());
+	for (int32 TileIndex = 0; TileIndex < SaltsOut.Num(); TileIndex++)
+	{
+		const dtMeshTile* Tile = DetourMesh->getTile(TileIndex);
+		if (Tile && Tile->header)
+		{
+			SaltsOut[TileIndex] = Tile->salt;
+		}
+	}
+
+	return true;
+#else
+	return false;
+#endif // WITH_RECAST
+}
+
+
+bool FGANavRasterizer::HashNavMesh(const ARecastNavMesh* NavMesh, uint32& HashOut)
+{
+	HashOut = 0;
+
+	if (NavMesh == NULL)
+	{
+		return false;
+	}
+
+#if WITH_RECAST
+	const dtNavMesh* DetourMesh = NavMesh->GetRecastMesh();
+	if (DetourMesh == NULL)
+	{
+		return false;
+	}
+
+	uint32 Hash = 0;
+	for (int32 TileIndex = 0; TileIndex < DetourMesh->getMaxTiles(); TileIndex++)
+	{
+		const dtMeshTile* Tile = DetourMesh->getTile(TileIndex);
+		if ((Tile == NULL) || (Tile->header == NULL))
+		{
+			continue;
+		}
+
+		const dtMeshHeader* Header = Tile->header;
+		Hash = FCrc::MemCrc32(&Header->x, sizeof(Header->x), Hash);
+		Hash = FCrc::MemCrc32(&Header->y, sizeof(Header->y), Hash);
+		Hash = FCrc::MemCrc32(&Header->layer, sizeof(Header->layer), Hash);
+		Hash = FCrc::MemCrc32(Tile->verts, Header->vertCount * 3 * sizeof(Tile->verts[0]), Hash);
+
+		// Note, we don't hash dtPoly wholesale -- firstLink is runtime bookkeeping that changes from run to run
+		for (int32 PolyIndex = 0; PolyIndex < Header->polyCount; PolyIndex++)
+		{
+			const dtPoly& Poly = Tile->polys[PolyIndex];
+			uint8 TypeAndCount[2] = { Poly.getType(), Poly.vertCount };
+
+			Hash = FCrc::MemCrc32(TypeAndCount, sizeof(TypeAndCount), Hash);
+			Hash = FCrc::MemCrc32(Poly.verts, Poly.vertCount * sizeof(Poly.verts[0]), Hash);
+		}
+	}
+
+	HashOut = Hash;
+	return true;
+#else
+	return false;
+#endif // WITH_RECAST
+}
+
+
+void FGANavRasterizer::RasterizeTiles(const FGANavPolySoup& Soup, const FGAGridRasterParams& Params, uint8* CellsOut,
+	FThreadSafeCounter* TilesDone, const FThreadSafeCounter* Cancelled)
+{
+	ParallelFor(Soup.GetTileCount(), [&Soup, &Params, CellsOut, TilesDone, Cancelled](int32 SoupTileIndex)
+	{
+		if (Cancelled && (Cancelled->GetValue() != 0))
+		{
+			return;
+		}
+
+		RasterizeTile(Soup, SoupTileIndex, Params, CellsOut);
+
+		if (TilesDone)
+		{
+			TilesDone->Increment();
+		}
+	});
+}
+
+
+void FGANavRasterizer::RasterizeTile(const FGANavPolySoup& Soup, int32 SoupTileIndex, const FGAGridRasterParams& Params, uint8* CellsOut)
+{
+	const float CellScale = Params.CellScale;
+	const float HalfScale = 0.5f * CellScale;
+	const int32 ClipWidth = Params.GetClipWidth();
+
+	// Small fixed-size scratch for the outside vectors -- detour polys have at most 6 verts, but be generous
+	TArray<FVector2D, TInlineAllocator<16>> OutsideVectors;
+
+	for (int32 PolyIndex = Soup.TilePolyStart[SoupTileIndex]; PolyIndex < Soup.TilePolyStart[SoupTileIndex + 1]; PolyIndex++)
+	{
+		const int32 FirstVert = Soup.PolyVertStart[PolyIndex];
+		const int32 VertCount = Soup.PolyVertStart[PolyIndex + 1] - FirstVert;
+		if (VertCount < 3)
+		{
+			continue;
+		}
+
+		const FVector2D* PolyVerts2D = &Soup.Verts[FirstVert];
+
+		FBox2D PolyBounds(EForceInit::ForceInit);
+		for (int32 VertexIndex = 0; VertexIndex < VertCount; VertexIndex++)
+		{
+			PolyBounds += PolyVerts2D[VertexIndex];
+		}
+
+		// Same as AGAGridActor::GridSpaceBoundsToRect2D, but clipped to the output rect as well
+		FIntRect GridBox;
+		GridBox.Min.X = FMath::Max(int32((PolyBounds.Min.X + HalfScale) / CellScale), Params.Clip.Min.X);
+		GridBox.Max.X = FMath::Min(int32((PolyBounds.Max.X - HalfScale) / CellScale), Params.Clip.Max.X);
+		GridBox.Min.Y = FMath::Max(int32((PolyBounds.Min.Y + HalfScale) / CellScale), Params.Clip.Min.Y);
+		GridBox.Max.Y = FMath::Min(int32((PolyBounds.Max.Y - HalfScale) / CellScale), Params.Clip.Max.Y);
+
+		if ((GridBox.Min.X > GridBox.Max.X) || (GridBox.Min.Y > GridBox.Max.Y))
+		{
+			continue;
+		}
+
+		// Cache off a set of "outside vectors", so that we can test each cell in the box against the
+		// bounds of the polygons
+		OutsideVectors.SetNum(VertCount, false);
+		for (int32 V0Index = 0; V0Index < VertCount; V0Index++)
+		{
+			int32 V1Index = (V0Index + 1) % VertCount;
+			FVector2D V0V1 = PolyVerts2D[V1Index] - PolyVerts2D[V0Index];
+
+			// Rotate 90 degrees
+			OutsideVectors[V0Index].X = -V0V1.Y;
+			OutsideVectors[V0Index].Y = V0V1.X;
+		}
+
+		for (int32 Y = GridBox.Min.Y; Y <= GridBox.Max.Y; Y++)
+		{
+			const float CellCenterY = Y * CellScale + HalfScale;
+			uint8* Row = CellsOut + (Y - Params.Clip.Min.Y) * ClipWidth;
+
+			for (int32 X = GridBox.Min.X; X <= GridBox.Max.X; X++)
+			{
+				const FVector2D CellCenter(X * CellScale + HalfScale, CellCenterY);
+				bool IsOutside = false;
+
+				for (int32 V0Index = 0; (V0Index < VertCount) && !IsOutside; V0Index++)
+				{
+					FVector2D V0Cell = CellCenter - PolyVerts2D[V0Index];
+					if ((V0Cell | OutsideVectors[V0Index]) > 0.0f)		// Dot product
+					{
+						// the cell is outside this edge
+						IsOutside = true;
+					}
+				}
+
+				if (!IsOutside)
+				{
+					// Tiles can share cells along their borders, and they are being rasterized concurrently
+					FPlatformAtomics::InterlockedOr((volatile int8*)&Row[X - Params.Clip.Min.X], int8(1));
+				}
+			}
+		}
+	}
+}
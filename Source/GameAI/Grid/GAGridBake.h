@@ -0,0 +1,155 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "GAGridLayout.h"
+
+class ARecastNavMesh;
+
+
+// A flattened snapshot of nav mesh polygons, already transformed into grid space.
+// We gather this on the game thread (where it is safe to look at the nav mesh), and then hand it
+// off to worker threads for rasterization. Everything lives in a few flat arrays, so gathering
+// does not allocate per tile or per poly.
+
+struct FGANavPolySoup
+{
+	// Grid-space vertices of every poly, back to back
+	TArray<FVector2D> Verts;
+
+	// For each poly, the index of its first vertex in Verts. Has one extra entry at the end, so that
+	// the verts of poly i are always [PolyVertStart[i], PolyVertStart[i + 1])
+	TArray<int32> PolyVertStart;
+
+	// For each gathered tile, the index of its first poly. Same trick as above.
+	TArray<int32> TilePolyStart;
+
+	// The nav mesh tile index each gathered tile came from
+	TArray<int32> TileIndices;
+
+	void Reset();
+
+	int32 GetTileCount() const { return TileIndices.Num(); }
+	int32 GetPolyCount() const { return FMath::Max(PolyVertStart.Num() - 1, 0); }
+};
+
+
+// Everything the rasterizer needs to know about the grid. Copied by value, so that worker threads
+// never have to touch the actor.
+
+struct FGAGridRasterParams
+{
+	int32 XCount = 0;
+	int32 YCount = 0;
+	float CellScale = 1.0f;
+
+	// Only cells inside this (inclusive) rect get written. The output buffer is row-major over the rect.
+	FIntRect Clip;
+
+	int32 GetClipWidth() const { return Clip.Max.X - Clip.Min.X + 1; }
+	int32 GetClipHeight() const { return Clip.Max.Y - Clip.Min.Y + 1; }
+};
+
+
+// What we remember about each nav mesh tile slot from the last bake, so that when the nav mesh
+// regenerates we can tell which tiles actually changed.
+
+struct FGANavTileStamp
+{
+	// The detour tile salt, or 0 if the slot was empty.
+	// Detour bumps the salt every time a tile is removed from a slot (and never uses 0),
+	// so a rebuilt tile always comes back with a different stamp.
+	uint32 Salt = 0;
+
+	// The cells whose centers fall inside the tile's bounds
+	FIntRect CellRect;
+
+	bool bHasCells = false;
+};
+
+
+// Everything that decides whether a baked grid cache file is still good.
+// If any of it differs from what's on disk, we bake from scratch.
+
+struct FGAGridCacheKey
+{
+	static constexpr uint32 FileMagic = 0x43474147;		// "GAGC"
+
+	// Bump this whenever the layout of the cache file changes
+	static constexpr int32 FileVersion = 2;
+
+	// Hash of the geometry of every nav mesh tile
+	uint32 NavHash = 0;
+
+	int32 XCount = 0;
+	int32 YCount = 0;
+	float CellScale = 0.0f;
+	EGridLayout Layout = EGridLayout::RowMajor;
+	FTransform GridTransform;
+
+	bool Matches(const FGAGridCacheKey& Other) const
+	{
+		return (NavHash == Other.NavHash) && (XCount == Other.XCount) && (YCount == Other.YCount) &&
+			(CellScale == Other.CellScale) && (Layout == Other.Layout) && GridTransform.Equals(Other.GridTransform, UE_KINDA_SMALL_NUMBER);
+	}
+
+	friend FArchive& operator<<(FArchive& Ar, FGAGridCacheKey& Key)
+	{
+		Ar << Key.NavHash;
+		Ar << Key.XCount;
+		Ar << Key.YCount;
+		Ar << Key.CellScale;
+		Ar << Key.Layout;
+		Ar << Key.GridTransform;
+		return Ar;
+	}
+};
+
+
+// Shared state of an in-flight background bake.
+// Owned jointly by the grid actor and the worker, so either one can go away first.
+
+struct FGAGridBakeState
+{
+	FGANavPolySoup Soup;
+	FGAGridRasterParams Params;
+	TArray<FGANavTileStamp> TileStamps;
+	FGAGridCacheKey CacheKey;
+	bool bHasCacheKey = false;
+
+	// Row-major over Params.Clip, one byte per cell; non-zero means traversable
+	TArray<uint8> Cells;
+
+	FThreadSafeCounter TilesDone;
+	FThreadSafeCounter Cancelled;
+
+	float GetProgress() const
+	{
+		int32 TileCount = Soup.GetTileCount();
+		return (TileCount > 0) ? float(TilesDone.GetValue()) / float(TileCount) : 1.0f;
+	}
+};
+
+
+struct FGANavRasterizer
+{
+	// Read the salt of every tile slot in the nav mesh (0 for empty slots)
+	static bool GatherTileSalts(const ARecastNavMesh* NavMesh, TArray<uint32>& SaltsOut);
+
+	// Hash the polygon geometry of every tile. Unlike the salts, this is stable from one run to the next.
+	static bool HashNavMesh(const ARecastNavMesh* NavMesh, uint32& HashOut);
+
+	// Snapshot the polys of the given nav mesh tiles into grid space.
+	// If TileIndicesIn is null, every tile is gathered.
+	static bool GatherNavPolys(const ARecastNavMesh* NavMesh, const FTransform& GridTransform, const FVector2D& HalfExtents,
+		const TArray<int32>* TileIndicesIn, FGANavPolySoup& SoupOut);
+
+	// Rasterize every gathered tile into CellsOut, spreading the tiles across worker threads with ParallelFor.
+	// CellsOut must be sized to the clip rect and zeroed. Tiles may overlap in cells, so writes are atomic ORs.
+	// TilesDone and Cancelled are optional.
+	static void RasterizeTiles(const FGANavPolySoup& Soup, const FGAGridRasterParams& Params, uint8* CellsOut,
+		FThreadSafeCounter* TilesDone = nullptr, const FThreadSafeCounter* Cancelled = nullptr);
+
+	// Rasterize the polys of a single gathered tile
+	static void RasterizeTile(const FGANavPolySoup& Soup, int32 SoupTileIndex, const FGAGridRasterParams& Params, uint8* CellsOut);
+};
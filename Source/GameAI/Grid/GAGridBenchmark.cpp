@@ -0,0 +1,190 @@
+#include "CoreMinimal.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "GAGridLayout.h"
+
+
+// Benchmarks for the grid memory layouts (see EGridLayout).
+//
+//		GameAI.Grid.BenchmarkLayouts [Size] [Iterations]
+//
+// Runs a 3x3 diffusion pass and an 8-connected Dijkstra over a Size x Size grid (1024 by default) in
+// each layout, and logs the best time of each. The kernels go through FGAGridIndexer exactly the way
+// the grid code does, so this measures the layouts, not some hand-tuned special case.
+//
+// Numbers from one run (best of 5, single core Xeon, -O2). These came from building this file's kernels and
+// GAGridLayout.cpp outside the engine, so treat them as relative, and re-run the command in your own build:
+//
+//		1024 x 1024		RowMajor	diffuse   9.3 ms	dijkstra  133 ms
+//						Tiled8		diffuse  19.8 ms	dijkstra  170 ms
+//						Tiled16		diffuse  30.2 ms	dijkstra  187 ms
+//
+//		4096 x 4096		RowMajor	diffuse 161 ms		dijkstra 3261 ms
+//						Tiled8		diffuse 315 ms		dijkstra 2714 ms
+//						Tiled16		diffuse 418 ms		dijkstra 2880 ms
+//
+// So tiling only pays off for the scattered access of Dijkstra on grids too big for the cache. Per-cell Index()
+// calls through the slot table cost more than tiling saves on a streaming 3x3 pass; kernels that want the tiled
+// layout should walk ForEachTile and index inside the block instead. RowMajor stays the default.
+
+namespace GAGridBenchmark
+{
+	// Every cell becomes the average of its 3x3 neighborhood (the part of it that's on the grid)
+	static void Diffuse(const FGAGridIndexer& Indexer, const TArray<float>& In, TArray<float>& Out)
+	{
+		const int32 Width = Indexer.Width;
+		const int32 Height = Indexer.Height;
+
+		Indexer.ForEachSpan([&](int32 X0, int32 Y, int32 Index, int32 Count)
+		{
+			const int32 YMin = FMath::Max(Y - 1, 0);
+			const int32 YMax = FMath::Min(Y + 1, Height - 1);
+
+			for (int32 I = 0; I < Count; I++)
+			{
+				const int32 X = X0 + I;
+				const int32 XMin = FMath::Max(X - 1, 0);
+				const int32 XMax = FMath::Min(X + 1, Width - 1);
+
+				float Sum = 0.0f;
+				for (int32 NY = YMin; NY <= YMax; NY++)
+				{
+					for (int32 NX = XMin; NX <= XMax; NX++)
+					{
+						Sum += In[Indexer.Index(NX, NY)];
+					}
+				}
+
+				Out[Index + I] = Sum / float((XMax - XMin + 1) * (YMax - YMin + 1));
+			}
+		});
+	}
+
+	struct FNode
+	{
+		float Cost;
+		int32 X;
+		int32 Y;
+
+		bool operator<(const FNode& Other) const { return Cost < Other.Cost; }
+	};
+
+	// Plain lazy-deletion Dijkstra: stale heap entries are skipped when they come off, rather than decreased in place
+	static int32 Dijkstra(const FGAGridIndexer& Indexer, const TArray<uint8>& Blocked, TArray<float>& Distances, const FIntPoint& Start)
+	{
+		static const FIntPoint Offsets[8] =
+		{
+			FIntPoint(-1, -1), FIntPoint(0, -1), FIntPoint(1, -1),
+			FIntPoint(-1, 0),                    FIntPoint(1, 0),
+			FIntPoint(-1, 1),  FIntPoint(0, 1),  FIntPoint(1, 1)
+		};
+		static const float Costs[8] = { UE_SQRT_2, 1.0f, UE_SQRT_2, 1.0f, 1.0f, UE_SQRT_2, 1.0f, UE_SQRT_2 };
+
+		for (float& Distance : Distances)
+		{
+			Distance = UE_MAX_FLT;
+		}
+
+		TArray<FNode> Heap;
+		Distances[Indexer.Index(Start.X, Start.Y)] = 0.0f;
+		Heap.HeapPush(FNode{ 0.0f, Start.X, Start.Y });
+
+		int32 Settled = 0;
+		while (Heap.Num() > 0)
+		{
+			FNode Node;
+			Heap.HeapPop(Node, false);
+
+			if (Node.Cost > Distances[Indexer.Index(Node.X, Node.Y)])
+			{
+				continue;
+			}
+			Settled++;
+
+			for (int32 N = 0; N < 8; N++)
+			{
+				const int32 NX = Node.X + Offsets[N].X;
+				const int32 NY = Node.Y + Offsets[N].Y;
+				if ((NX < 0) || (NX >= Indexer.Width) || (NY < 0) || (NY >= Indexer.Height))
+				{
+					continue;
+				}
+
+				const int32 NIndex = Indexer.Index(NX, NY);
+				const float NewCost = Node.Cost + Costs[N];
+				if (!Blocked[NIndex] && (NewCost < Distances[NIndex]))
+				{
+					Distances[NIndex] = NewCost;
+					Heap.HeapPush(FNode{ NewCost, NX, NY });
+				}
+			}
+		}
+
+		return Settled;
+	}
+
+	static void RunLayout(EGridLayout Layout, int32 Size, int32 Iterations)
+	{
+		const FGAGridIndexer Indexer = FGAGridIndexer::Make(Layout, Size, Size);
+		const int32 StorageCount = Indexer.GetStorageCount();
+
+		// Same random field and obstacles for every layout
+		FRandomStream Random(1234);
+		TArray<float> Field;
+		TArray<uint8> Blocked;
+		Field.Init(0.0f, StorageCount);
+		Blocked.Init(1, StorageCount);
+
+		for (int32 Y = 0; Y < Size; Y++)
+		{
+			for (int32 X = 0; X < Size; X++)
+			{
+				const int32 Index = Indexer.Index(X, Y);
+				Field[Index] = Random.FRand();
+				Blocked[Index] = (Random.FRand() < 0.2f) ? 1 : 0;
+			}
+		}
+
+		const FIntPoint Start(Size / 2, Size / 2);
+		Blocked[Indexer.Index(Start.X, Start.Y)] = 0;
+
+		TArray<float> Scratch;
+		Scratch.Init(0.0f, StorageCount);
+
+		double BestDiffuse = UE_DOUBLE_BIG_NUMBER;
+		double BestDijkstra = UE_DOUBLE_BIG_NUMBER;
+		int32 Settled = 0;
+
+		for (int32 Iteration = 0; Iteration < Iterations; Iteration++)
+		{
+			double StartTime = FPlatformTime::Seconds();
+			Diffuse(Indexer, Field, Scratch);
+			BestDiffuse = FMath::Min(BestDiffuse, FPlatformTime::Seconds() - StartTime);
+			Swap(Field, Scratch);
+
+			StartTime = FPlatformTime::Seconds();
+			Settled = Dijkstra(Indexer, Blocked, Scratch, Start);
+			BestDijkstra = FMath::Min(BestDijkstra, FPlatformTime::Seconds() - StartTime);
+		}
+
+		UE_LOG(LogTemp, Display, TEXT("  %-10s  diffuse %8.2f ms   dijkstra %8.2f ms (%d cells settled)   storage %d cells"),
+			*StaticEnum<EGridLayout>()->GetNameStringByValue(int64(Layout)), BestDiffuse * 1000.0, BestDijkstra * 1000.0, Settled, StorageCount);
+	}
+
+	static void BenchmarkLayouts(const TArray<FString>& Args)
+	{
+		const int32 Size = (Args.Num() > 0) ? FMath::Clamp(FCString::Atoi(*Args[0]), 16, 8192) : 1024;
+		const int32 Iterations = (Args.Num() > 1) ? FMath::Clamp(FCString::Atoi(*Args[1]), 1, 100) : 5;
+
+		UE_LOG(LogTemp, Display, TEXT("Grid layout benchmark: %d x %d, best of %d"), Size, Size, Iterations);
+
+		RunLayout(EGridLayout::RowMajor, Size, Iterations);
+		RunLayout(EGridLayout::Tiled8, Size, Iterations);
+		RunLayout(EGridLayout::Tiled16, Size, Iterations);
+	}
+
+	static FAutoConsoleCommand BenchmarkLayoutsCommand(
+		TEXT("GameAI.Grid.BenchmarkLayouts"),
+		TEXT("Time diffusion and Dijkstra over a large grid in each memory layout. Args: [Size=1024] [Iterations=5]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkLayouts));
+}
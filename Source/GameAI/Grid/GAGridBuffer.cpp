@@ -0,0 +1,201 @@
+#include "GAGridBuffer.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/ScopeLock.h"
+
+
+// --------------------- FGAGridBuffer ---------------------
+
+FGAGridBuffer::FGAGridBuffer(const FGAGridBuffer& Other) : Block(Other.Block)
+{
+	if (Block)
+	{
+		Block->RefCount.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+FGAGridBuffer& FGAGridBuffer::operator=(const FGAGridBuffer& Other)
+{
+	if (Block != Other.Block)
+	{
+		// Take the new reference before dropping the old one
+		if (Other.Block)
+		{
+			Other.Block->RefCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		Release();
+		Block = Other.Block;
+	}
+	return *this;
+}
+
+FGAGridBuffer& FGAGridBuffer::operator=(FGAGridBuffer&& Other)
+{
+	if (this != &Other)
+	{
+		Release();
+		Block = Other.Block;
+		Other.Block = nullptr;
+	}
+	return *this;
+}
+
+void FGAGridBuffer::Release()
+{
+	if (Block)
+	{
+		if (Block->RefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			FGAGridBufferPool::Get().Free(Block);
+		}
+		Block = nullptr;
+	}
+}
+
+bool FGAGridBuffer::IsShared() const
+{
+	return Block && (Block->RefCount.load(std::memory_order_acquire) > 1);
+}
+
+void FGAGridBuffer::Detach()
+{
+	FBlock* Copy = FGAGridBufferPool::Get().Allocate(Block->Num);
+	Copy->Num = Block->Num;
+	FMemory::Memcpy(Copy->GetValues(), Block->GetValues(), Block->Num * sizeof(float));
+
+	Release();
+	Block = Copy;
+}
+
+void FGAGridBuffer::SetNumUninitialized(int32 Count)
+{
+	if (Count <= 0)
+	{
+		Release();
+		return;
+	}
+
+	if (Block && !IsShared() && (Block->Capacity >= Count))
+	{
+		Block->Num = Count;
+		return;
+	}
+
+	FBlock* NewBlock = FGAGridBufferPool::Get().Allocate(Count);
+	NewBlock->Num = Count;
+
+	Release();
+	Block = NewBlock;
+}
+
+void FGAGridBuffer::Init(float Value, int32 Count)
+{
+	SetNumUninitialized(Count);
+
+	if (Block)
+	{
+		float* Values = Block->GetValues();
+		for (int32 Index = 0; Index < Count; Index++)
+		{
+			Values[Index] = Value;
+		}
+	}
+}
+
+SIZE_T FGAGridBuffer::GetAllocatedSize() const
+{
+	return Block ? sizeof(FBlock) + SIZE_T(Block->Capacity) * sizeof(float) : 0;
+}
+
+
+// --------------------- FGAGridBufferPool ---------------------
+
+FGAGridBufferPool& FGAGridBufferPool::Get()
+{
+	static FGAGridBufferPool Pool;
+	return Pool;
+}
+
+FGAGridBuffer::FBlock* FGAGridBufferPool::Allocate(int32 Count)
+{
+	const int32 Bucket = FMath::Max(int32(FMath::CeilLogTwo(uint32(FMath::Max(Count, 1)))), MinBucket);
+	check(Bucket < BucketCount);
+
+	FGAGridBuffer::FBlock* Block = nullptr;
+	{
+		FScopeLock ScopeLock(&Lock);
+		if (FreeLists[Bucket].Num() > 0)
+		{
+			Block = FreeLists[Bucket].Pop(false);
+		}
+	}
+
+	if (Block == nullptr)
+	{
+		const int32 Capacity = 1 << Bucket;
+		void* Memory = FMemory::Malloc(sizeof(FGAGridBuffer::FBlock) + SIZE_T(Capacity) * sizeof(float), alignof(FGAGridBuffer::FBlock));
+		Block = new (Memory) FGAGridBuffer::FBlock();
+		Block->Capacity = Capacity;
+	}
+
+	Block->RefCount.store(1, std::memory_order_relaxed);
+	Block->Num = 0;
+	return Block;
+}
+
+void FGAGridBufferPool::Free(FGAGridBuffer::FBlock* Block)
+{
+	const int32 Bucket = FMath::CeilLogTwo(uint32(Block->Capacity));
+	{
+		FScopeLock ScopeLock(&Lock);
+		if (FreeLists[Bucket].Num() < MaxFreePerBucket)
+		{
+			FreeLists[Bucket].Add(Block);
+			return;
+		}
+	}
+
+	Block->~FBlock();
+	FMemory::Free(Block);
+}
+
+void FGAGridBufferPool::Trim()
+{
+	TArray<FGAGridBuffer::FBlock*> ToFree;
+	{
+		FScopeLock ScopeLock(&Lock);
+		for (TArray<FGAGridBuffer::FBlock*>& FreeList : FreeLists)
+		{
+			ToFree.Append(FreeList);
+			FreeList.Empty();
+		}
+	}
+
+	for (FGAGridBuffer::FBlock* Block : ToFree)
+	{
+		Block->~FBlock();
+		FMemory::Free(Block);
+	}
+}
+
+SIZE_T FGAGridBufferPool::GetCachedBytes() const
+{
+	FScopeLock ScopeLock(&Lock);
+
+	SIZE_T Bytes = 0;
+	for (int32 Bucket = 0; Bucket < BucketCount; Bucket++)
+	{
+		Bytes += FreeLists[Bucket].Num() * (sizeof(FGAGridBuffer::FBlock) + (SIZE_T(1) << Bucket) * sizeof(float));
+	}
+	return Bytes;
+}
+
+
+static FAutoConsoleCommand TrimGridBufferPoolCommand(
+	TEXT("GameAI.Grid.TrimBufferPool"),
+	TEXT("Free every grid map buffer sitting in the pool."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		const SIZE_T Bytes = FGAGridBufferPool::Get().GetCachedBytes();
+		FGAGridBufferPool::Get().Trim();
+		UE_LOG(LogTemp, Display, TEXT("Freed %llu bytes of pooled grid buffers."), uint64(Bytes));
+	}));
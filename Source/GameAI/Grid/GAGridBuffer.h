@@ -0,0 +1,126 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+
+// Storage for grid map values.
+//
+// A buffer is a handle to a reference-counted block of floats. Copying a buffer just bumps the count; the first
+// write through a shared handle copies the block (copy-on-write), so copies still behave like values. Blocks come
+// from FGAGridBufferPool, bucketed by size, and go back to it when the last handle lets go -- so code that builds
+// the same size of map over and over (e.g. a query every frame) stops allocating once the pool has warmed up.
+//
+// Only the parts of the TArray interface the grid code uses are here.
+
+class FGAGridBuffer
+{
+public:
+	FGAGridBuffer() : Block(nullptr) {}
+	FGAGridBuffer(const FGAGridBuffer& Other);
+	FGAGridBuffer(FGAGridBuffer&& Other) : Block(Other.Block) { Other.Block = nullptr; }
+	~FGAGridBuffer() { Release(); }
+
+	FGAGridBuffer& operator=(const FGAGridBuffer& Other);
+	FGAGridBuffer& operator=(FGAGridBuffer&& Other);
+
+	FORCEINLINE int32 Num() const { return Block ? Block->Num : 0; }
+
+	FORCEINLINE bool IsValidIndex(int32 Index) const { return (Index >= 0) && (Index < Num()); }
+
+	FORCEINLINE const float* GetData() const { return Block ? Block->GetValues() : nullptr; }
+
+	// Writable access. Copies the block first if anyone else is looking at it.
+	FORCEINLINE float* GetData()
+	{
+		MakeUnique();
+		return Block ? Block->GetValues() : nullptr;
+	}
+
+	FORCEINLINE const float& operator[](int32 Index) const
+	{
+		checkSlow(IsValidIndex(Index));
+		return Block->GetValues()[Index];
+	}
+
+	FORCEINLINE float& operator[](int32 Index)
+	{
+		checkSlow(IsValidIndex(Index));
+		MakeUnique();
+		return Block->GetValues()[Index];
+	}
+
+	// Resize to Count, every element set to Value. Keeps the current block if it's ours alone and big enough.
+	void Init(float Value, int32 Count);
+
+	// Resize to Count, contents undefined
+	void SetNumUninitialized(int32 Count);
+
+	// Let go of the block
+	void Empty() { Release(); }
+
+	// True if another buffer shares our block
+	bool IsShared() const;
+
+	// Make sure nobody else shares our block, copying it if they do
+	FORCEINLINE void MakeUnique()
+	{
+		if (Block && IsShared())
+		{
+			Detach();
+		}
+	}
+
+	SIZE_T GetAllocatedSize() const;
+
+	friend void Swap(FGAGridBuffer& A, FGAGridBuffer& B)
+	{
+		::Swap(A.Block, B.Block);
+	}
+
+	// The header at the start of every pooled block, followed by the values
+	struct alignas(16) FBlock
+	{
+		std::atomic<int32> RefCount;
+		int32 Num;
+		int32 Capacity;
+
+		FORCEINLINE float* GetValues() { return reinterpret_cast<float*>(this + 1); }
+		FORCEINLINE const float* GetValues() const { return reinterpret_cast<const float*>(this + 1); }
+	};
+
+private:
+	void Release();
+	void Detach();
+
+	FBlock* Block;
+};
+
+
+// Size-bucketed free lists of buffer blocks. Thread safe.
+// Buckets are powers of two, and each keeps a handful of free blocks around for reuse.
+
+class FGAGridBufferPool
+{
+public:
+	static FGAGridBufferPool& Get();
+
+	// A block with room for at least Count values, with a ref count of 1
+	FGAGridBuffer::FBlock* Allocate(int32 Count);
+
+	void Free(FGAGridBuffer::FBlock* Block);
+
+	// Give every cached block back to the allocator
+	void Trim();
+
+	// How many bytes are sitting in the free lists
+	SIZE_T GetCachedBytes() const;
+
+private:
+	static constexpr int32 MinBucket = 6;		// 64 values
+	static constexpr int32 BucketCount = 32;
+	static constexpr int32 MaxFreePerBucket = 8;
+
+	mutable FCriticalSection Lock;
+	TArray<FGAGridBuffer::FBlock*> FreeLists[BucketCount];
+};
@@ -0,0 +1,175 @@
+#include "GAGridLayerFile.h"
+#include "GAGridActor.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+
+
+static_assert(sizeof(FGAGridLayerFileHeader) <= FGAGridLayerFileHeader::PageSize, "Layer file header must fit in its page");
+
+
+FGAMappedGridLayer::~FGAMappedGridLayer()
+{
+	// The region has to go before the file it maps
+	Region.Reset();
+	FileHandle.Reset();
+}
+
+
+TSharedPtr<const FGAMappedGridLayer, ESPMode::ThreadSafe> FGAMappedGridLayer::Open(const FString& Path)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	TUniquePtr<IMappedFileHandle> FileHandle(PlatformFile.OpenMapped(*Path));
+	if (!FileHandle)
+	{
+		return nullptr;
+	}
+
+	const int64 FileSize = FileHandle->GetFileSize();
+	if (FileSize < FGAGridLayerFileHeader::PageSize)
+	{
+		return nullptr;
+	}
+
+	// Map the whole file, but don't ask for it to be preloaded -- pages (and so tiles) come in when they're first touched
+	TUniquePtr<IMappedFileRegion> Region(FileHandle->MapRegion(0, FileSize, false));
+	if (!Region)
+	{
+		return nullptr;
+	}
+
+	FGAGridLayerFileHeader Header;
+	FMemory::Memcpy(&Header, Region->GetMappedPtr(), sizeof(Header));
+
+	FGridBox Bounds(Header.MinX, Header.MaxX, Header.MinY, Header.MaxY);
+	const int32 ElementSize = Header.GetElementSize();
+	const bool bValid =
+		(Header.Magic == FGAGridLayerFileHeader::FileMagic) &&
+		(Header.Version == FGAGridLayerFileHeader::FileVersion) &&
+		((Header.ElementType == EGAGridLayerElement::Float32) || (Header.ElementType == EGAGridLayerElement::UInt8)) &&
+		Bounds.IsValid() &&
+		(Header.TilesX == FMath::DivideAndRoundUp(Bounds.GetWidth(), FGAGridLayerFileHeader::TileSize)) &&
+		(Header.TilesY == FMath::DivideAndRoundUp(Bounds.GetHeight(), FGAGridLayerFileHeader::TileSize)) &&
+		(Header.TileStride >= int64(FGAGridLayerFileHeader::TileSize) * FGAGridLayerFileHeader::TileSize * ElementSize) &&
+		(Header.DataOffset >= FGAGridLayerFileHeader::PageSize) &&
+		(Header.GetFileSize() <= Region->GetMappedSize());
+
+	if (!bValid)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("FGAMappedGridLayer: %s is not a valid layer file."), *Path);
+		return nullptr;
+	}
+
+	TSharedPtr<FGAMappedGridLayer, ESPMode::ThreadSafe> Layer = MakeShareable(new FGAMappedGridLayer());
+	Layer->Header = Header;
+	Layer->TileBase = Region->GetMappedPtr() + Header.DataOffset;
+	Layer->Region = MoveTemp(Region);
+	Layer->FileHandle = MoveTemp(FileHandle);
+
+	return Layer;
+}
+
+
+bool FGAMappedGridLayer::WriteTiles(const FString& Path, FGAGridLayerFileHeader& Header, TFunctionRef<void(int32 X, int32 Y, uint8* ElementOut)> GetElement)
+{
+	const int32 Width = Header.MaxX - Header.MinX + 1;
+	const int32 Height = Header.MaxY - Header.MinY + 1;
+	const int32 ElementSize = Header.GetElementSize();
+	const int64 TileBytes = int64(FGAGridLayerFileHeader::TileSize) * FGAGridLayerFileHeader::TileSize * ElementSize;
+
+	Header.TilesX = FMath::DivideAndRoundUp(Width, FGAGridLayerFileHeader::TileSize);
+	Header.TilesY = FMath::DivideAndRoundUp(Height, FGAGridLayerFileHeader::TileSize);
+	Header.TileStride = Align(TileBytes, FGAGridLayerFileHeader::PageSize);
+	Header.DataOffset = FGAGridLayerFileHeader::PageSize;
+
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*Path));
+	if (!Writer)
+	{
+		return false;
+	}
+
+	// Header page
+	TArray<uint8> Buffer;
+	Buffer.SetNumZeroed(FGAGridLayerFileHeader::PageSize);
+	FMemory::Memcpy(Buffer.GetData(), &Header, sizeof(Header));
+	Writer->Serialize(Buffer.GetData(), Buffer.Num());
+
+	// Tiles. Cells past the edge of the bounds are left as zero.
+	Buffer.SetNumUninitialized(Header.TileStride);
+	for (int32 TileY = 0; TileY < Header.TilesY; TileY++)
+	{
+		for (int32 TileX = 0; TileX < Header.TilesX; TileX++)
+		{
+			FMemory::Memzero(Buffer.GetData(), Buffer.Num());
+
+			const int32 X0 = TileX * FGAGridLayerFileHeader::TileSize;
+			const int32 Y0 = TileY * FGAGridLayerFileHeader::TileSize;
+			const int32 X1 = FMath::Min(X0 + FGAGridLayerFileHeader::TileSize, Width);
+			const int32 Y1 = FMath::Min(Y0 + FGAGridLayerFileHeader::TileSize, Height);
+
+			for (int32 Y = Y0; Y < Y1; Y++)
+			{
+				for (int32 X = X0; X < X1; X++)
+				{
+					const int32 InTileIndex = ((Y - Y0) << FGAGridLayerFileHeader::TileShift) + (X - X0);
+					GetElement(X, Y, Buffer.GetData() + InTileIndex * ElementSize);
+				}
+			}
+
+			Writer->Serialize(Buffer.GetData(), Buffer.Num());
+		}
+	}
+
+	return Writer->Close();
+}
+
+
+bool FGAMappedGridLayer::Write(const FString& Path, const FGAGridMap& GridMap)
+{
+	if (!GridMap.IsValid())
+	{
+		return false;
+	}
+
+	FGAGridLayerFileHeader Header;
+	Header.ElementType = EGAGridLayerElement::Float32;
+	Header.XCount = GridMap.XCount;
+	Header.YCount = GridMap.YCount;
+	Header.MinX = GridMap.GridBounds.MinX;
+	Header.MaxX = GridMap.GridBounds.MaxX;
+	Header.MinY = GridMap.GridBounds.MinY;
+	Header.MaxY = GridMap.GridBounds.MaxY;
+
+	return WriteTiles(Path, Header, [&GridMap](int32 X, int32 Y, uint8* ElementOut)
+	{
+		FCellRef Cell;
+		float Value = 0.0f;
+		GridMap.LocalToCellRef(X, Y, Cell);
+		GridMap.GetValue(Cell, Value);
+		FMemory::Memcpy(ElementOut, &Value, sizeof(Value));
+	});
+}
+
+
+bool FGAMappedGridLayer::Write(const FString& Path, const AGAGridActor& Grid)
+{
+	if ((Grid.XCount * Grid.YCount <= 0) || (Grid.Data.Num() != Grid.GetStorageCount()))
+	{
+		return false;
+	}
+
+	FGAGridLayerFileHeader Header;
+	Header.ElementType = EGAGridLayerElement::UInt8;
+	Header.XCount = Grid.XCount;
+	Header.YCount = Grid.YCount;
+	Header.MinX = 0;
+	Header.MaxX = Grid.XCount - 1;
+	Header.MinY = 0;
+	Header.MaxY = Grid.YCount - 1;
+
+	return WriteTiles(Path, Header, [&Grid](int32 X, int32 Y, uint8* ElementOut)
+	{
+		*ElementOut = uint8(Grid.GetCellData(FCellRef(X, Y)));
+	});
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GAGridMap.h"
+
+class AGAGridActor;
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+
+// A flat, memory-mappable file format for grid layers (distance tables, cover scores, visibility, etc.)
+//
+// The file is a fixed-size header padded out to a page, followed by the layer cut up into square tiles.
+// Tiles are stored one after the other (row-major by tile), each one row-major inside and padded out to a
+// whole number of pages. So reading a handful of neighboring cells only ever touches one or two pages,
+// and a query that only looks at part of the grid only pages in the tiles it looks at -- the OS brings
+// them in on first touch, nothing gets read up front.
+
+enum class EGAGridLayerElement : uint8
+{
+	Float32,
+	UInt8
+};
+
+struct FGAGridLayerFileHeader
+{
+	static constexpr uint32 FileMagic = 0x464C4147;		// "GALF"
+
+	// Bump this whenever the layout of the file changes
+	static constexpr int32 FileVersion = 1;
+
+	// Everything is aligned to this, so that tiles start on page boundaries
+	static constexpr int64 PageSize = 4096;
+
+	// Tiles are TileSize x TileSize cells. Power of two.
+	static constexpr int32 TileShift = 6;
+	static constexpr int32 TileSize = 1 << TileShift;
+	static constexpr int32 TileMask = TileSize - 1;
+
+	uint32 Magic = FileMagic;
+	int32 Version = FileVersion;
+	EGAGridLayerElement ElementType = EGAGridLayerElement::Float32;
+	uint8 Padding[3] = { 0, 0, 0 };
+
+	// Same meaning as the FGAGridMap fields
+	int32 XCount = 0;
+	int32 YCount = 0;
+	int32 MinX = 0;
+	int32 MaxX = 0;
+	int32 MinY = 0;
+	int32 MaxY = 0;
+
+	int32 TilesX = 0;
+	int32 TilesY = 0;
+
+	// Bytes from the start of one tile to the next
+	int64 TileStride = 0;
+
+	// Offset of the first tile from the start of the file
+	int64 DataOffset = 0;
+
+	int32 GetElementSize() const { return (ElementType == EGAGridLayerElement::Float32) ? sizeof(float) : sizeof(uint8); }
+	int64 GetFileSize() const { return DataOffset + int64(TilesX) * int64(TilesY) * TileStride; }
+};
+
+
+// A read-only, zero-copy view of a layer file.
+// Lookups go straight to the mapped memory. Safe to read from any number of threads at once.
+
+class FGAMappedGridLayer
+{
+public:
+	~FGAMappedGridLayer();
+
+	// Map a layer file. Returns null if the file is missing or doesn't look right.
+	static TSharedPtr<const FGAMappedGridLayer, ESPMode::ThreadSafe> Open(const FString& Path);
+
+	// Write a float layer covering the map's GridBounds
+	static bool Write(const FString& Path, const FGAGridMap& GridMap);
+
+	// Write the grid actor's cell flags as a byte layer covering the whole grid
+	static bool Write(const FString& Path, const AGAGridActor& Grid);
+
+	const FGAGridLayerFileHeader& GetHeader() const { return Header; }
+
+	FGridBox GetGridBounds() const { return FGridBox(Header.MinX, Header.MaxX, Header.MinY, Header.MaxY); }
+
+	// X and Y are local to the bounds, the same as FGAGridMap::CellRefToLocal gives you.
+	// No bounds checking here, that's the caller's job.
+	FORCEINLINE float GetValue(int32 X, int32 Y) const
+	{
+		const int64 TileIndex = int64(Y >> FGAGridLayerFileHeader::TileShift) * Header.TilesX + (X >> FGAGridLayerFileHeader::TileShift);
+		const uint8* Tile = TileBase + TileIndex * Header.TileStride;
+		const int32 InTileIndex = ((Y & FGAGridLayerFileHeader::TileMask) << FGAGridLayerFileHeader::TileShift) + (X & FGAGridLayerFileHeader::TileMask);
+
+		if (Header.ElementType == EGAGridLayerElement::Float32)
+		{
+			return reinterpret_cast<const float*>(Tile)[InTileIndex];
+		}
+		else
+		{
+			return float(Tile[InTileIndex]);
+		}
+	}
+
+private:
+	FGAMappedGridLayer() {}
+
+	static bool WriteTiles(const FString& Path, FGAGridLayerFileHeader& Header, TFunctionRef<void(int32 X, int32 Y, uint8* ElementOut)> GetElement);
+
+	FGAGridLayerFileHeader Header;
+
+	TUniquePtr<IMappedFileHandle> FileHandle;
+	TUniquePtr<IMappedFileRegion> Region;
+
+	// Start of the first tile in the mapped memory
+	const uint8* TileBase = nullptr;
+};
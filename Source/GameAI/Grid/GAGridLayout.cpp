@@ -0,0 +1,97 @@
+#include "GAGridLayout.h"
+#include "Misc/ScopeLock.h"
+
+
+// Spread the low 16 bits of Value out into the even bits
+static uint32 SpreadBits(uint32 Value)
+{
+	Value &= 0x0000ffff;
+	Value = (Value | (Value << 8)) & 0x00ff00ff;
+	Value = (Value | (Value << 4)) & 0x0f0f0f0f;
+	Value = (Value | (Value << 2)) & 0x33333333;
+	Value = (Value | (Value << 1)) & 0x55555555;
+	return Value;
+}
+
+// Slot tables only depend on the tile counts, and lots of maps share the same grid, so build each one once
+static TSharedPtr<const TArray<int32>, ESPMode::ThreadSafe> GetSlotTable(int32 TilesX, int32 TilesY)
+{
+	static FCriticalSection CacheLock;
+	static TMap<FIntPoint, TSharedPtr<const TArray<int32>, ESPMode::ThreadSafe>> Cache;
+
+	FScopeLock Lock(&CacheLock);
+
+	const FIntPoint Key(TilesX, TilesY);
+	if (const TSharedPtr<const TArray<int32>, ESPMode::ThreadSafe>* Found = Cache.Find(Key))
+	{
+		return *Found;
+	}
+
+	const int32 TileCount = TilesX * TilesY;
+
+	// Sort the tiles by their Morton code. The tile grid usually isn't a power of two on a side,
+	// so this leaves gaps in the codes -- the slots just close them up.
+	TArray<TPair<uint32, int32>> Codes;
+	Codes.SetNumUninitialized(TileCount);
+	for (int32 TileY = 0; TileY < TilesY; TileY++)
+	{
+		for (int32 TileX = 0; TileX < TilesX; TileX++)
+		{
+			const int32 Tile = TileY * TilesX + TileX;
+			Codes[Tile] = TPair<uint32, int32>(SpreadBits(TileX) | (SpreadBits(TileY) << 1), Tile);
+		}
+	}
+	Codes.Sort([](const TPair<uint32, int32>& A, const TPair<uint32, int32>& B) { return A.Key < B.Key; });
+
+	// First half is tile -> slot, second half is slot -> tile
+	TSharedPtr<TArray<int32>, ESPMode::ThreadSafe> Table = MakeShared<TArray<int32>, ESPMode::ThreadSafe>();
+	Table->SetNumUninitialized(TileCount * 2);
+	for (int32 Slot = 0; Slot < TileCount; Slot++)
+	{
+		(*Table)[Codes[Slot].Value] = Slot;
+		(*Table)[TileCount + Slot] = Codes[Slot].Value;
+	}
+
+	Cache.Add(Key, Table);
+	return Table;
+}
+
+
+FGAGridIndexer FGAGridIndexer::Make(EGridLayout Layout, int32 Width, int32 Height)
+{
+	FGAGridIndexer Indexer;
+	Indexer.Layout = Layout;
+	Indexer.Width = FMath::Max(Width, 0);
+	Indexer.Height = FMath::Max(Height, 0);
+
+	switch (Layout)
+	{
+	case EGridLayout::Tiled8:
+		Indexer.TileShift = 3;
+		break;
+	case EGridLayout::Tiled16:
+		Indexer.TileShift = 4;
+		break;
+	default:
+		Indexer.TileShift = 0;
+		break;
+	}
+
+	if (Indexer.IsTiled() && (Indexer.Width > 0) && (Indexer.Height > 0))
+	{
+		Indexer.TilesX = FMath::DivideAndRoundUp(Indexer.Width, Indexer.GetTileSize());
+		Indexer.TilesY = FMath::DivideAndRoundUp(Indexer.Height, Indexer.GetTileSize());
+
+		const int32 TileCount = Indexer.TilesX * Indexer.TilesY;
+		Indexer.SlotTable = GetSlotTable(Indexer.TilesX, Indexer.TilesY);
+		Indexer.TileSlots = TArrayView<const int32>(Indexer.SlotTable->GetData(), TileCount);
+		Indexer.SlotTiles = TArrayView<const int32>(Indexer.SlotTable->GetData() + TileCount, TileCount);
+	}
+	else
+	{
+		// Nothing to tile
+		Indexer.TileShift = 0;
+	}
+
+	return Indexer;
+}
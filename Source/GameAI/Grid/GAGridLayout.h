@@ -0,0 +1,154 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GAGridLayout.generated.h"
+
+
+// How the cells of a grid (or grid map) are laid out in memory
+UENUM(BlueprintType)
+enum class EGridLayout : uint8
+{
+	// One row after another. Simple, but the cells above and below a cell are a whole row away.
+	RowMajor,
+
+	// Square tiles of 8x8 or 16x16 cells, row-major inside each tile, with the tiles themselves in Z (Morton) order.
+	// A 3x3 window or a small box lands in one or two tiles, so it touches a couple of cache lines instead of
+	// one per row. The storage is padded out to whole tiles.
+	Tiled8,
+	Tiled16
+};
+
+
+// Turns local (X, Y) coordinates into an index into the storage array, for a given layout and size.
+// Cheap to copy -- the tile slot table is shared between every indexer with the same tiling.
+
+struct FGAGridIndexer
+{
+	static FGAGridIndexer Make(EGridLayout Layout, int32 Width, int32 Height);
+
+	EGridLayout Layout = EGridLayout::RowMajor;
+	int32 Width = 0;
+	int32 Height = 0;
+
+	// 0 for row-major
+	int32 TileShift = 0;
+	int32 TilesX = 0;
+	int32 TilesY = 0;
+
+	bool IsTiled() const { return TileShift > 0; }
+
+	int32 GetTileSize() const { return 1 << TileShift; }
+
+	bool Matches(EGridLayout LayoutIn, int32 WidthIn, int32 HeightIn) const
+	{
+		return (Layout == LayoutIn) && (Width == WidthIn) && (Height == HeightIn);
+	}
+
+	// How many elements the storage array needs. Bigger than Width * Height when tiled, because of the padding.
+	int32 GetStorageCount() const
+	{
+		return IsTiled() ? ((TilesX * TilesY) << (2 * TileShift)) : (Width * Height);
+	}
+
+	// No bounds checking, that's the caller's job
+	FORCEINLINE int32 Index(int32 X, int32 Y) const
+	{
+		if (TileShift == 0)
+		{
+			return Y * Width + X;
+		}
+
+		const int32 TileMask = (1 << TileShift) - 1;
+		const int32 Slot = TileSlots[(Y >> TileShift) * TilesX + (X >> TileShift)];
+		return (Slot << (2 * TileShift)) + ((Y & TileMask) << TileShift) + (X & TileMask);
+	}
+
+	// Visit every run of cells that are next to each other both in X and in storage, in storage order.
+	// Func(int32 X, int32 Y, int32 Index, int32 Count) -- the span covers (X .. X + Count - 1, Y), starting at Index.
+	// Padding is never visited.
+	template<typename FuncType>
+	void ForEachSpan(FuncType&& Func) const
+	{
+		if (!IsTiled())
+		{
+			for (int32 Y = 0; Y < Height; Y++)
+			{
+				Func(0, Y, Y * Width, Width);
+			}
+			return;
+		}
+
+		ForEachTile([&Func](const FIntRect& Rect, int32 BaseIndex, int32 RowStride)
+		{
+			for (int32 Y = Rect.Min.Y; Y <= Rect.Max.Y; Y++)
+			{
+				Func(Rect.Min.X, Y, BaseIndex + (Y - Rect.Min.Y) * RowStride, Rect.Max.X - Rect.Min.X + 1);
+			}
+		});
+	}
+
+	// Visit the grid a block at a time, in storage order. For tiled layouts the blocks are the tiles, for row-major
+	// they are 16x16 blocks of rows. Either way, cell (X, Y) of the block is at BaseIndex + (Y - Rect.Min.Y) * RowStride + (X - Rect.Min.X).
+	// Func(const FIntRect& Rect, int32 BaseIndex, int32 RowStride) -- Rect is inclusive, clipped to the grid.
+	template<typename FuncType>
+	void ForEachTile(FuncType&& Func) const
+	{
+		const int32 BlockShift = IsTiled() ? TileShift : 4;
+		const int32 BlockSize = 1 << BlockShift;
+
+		if (!IsTiled())
+		{
+			for (int32 Y0 = 0; Y0 < Height; Y0 += BlockSize)
+			{
+				for (int32 X0 = 0; X0 < Width; X0 += BlockSize)
+				{
+					FIntRect Rect(X0, Y0, FMath::Min(X0 + BlockSize, Width) - 1, FMath::Min(Y0 + BlockSize, Height) - 1);
+					Func(Rect, Y0 * Width + X0, Width);
+				}
+			}
+			return;
+		}
+
+		for (int32 Slot = 0; Slot < SlotTiles.Num(); Slot++)
+		{
+			const int32 X0 = (SlotTiles[Slot] % TilesX) << TileShift;
+			const int32 Y0 = (SlotTiles[Slot] / TilesX) << TileShift;
+			FIntRect Rect(X0, Y0, FMath::Min(X0 + BlockSize, Width) - 1, FMath::Min(Y0 + BlockSize, Height) - 1);
+			Func(Rect, Slot << (2 * TileShift), BlockSize);
+		}
+	}
+
+	// Copy Data from one layout to another, filling any padding with PadValue
+	template<typename ElementType>
+	static void Relayout(const FGAGridIndexer& From, const FGAGridIndexer& To, TArray<ElementType>& Data, ElementType PadValue)
+	{
+		check((From.Width == To.Width) && (From.Height == To.Height));
+		if (Data.Num() != From.GetStorageCount())
+		{
+			return;
+		}
+
+		TArray<ElementType> NewData;
+		NewData.Init(PadValue, To.GetStorageCount());
+
+		From.ForEachSpan([&From, &To, &Data, &NewData](int32 X, int32 Y, int32 Index, int32 Count)
+		{
+			for (int32 I = 0; I < Count; I++)
+			{
+				NewData[To.Index(X + I, Y)] = Data[Index + I];
+			}
+		});
+
+		Data = MoveTemp(NewData);
+	}
+
+private:
+	// For each tile (numbered row-major), its slot in storage. Slots go in Z-order.
+	TArrayView<const int32> TileSlots;
+
+	// And the reverse: for each slot, the (row-major) tile in it
+	TArrayView<const int32> SlotTiles;
+
+	// Keeps the views above alive
+	TSharedPtr<const TArray<int32>, ESPMode::ThreadSafe> SlotTable;
+};
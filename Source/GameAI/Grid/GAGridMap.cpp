@@ -1,5 +1,7 @@
 #include "GAGridMap.h"
 #include "GAGridActor.h"
+#include "GAGridLayerFile.h"
+#include "Serialization/CustomVersion.h"
 
 UE_DISABLE_OPTIMIZATION
 
@@ -10,10 +12,21 @@ bool FGridBox::IsValidCell(const FCellRef& Cell) const
 	return (Cell.X >= MinX) && (Cell.X <= MaxX) && (Cell.Y >= MinY) && (Cell.Y <= MaxY);
 }
 
+bool FGridBox::CellRefToLocal(const FCellRef& Cell, int32& X, int32& Y) const
+{
+	if (IsValidCell(Cell))
+	{
+		X = Cell.X - MinX;
+		Y = Cell.Y - MinY;
+		return true;
+	}
+	return false;
+}
+
 
 // --------------------- FGAGridMap ---------------------
 
-FGAGridMap::FGAGridMap() : XCount(INDEX_NONE), YCount(INDEX_NONE), GridBounds()
+FGAGridMap::FGAGridMap() : XCount(INDEX_NONE), YCount(INDEX_NONE), GridBounds(), Layout(EGridLayout::RowMajor)
 {
 	// we are empty
 }
@@ -24,6 +37,7 @@ FGAGridMap::FGAGridMap(int32 XCountIn, int32 YCountIn, float InitialValue)
 	XCount = XCountIn;
 	YCount = YCountIn;
 	GridBounds = FGridBox(0, XCount - 1, 0, YCount - 1);
+	Layout = EGridLayout::RowMajor;
 
 	ResetData(InitialValue);
 }
@@ -33,6 +47,7 @@ FGAGridMap::FGAGridMap(const AGAGridActor* Grid, float InitialValue)
 	XCount = Grid->XCount;
 	YCount = Grid->YCount;
 	GridBounds = FGridBox(0, XCount - 1, 0, YCount - 1);
+	Layout = Grid->Layout;
 
 	ResetData(InitialValue);
 }
@@ -42,12 +57,15 @@ FGAGridMap::FGAGridMap(const AGAGridActor* Grid, const FGridBox& GridBoxIn, floa
 	XCount = Grid->XCount;
 	YCount = Grid->YCount;
 	GridBounds = GridBoxIn;
+	Layout = Grid->Layout;
 
 	ResetData(InitialValue);
 }
 
 void FGAGridMap::ResetData(float InitialValue)
 {
+	MappedLayer.Reset();
+
 	if (GridBounds.IsValid())
 	{
 		int32 BoxWidth = GridBounds.GetWidth();
@@ -56,17 +74,151 @@ void FGAGridMap::ResetData(float InitialValue)
 		check(BoxWidth > 0);
 		check(BoxHeight > 0);
 
-		int32 CellCount = BoxWidth * BoxHeight;
-		Data.SetNum(CellCount);
+		// Padding gets the initial value too, but nothing ever reads it
+		Indexer = FGAGridIndexer::Make(Layout, BoxWidth, BoxHeight);
+		Data.Init(InitialValue, Indexer.GetStorageCount());
+	}
+	else
+	{
+		Indexer = FGAGridIndexer();
+		Data.Empty();
+	}
+}
+
+void FGAGridMap::SetLayout(EGridLayout NewLayout)
+{
+	if (NewLayout == Layout)
+	{
+		return;
+	}
+
+	Layout = NewLayout;
+	if (!GridBounds.IsValid())
+	{
+		return;
+	}
+
+	FGAGridIndexer NewIndexer = FGAGridIndexer::Make(Layout, GridBounds.GetWidth(), GridBounds.GetHeight());
+	if (!MappedLayer.IsValid() && (Data.Num() == Indexer.GetStorageCount()))
+	{
+		FGAGridBuffer NewData;
+		NewData.Init(0.0f, NewIndexer.GetStorageCount());
+
+		const float* OldValues = Data.GetData();
+		float* NewValues = NewData.GetData();
+		Indexer.ForEachSpan([&NewIndexer, OldValues, NewValues](int32 X, int32 Y, int32 Index, int32 Count)
+		{
+			for (int32 I = 0; I < Count; I++)
+			{
+				NewValues[NewIndexer.Index(X + I, Y)] = OldValues[Index + I];
+			}
+		});
+
+		Data = MoveTemp(NewData);
+	}
+	Indexer = NewIndexer;
+}
+
+void FGAGridMap::Swap(FGAGridMap& Other)
+{
+	::Swap(XCount, Other.XCount);
+	::Swap(YCount, Other.YCount);
+	::Swap(GridBounds, Other.GridBounds);
+	::Swap(Layout, Other.Layout);
+	::Swap(Indexer, Other.Indexer);
+	::Swap(Data, Other.Data);
+	::Swap(MappedLayer, Other.MappedLayer);
+}
+
+void FGAGridMap::RefreshIndexer()
+{
+	if (GridBounds.IsValid() && !Indexer.Matches(Layout, GridBounds.GetWidth(), GridBounds.GetHeight()))
+	{
+		Indexer = FGAGridIndexer::Make(Layout, GridBounds.GetWidth(), GridBounds.GetHeight());
+	}
+}
+
+// Maps saved before this version only have their properties, not their values
+struct FGAGridMapVersion
+{
+	enum Type
+	{
+		BeforeCustomVersion = 0,
+		SerializeValues,
+
+		VersionPlusOne,
+		LatestVersion = VersionPlusOne - 1
+	};
+
+	static const FGuid GUID;
+};
 
-		for (int32 Index = 0; Index < CellCount; Index++)
+const FGuid FGAGridMapVersion::GUID(0x6A3F1C52, 0x8E4B4D17, 0xA2C9E305, 0x5B7D91F4);
+static FCustomVersionRegistration GRegisterGAGridMapVersion(FGAGridMapVersion::GUID, FGAGridMapVersion::LatestVersion, TEXT("GAGridMap"));
+
+bool FGAGridMap::Serialize(FArchive& Ar)
+{
+	Ar.UsingCustomVersion(FGAGridMapVersion::GUID);
+
+	UScriptStruct* Struct = FGAGridMap::StaticStruct();
+	Struct->SerializeTaggedProperties(Ar, reinterpret_cast<uint8*>(this), Struct, NULL);
+
+	if (Ar.CustomVer(FGAGridMapVersion::GUID) < FGAGridMapVersion::SerializeValues)
+	{
+		return true;
+	}
+
+	if (Ar.IsSaving())
+	{
+		// Write straight out of the (possibly shared) block, without triggering a copy-on-write
+		FGAGridMap Materialized;
+		const FGAGridMap* Source = this;
+		if (IsMapped())
+		{
+			Materialized = *this;
+			Materialized.Materialize();
+			Source = &Materialized;
+		}
+
+		int32 Count = Source->Data.Num();
+		Ar << Count;
+		if (Count > 0)
 		{
-			Data[Index] = InitialValue;
+			Ar.Serialize(const_cast<float*>(Source->Data.GetData()), Count * sizeof(float));
 		}
 	}
-	else
+	else if (Ar.IsLoading())
 	{
-		Data.Empty();
+		int32 Count = 0;
+		Ar << Count;
+
+		MappedLayer.Reset();
+		if (Count > 0)
+		{
+			Data.SetNumUninitialized(Count);
+			Ar.Serialize(Data.GetData(), Count * sizeof(float));
+		}
+		else
+		{
+			Data.Empty();
+		}
+	}
+
+	return true;
+}
+
+void FGAGridMap::PostSerialize(const FArchive& Ar)
+{
+	// The indexer isn't saved, so it doesn't come along when the map is loaded
+	if (Ar.IsLoading())
+	{
+		RefreshIndexer();
+
+		// Old saves (or a truncated one) have no values, so start from zero rather than leave the map invalid
+		if (GridBounds.IsValid() && !IsMapped() && (Data.Num() != Indexer.GetStorageCount()))
+		{
+			Data.Init(0.0f, Indexer.GetStorageCount());
+		}
 	}
 }
 
@@ -93,13 +245,29 @@ bool FGAGridMap::LocalToCellRef(int32 X, int32 Y, FCellRef& Cell) const
 	return false;
 }
 
+int32 FGAGridMap::CellRefToIndex(const FCellRef& Cell) const
+{
+	int32 X, Y;
+	if (!MappedLayer.IsValid() && CellRefToLocal(Cell, X, Y))
+	{
+		return Indexer.Index(X, Y);
+	}
+	return INDEX_NONE;
+}
+
 
 bool FGAGridMap::GetValue(const FCellRef& Cell, float &ValueOut) const
 {
 	int32 X, Y;
 	if (CellRefToLocal(Cell, X, Y))
 	{
-		int32 Index = GridBounds.GetWidth()* Y + X;
+		if (MappedLayer.IsValid())
+		{
+			ValueOut = MappedLayer->GetValue(X, Y);
+			return true;
+		}
+
+		int32 Index = Indexer.Index(X, Y);
 		check(Data.IsValidIndex(Index));
 		ValueOut = Data[Index];
 		return true;
@@ -112,10 +280,28 @@ bool FGAGridMap::GetMaxValue(float& MaxValueOut) const
 	if (IsValid())
 	{
 		MaxValueOut = -UE_MAX_FLT;
-		for (int32 Index = 0; Index < Data.Num(); Index++)
+
+		if (MappedLayer.IsValid())
 		{
-			MaxValueOut = FMath::Max(MaxValueOut, Data[Index]);
+			for (int32 Y = 0; Y < GridBounds.GetHeight(); Y++)
+			{
+				for (int32 X = 0; X < GridBounds.GetWidth(); X++)
+				{
+					MaxValueOut = FMath::Max(MaxValueOut, MappedLayer->GetValue(X, Y));
+				}
+			}
+			return true;
 		}
+
+		// Go span by span, so that tile padding is skipped
+		const float* Values = Data.GetData();
+		Indexer.ForEachSpan([Values, &MaxValueOut](int32 X, int32 Y, int32 Index, int32 Count)
+		{
+			for (int32 I = Index; I < Index + Count; I++)
+			{
+				MaxValueOut = FMath::Max(MaxValueOut, Values[I]);
+			}
+		});
 		return true;
 	}
 	return false;
@@ -127,7 +313,12 @@ bool FGAGridMap::SetValue(const FCellRef& Cell, float Value)
 	int32 X, Y;
 	if (CellRefToLocal(Cell, X, Y))
 	{
-		int32 Index = GridBounds.GetWidth()* Y + X;
+		if (MappedLayer.IsValid())
+		{
+			Materialize();
+		}
+
+		int32 Index = Indexer.Index(X, Y);
 		check(Data.IsValidIndex(Index));
 		Data[Index] = Value;
 		return true;
@@ -136,4 +327,60 @@ bool FGAGridMap::SetValue(const FCellRef& Cell, float Value)
 }
 
 
+bool FGAGridMap::MapFromFile(const FString& Path)
+{
+	TSharedPtr<const FGAMappedGridLayer, ESPMode::ThreadSafe> Layer = FGAMappedGridLayer::Open(Path);
+	if (!Layer.IsValid())
+	{
+		return false;
+	}
+
+	// The bounds have to sit on the grid the file says it was built on, or every CellRef lookup is off
+	const FGAGridLayerFileHeader& Header = Layer->GetHeader();
+	const FGridBox FileBounds = Layer->GetGridBounds();
+	if ((Header.XCount <= 0) || (Header.YCount <= 0) ||
+		(FileBounds.MinX < 0) || (FileBounds.MaxX >= Header.XCount) ||
+		(FileBounds.MinY < 0) || (FileBounds.MaxY >= Header.YCount))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("FGAGridMap: layer file %s has bounds outside its %d x %d grid, not mapping it."), *Path, Header.XCount, Header.YCount);
+		return false;
+	}
+
+	XCount = Header.XCount;
+	YCount = Header.YCount;
+	GridBounds = Layer->GetGridBounds();
+	Indexer = FGAGridIndexer::Make(Layout, GridBounds.GetWidth(), GridBounds.GetHeight());
+	Data.Empty();
+	MappedLayer = Layer;
+	return true;
+}
+
+bool FGAGridMap::WriteToFile(const FString& Path) const
+{
+	return FGAMappedGridLayer::Write(Path, *this);
+}
+
+void FGAGridMap::Materialize()
+{
+	if (!MappedLayer.IsValid())
+	{
+		return;
+	}
+
+	Indexer = FGAGridIndexer::Make(Layout, GridBounds.GetWidth(), GridBounds.GetHeight());
+	Data.Init(0.0f, Indexer.GetStorageCount());
+
+	float* Values = Data.GetData();
+	Indexer.ForEachSpan([this, Values](int32 X, int32 Y, int32 Index, int32 Count)
+	{
+		for (int32 I = 0; I < Count; I++)
+		{
+			Values[Index + I] = MappedLayer->GetValue(X + I, Y);
+		}
+	});
+
+	MappedLayer.Reset();
+}
+
+
 UE_DISABLE_OPTIMIZATION
@@ -2,6 +2,8 @@
 
 #include "CoreMinimal.h"
 #include "Math/MathFwd.h"
+#include "GAGridLayout.h"
+#include "GAGridBuffer.h"
 #include "GAGridMap.generated.h"
 
 
@@ -9,6 +11,7 @@
 // Note that it does not necessarily need to cover the entire grid
 
 class AGAGridActor;
+class FGAMappedGridLayer;
 struct FCellRef;
 
 USTRUCT(BlueprintType)
@@ -48,6 +51,9 @@ struct FGridBox
 	int32 GetCellCount() const { return ((MaxX - MinX) + 1) * ((MaxY - MinY) + 1); }
 
 	bool IsValidCell(const FCellRef& Cell) const;
+
+	// Cell relative to (MinX, MinY). False if it isn't in the box.
+	bool CellRefToLocal(const FCellRef& Cell, int32& X, int32& Y) const;
 };
 
 
@@ -63,6 +69,21 @@ struct FGAGridMap
 
 	void ResetData(float InitialValue);
 
+	// Change the memory layout, keeping the values
+	void SetLayout(EGridLayout NewLayout);
+
+	// Trade contents with another map. O(1), no copying.
+	void Swap(FGAGridMap& Other);
+
+	// Rebuild the indexer after the bounds or layout changed underneath us (e.g. after loading)
+	void RefreshIndexer();
+
+	// The properties go through the usual tagged serialization, then Data follows as a raw block.
+	// Saving a mapped map writes out its values, so it loads as a plain one.
+	bool Serialize(FArchive& Ar);
+
+	void PostSerialize(const FArchive& Ar);
+
 	// The XCount of the GridActor I'm built on
 	UPROPERTY(BlueprintReadOnly)
 	int32 XCount;
@@ -78,14 +99,53 @@ struct FGAGridMap
 	UPROPERTY(BlueprintReadOnly)
 	FGridBox GridBounds;
 
+	// Maps built on a grid actor take its layout
 	UPROPERTY(BlueprintReadOnly)
-	TArray<float> Data;
+	EGridLayout Layout;
+
+	// Laid out according to Layout. Use CellRefToIndex/LocalToIndex rather than indexing it yourself.
+	// Pooled and copy-on-write (see GAGridBuffer.h): copying a map shares its values until one of the copies
+	// writes. This isn't a property; Serialize saves it by hand, and Blueprint gets at it through UGAGridMapLibrary.
+	FGAGridBuffer Data;
+
+	// Local (X, Y) to Data index, for the current bounds and layout
+	FGAGridIndexer Indexer;
+
+	// Optional read-only view of a layer file on disk (see GAGridLayerFile.h).
+	// When this is set, Data is empty and reads go straight to the mapped file. Copies of the map share the view.
+	TSharedPtr<const FGAMappedGridLayer, ESPMode::ThreadSafe> MappedLayer;
+
+	// Point this map at a layer file, without reading it in. Replaces whatever was in the map.
+	bool MapFromFile(const FString& Path);
+
+	// Write this map out as a layer file that can later be mapped with MapFromFile
+	bool WriteToFile(const FString& Path) const;
+
+	FORCEINLINE bool IsMapped() const { return MappedLayer.IsValid(); }
+
+	// Copy the mapped values into Data and drop the mapping.
+	// Writes do this automatically, so a mapped map behaves like copy-on-write.
+	void Materialize();
 
 
 	bool CellRefToLocal(const FCellRef& Cell, int32& X, int32& Y) const;
 
 	bool LocalToCellRef(int32 X, int32 Y, FCellRef& Cell) const;
 
+	// X and Y are local to GridBounds. No bounds checking.
+	FORCEINLINE int32 LocalToIndex(int32 X, int32 Y) const { return Indexer.Index(X, Y); }
+
+	// Index into Data, or INDEX_NONE if the cell isn't on the map
+	int32 CellRefToIndex(const FCellRef& Cell) const;
+
+	// See FGAGridIndexer -- visit the map's storage in order, a span or a tile at a time, for bulk kernels.
+	// Coordinates passed to Func are local to GridBounds. Not for mapped maps; Materialize first.
+	template<typename FuncType>
+	void ForEachSpan(FuncType&& Func) const { Indexer.ForEachSpan(Forward<FuncType>(Func)); }
+
+	template<typename FuncType>
+	void ForEachTile(FuncType&& Func) const { Indexer.ForEachTile(Forward<FuncType>(Func)); }
+
 	bool GetValue(const FCellRef& Cell, float& ValueOut) const;
 
 	bool GetMaxValue(float& MaxValueOut) const;
@@ -93,8 +153,21 @@ struct FGAGridMap
 	bool SetValue(const FCellRef& Cell, float Value);
 
 
+	// Note this checks the Indexer too. If you fill in GridBounds/Layout/Data by hand rather than through a
+	// constructor or ResetData, call RefreshIndexer afterwards or the map won't count as valid.
 	FORCEINLINE bool IsValid() const
 	{
-		return GridBounds.IsValid() && (GridBounds.GetCellCount() == Data.Num());
+		return GridBounds.IsValid() && (MappedLayer.IsValid() ||
+			(Indexer.Matches(Layout, GridBounds.GetWidth(), GridBounds.GetHeight()) && (Indexer.GetStorageCount() == Data.Num())));
 	}
+};
+
+template<>
+struct TStructOpsTypeTraits<FGAGridMap> : public TStructOpsTypeTraitsBase2<FGAGridMap>
+{
+	enum
+	{
+		WithSerializer = true,
+		WithPostSerialize = true,
+	};
 };
\ No newline at end of file
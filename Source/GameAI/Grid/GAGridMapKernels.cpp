@@ -0,0 +1,600 @@
+#include "GAGridMapKernels.h"
+#include "GAGridActor.h"
+#include "Math/VectorRegister.h"
+
+
+namespace GAGridMapKernels
+{
+	struct FAddOp
+	{
+		FORCEINLINE static float Scalar(float A, float B) { return A + B; }
+		FORCEINLINE static VectorRegister4Float Vector(const VectorRegister4Float& A, const VectorRegister4Float& B) { return VectorAdd(A, B); }
+	};
+
+	struct FMultiplyOp
+	{
+		FORCEINLINE static float Scalar(float A, float B) { return A * B; }
+		FORCEINLINE static VectorRegister4Float Vector(const VectorRegister4Float& A, const VectorRegister4Float& B) { return VectorMultiply(A, B); }
+	};
+
+	struct FMinOp
+	{
+		FORCEINLINE static float Scalar(float A, float B) { return FMath::Min(A, B); }
+		FORCEINLINE static VectorRegister4Float Vector(const VectorRegister4Float& A, const VectorRegister4Float& B) { return VectorMin(A, B); }
+	};
+
+	struct FMaxOp
+	{
+		FORCEINLINE static float Scalar(float A, float B) { return FMath::Max(A, B); }
+		FORCEINLINE static VectorRegister4Float Vector(const VectorRegister4Float& A, const VectorRegister4Float& B) { return VectorMax(A, B); }
+	};
+
+	// Calls Func with an instance of the op type that matches Op, so the kernels get instantiated once per op
+	template<typename FuncType>
+	FORCEINLINE void DispatchOp(EGAGridMapOp Op, FuncType&& Func)
+	{
+		switch (Op)
+		{
+		case EGAGridMapOp::Add:			Func(FAddOp()); break;
+		case EGAGridMapOp::Multiply:	Func(FMultiplyOp()); break;
+		case EGAGridMapOp::Min:			Func(FMinOp()); break;
+		case EGAGridMapOp::Max:			Func(FMaxOp()); break;
+		}
+	}
+
+	template<typename OpType>
+	FORCEINLINE void SpanApply(float* Dest, const float* Source, int32 Count)
+	{
+		int32 Index = 0;
+		for (; Index + 4 <= Count; Index += 4)
+		{
+			VectorStore(OpType::Vector(VectorLoad(Dest + Index), VectorLoad(Source + Index)), Dest + Index);
+		}
+		for (; Index < Count; Index++)
+		{
+			Dest[Index] = OpType::Scalar(Dest[Index], Source[Index]);
+		}
+	}
+
+	template<typename OpType>
+	FORCEINLINE void SpanApplyScalar(float* Dest, float Value, int32 Count)
+	{
+		const VectorRegister4Float ValueVec = VectorSetFloat1(Value);
+
+		int32 Index = 0;
+		for (; Index + 4 <= Count; Index += 4)
+		{
+			VectorStore(OpType::Vector(VectorLoad(Dest + Index), ValueVec), Dest + Index);
+		}
+		for (; Index < Count; Index++)
+		{
+			Dest[Index] = OpType::Scalar(Dest[Index], Value);
+		}
+	}
+
+	// One all-ones / all-zeros lane per bit, for turning 4 mask bits into a select mask
+	static const VectorRegister4Float LaneMasks[16] =
+	{
+#define GA_LANE(Bits, Lane) (((Bits) & (1 << (Lane))) ? 0xffffffffu : 0u)
+#define GA_LANES(Bits) MakeVectorRegister(GA_LANE(Bits, 0), GA_LANE(Bits, 1), GA_LANE(Bits, 2), GA_LANE(Bits, 3))
+		GA_LANES(0), GA_LANES(1), GA_LANES(2), GA_LANES(3), GA_LANES(4), GA_LANES(5), GA_LANES(6), GA_LANES(7),
+		GA_LANES(8), GA_LANES(9), GA_LANES(10), GA_LANES(11), GA_LANES(12), GA_LANES(13), GA_LANES(14), GA_LANES(15)
+#undef GA_LANES
+#undef GA_LANE
+	};
+
+	// The 4 mask bits starting at Bit. All 4 must be inside the bit array.
+	FORCEINLINE uint32 GetMaskBits4(const uint32* Words, int32 Bit)
+	{
+		const int32 Word = Bit >> 5;
+		const int32 Shift = Bit & 31;
+		uint64 Pair = Words[Word];
+		if (Shift > 28)
+		{
+			Pair |= uint64(Words[Word + 1]) << 32;
+		}
+		return uint32(Pair >> Shift) & 0xf;
+	}
+
+	// OR 4 bits into the mask starting at Bit. All 4 must be inside the bit array.
+	FORCEINLINE void OrMaskBits4(uint32* Words, int32 Bit, uint32 Bits)
+	{
+		const int32 Word = Bit >> 5;
+		const int32 Shift = Bit & 31;
+		Words[Word] |= Bits << Shift;
+		if (Shift > 28)
+		{
+			Words[Word + 1] |= Bits >> (32 - Shift);
+		}
+	}
+
+	FORCEINLINE bool GetMaskBit(const uint32* Words, int32 Bit)
+	{
+		return (Words[Bit >> 5] & (1u << (Bit & 31))) != 0;
+	}
+
+	// How many cells from local X to the end of X's row of storage (i.e. the end of the tile, or of the row)
+	FORCEINLINE int32 GetRunLength(const FGAGridIndexer& Indexer, int32 X)
+	{
+		return Indexer.IsTiled() ? (Indexer.GetTileSize() - (X & (Indexer.GetTileSize() - 1))) : (Indexer.Width - X);
+	}
+
+	static bool IsUsable(const FGAGridMap& Map)
+	{
+		return Map.IsValid() && !Map.IsMapped();
+	}
+
+	static bool IsMaskUsable(const FGAGridMap& Map, const TBitArray<>& Mask)
+	{
+		if (Mask.Num() < Map.XCount * Map.YCount)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("FGAGridMapKernels: mask has %d bits, but the grid has %d cells."), Mask.Num(), Map.XCount * Map.YCount);
+			return false;
+		}
+		return true;
+	}
+}
+
+using namespace GAGridMapKernels;
+
+
+void FGAGridMapKernels::Fill(FGAGridMap& Map, float Value)
+{
+	if (!IsUsable(Map))
+	{
+		return;
+	}
+
+	// Padding too -- nothing reads it, and it keeps this one straight run
+	const VectorRegister4Float ValueVec = VectorSetFloat1(Value);
+	float* Data = Map.Data.GetData();
+	const int32 Count = Map.Data.Num();
+
+	int32 Index = 0;
+	for (; Index + 4 <= Count; Index += 4)
+	{
+		VectorStore(ValueVec, Data + Index);
+	}
+	for (; Index < Count; Index++)
+	{
+		Data[Index] = Value;
+	}
+}
+
+void FGAGridMapKernels::ApplyScalar(FGAGridMap& Map, EGAGridMapOp Op, float Value)
+{
+	if (!IsUsable(Map))
+	{
+		return;
+	}
+
+	float* Data = Map.Data.GetData();
+	const int32 Count = Map.Data.Num();
+
+	DispatchOp(Op, [Data, Count, Value](auto OpType)
+	{
+		SpanApplyScalar<decltype(OpType)>(Data, Value, Count);
+	});
+}
+
+bool FGAGridMapKernels::Apply(FGAGridMap& Dest, EGAGridMapOp Op, const FGAGridMap& Source)
+{
+	if (!IsUsable(Dest) || !IsUsable(Source))
+	{
+		return false;
+	}
+
+	// Same bounds and layout means the same storage -- one straight run
+	if ((Dest.Layout == Source.Layout) && (Dest.GridBounds.MinX == Source.GridBounds.MinX) && (Dest.GridBounds.MaxX == Source.GridBounds.MaxX) &&
+		(Dest.GridBounds.MinY == Source.GridBounds.MinY) && (Dest.GridBounds.MaxY == Source.GridBounds.MaxY))
+	{
+		float* DestData = Dest.Data.GetData();
+		const float* SourceData = Source.Data.GetData();
+		const int32 Count = Dest.Data.Num();
+
+		DispatchOp(Op, [DestData, SourceData, Count](auto OpType)
+		{
+			SpanApply<decltype(OpType)>(DestData, SourceData, Count);
+		});
+		return true;
+	}
+
+	// Otherwise, work on the overlap, in runs that are contiguous in both maps
+	const int32 MinX = FMath::Max(Dest.GridBounds.MinX, Source.GridBounds.MinX);
+	const int32 MaxX = FMath::Min(Dest.GridBounds.MaxX, Source.GridBounds.MaxX);
+	const int32 MinY = FMath::Max(Dest.GridBounds.MinY, Source.GridBounds.MinY);
+	const int32 MaxY = FMath::Min(Dest.GridBounds.MaxY, Source.GridBounds.MaxY);
+	if ((MinX > MaxX) || (MinY > MaxY))
+	{
+		return false;
+	}
+
+	DispatchOp(Op, [&Dest, &Source, MinX, MaxX, MinY, MaxY](auto OpType)
+	{
+		for (int32 Y = MinY; Y <= MaxY; Y++)
+		{
+			const int32 DestY = Y - Dest.GridBounds.MinY;
+			const int32 SourceY = Y - Source.GridBounds.MinY;
+
+			int32 X = MinX;
+			while (X <= MaxX)
+			{
+				const int32 DestX = X - Dest.GridBounds.MinX;
+				const int32 SourceX = X - Source.GridBounds.MinX;
+				const int32 Count = FMath::Min3(GetRunLength(Dest.Indexer, DestX), GetRunLength(Source.Indexer, SourceX), MaxX - X + 1);
+
+				SpanApply<decltype(OpType)>(&Dest.Data[Dest.LocalToIndex(DestX, DestY)], &Source.Data[Source.LocalToIndex(SourceX, SourceY)], Count);
+				X += Count;
+			}
+		}
+	});
+
+	return true;
+}
+
+void FGAGridMapKernels::Clamp(FGAGridMap& Map, float MinValue, float MaxValue)
+{
+	if (!IsUsable(Map))
+	{
+		return;
+	}
+
+	const VectorRegister4Float MinVec = VectorSetFloat1(MinValue);
+	const VectorRegister4Float MaxVec = VectorSetFloat1(MaxValue);
+	float* Data = Map.Data.GetData();
+	const int32 Count = Map.Data.Num();
+
+	int32 Index = 0;
+	for (; Index + 4 <= Count; Index += 4)
+	{
+		VectorStore(VectorMin(VectorMax(VectorLoad(Data + Index), MinVec), MaxVec), Data + Index);
+	}
+	for (; Index < Count; Index++)
+	{
+		Data[Index] = FMath::Clamp(Data[Index], MinValue, MaxValue);
+	}
+}
+
+float FGAGridMapKernels::Sum(const FGAGridMap& Map, const TBitArray<>* Mask)
+{
+	if (!IsUsable(Map) || (Mask && !IsMaskUsable(Map, *Mask)))
+	{
+		return 0.0f;
+	}
+
+	const float* Data = Map.Data.GetData();
+	const uint32* MaskWords = Mask ? Mask->GetData() : nullptr;
+	const FGridBox& Bounds = Map.GridBounds;
+	const int32 GridXCount = Map.XCount;
+
+	VectorRegister4Float SumVec = VectorZeroFloat();
+	float ScalarSum = 0.0f;
+
+	// Span by span, so tile padding stays out of it
+	Map.ForEachSpan([&](int32 X, int32 Y, int32 Index, int32 Count)
+	{
+		const float* Values = Data + Index;
+		const int32 FirstBit = (Y + Bounds.MinY) * GridXCount + (X + Bounds.MinX);
+
+		int32 I = 0;
+		for (; I + 4 <= Count; I += 4)
+		{
+			VectorRegister4Float V = VectorLoad(Values + I);
+			if (MaskWords)
+			{
+				V = VectorBitwiseAnd(V, LaneMasks[GetMaskBits4(MaskWords, FirstBit + I)]);
+			}
+			SumVec = VectorAdd(SumVec, V);
+		}
+		for (; I < Count; I++)
+		{
+			if (!MaskWords || GetMaskBit(MaskWords, FirstBit + I))
+			{
+				ScalarSum += Values[I];
+			}
+		}
+	});
+
+	alignas(16) float Lanes[4];
+	VectorStoreAligned(SumVec, Lanes);
+	return ScalarSum + Lanes[0] + Lanes[1] + Lanes[2] + Lanes[3];
+}
+
+bool FGAGridMapKernels::NormalizeToSum(FGAGridMap& Map, float TargetSum)
+{
+	const float Total = Sum(Map);
+	if (FMath::IsNearlyZero(Total))
+	{
+		return false;
+	}
+
+	ApplyScalar(Map, EGAGridMapOp::Multiply, TargetSum / Total);
+	return true;
+}
+
+void FGAGridMapKernels::ApplyScalarMasked(FGAGridMap& Map, EGAGridMapOp Op, float Value, const TBitArray<>& Mask)
+{
+	if (!IsUsable(Map) || !IsMaskUsable(Map, Mask))
+	{
+		return;
+	}
+
+	float* Data = Map.Data.GetData();
+	const uint32* MaskWords = Mask.GetData();
+	const FGridBox& Bounds = Map.GridBounds;
+	const int32 GridXCount = Map.XCount;
+
+	DispatchOp(Op, [&](auto OpType)
+	{
+		typedef decltype(OpType) FOpType;
+		const VectorRegister4Float ValueVec = VectorSetFloat1(Value);
+
+		Map.ForEachSpan([&](int32 X, int32 Y, int32 Index, int32 Count)
+		{
+			float* Values = Data + Index;
+			const int32 FirstBit = (Y + Bounds.MinY) * GridXCount + (X + Bounds.MinX);
+
+			int32 I = 0;
+			for (; I + 4 <= Count; I += 4)
+			{
+				const VectorRegister4Float Old = VectorLoad(Values + I);
+				const VectorRegister4Float New = FOpType::Vector(Old, ValueVec);
+				VectorStore(VectorSelect(LaneMasks[GetMaskBits4(MaskWords, FirstBit + I)], New, Old), Values + I);
+			}
+			for (; I < Count; I++)
+			{
+				if (GetMaskBit(MaskWords, FirstBit + I))
+				{
+					Values[I] = FOpType::Scalar(Values[I], Value);
+				}
+			}
+		});
+	});
+}
+
+void FGAGridMapKernels::FillUnmasked(FGAGridMap& Map, float Value, const TBitArray<>& Mask)
+{
+	if (!IsUsable(Map) || !IsMaskUsable(Map, Mask))
+	{
+		return;
+	}
+
+	float* Data = Map.Data.GetData();
+	const uint32* MaskWords = Mask.GetData();
+	const FGridBox& Bounds = Map.GridBounds;
+	const int32 GridXCount = Map.XCount;
+	const VectorRegister4Float ValueVec = VectorSetFloat1(Value);
+
+	Map.ForEachSpan([&](int32 X, int32 Y, int32 Index, int32 Count)
+	{
+		float* Values = Data + Index;
+		const int32 FirstBit = (Y + Bounds.MinY) * GridXCount + (X + Bounds.MinX);
+
+		int32 I = 0;
+		for (; I + 4 <= Count; I += 4)
+		{
+			VectorStore(VectorSelect(LaneMasks[GetMaskBits4(MaskWords, FirstBit + I)], VectorLoad(Values + I), ValueVec), Values + I);
+		}
+		for (; I < Count; I++)
+		{
+			if (!GetMaskBit(MaskWords, FirstBit + I))
+			{
+				Values[I] = Value;
+			}
+		}
+	});
+}
+
+bool FGAGridMapKernels::ArgMax(const FGAGridMap& Map, FCellRef& CellOut, float& ValueOut, const TBitArray<>* Mask)
+{
+	if (!IsUsable(Map) || (Mask && !IsMaskUsable(Map, *Mask)))
+	{
+		return false;
+	}
+
+	const float* Data = Map.Data.GetData();
+	const uint32* MaskWords = Mask ? Mask->GetData() : nullptr;
+	const FGridBox& Bounds = Map.GridBounds;
+	const int32 GridXCount = Map.XCount;
+	const VectorRegister4Float Lowest = VectorSetFloat1(-UE_MAX_FLT);
+
+	bool bFound = false;
+	float BestValue = -UE_MAX_FLT;
+	FIntPoint BestLocal(INDEX_NONE, INDEX_NONE);
+
+	Map.ForEachSpan([&](int32 X, int32 Y, int32 Index, int32 Count)
+	{
+		const float* Values = Data + Index;
+		const int32 FirstBit = (Y + Bounds.MinY) * GridXCount + (X + Bounds.MinX);
+
+		// First the biggest value in the span, four lanes at a time...
+		VectorRegister4Float MaxVec = Lowest;
+		float SpanMax = -UE_MAX_FLT;
+		bool bAny = false;
+
+		int32 I = 0;
+		for (; I + 4 <= Count; I += 4)
+		{
+			VectorRegister4Float V = VectorLoad(Values + I);
+			if (MaskWords)
+			{
+				const uint32 Bits = GetMaskBits4(MaskWords, FirstBit + I);
+				bAny |= (Bits != 0);
+				V = VectorSelect(LaneMasks[Bits], V, Lowest);
+			}
+			else
+			{
+				bAny = true;
+			}
+			MaxVec = VectorMax(MaxVec, V);
+		}
+		for (; I < Count; I++)
+		{
+			if (!MaskWords || GetMaskBit(MaskWords, FirstBit + I))
+			{
+				SpanMax = FMath::Max(SpanMax, Values[I]);
+				bAny = true;
+			}
+		}
+
+		if (!bAny)
+		{
+			return;
+		}
+
+		alignas(16) float Lanes[4];
+		VectorStoreAligned(MaxVec, Lanes);
+		SpanMax = FMath::Max(SpanMax, FMath::Max(FMath::Max(Lanes[0], Lanes[1]), FMath::Max(Lanes[2], Lanes[3])));
+
+		// ...and only if it could win, go back and find where it is
+		const bool bEarlierThanBest = (Y < BestLocal.Y) || ((Y == BestLocal.Y) && (X < BestLocal.X));
+		if (bFound && ((SpanMax < BestValue) || ((SpanMax == BestValue) && !bEarlierThanBest)))
+		{
+			return;
+		}
+
+		for (I = 0; I < Count; I++)
+		{
+			if ((Values[I] == SpanMax) && (!MaskWords || GetMaskBit(MaskWords, FirstBit + I)))
+			{
+				BestValue = SpanMax;
+				BestLocal = FIntPoint(X + I, Y);
+				bFound = true;
+				break;
+			}
+		}
+	});
+
+	if (bFound)
+	{
+		ValueOut = BestValue;
+		CellOut = FCellRef(BestLocal.X + Bounds.MinX, BestLocal.Y + Bounds.MinY);
+	}
+	return bFound;
+}
+
+int32 FGAGridMapKernels::TopK(const FGAGridMap& Map, int32 K, TArray<TPair<FCellRef, float>>& CellsOut, const TBitArray<>* Mask)
+{
+	CellsOut.Reset();
+	if ((K <= 0) || !IsUsable(Map) || (Mask && !IsMaskUsable(Map, *Mask)))
+	{
+		return 0;
+	}
+
+	const float* Data = Map.Data.GetData();
+	const uint32* MaskWords = Mask ? Mask->GetData() : nullptr;
+	const FGridBox& Bounds = Map.GridBounds;
+	const int32 GridXCount = Map.XCount;
+	const int32 Width = Bounds.GetWidth();
+
+	// Best first. Order is the row-major local index, for the ties.
+	struct FCandidate
+	{
+		float Value;
+		int32 Order;
+	};
+	TArray<FCandidate, TInlineAllocator<16>> Best;
+
+	// Nothing below this can get in
+	float Threshold = -UE_MAX_FLT;
+
+	auto Offer = [&](float Value, int32 Order)
+	{
+		auto Beats = [](float AValue, int32 AOrder, const FCandidate& B) { return (AValue > B.Value) || ((AValue == B.Value) && (AOrder < B.Order)); };
+
+		if ((Best.Num() == K) && !Beats(Value, Order, Best.Last()))
+		{
+			return;
+		}
+
+		int32 Insert = Best.Num();
+		while ((Insert > 0) && Beats(Value, Order, Best[Insert - 1]))
+		{
+			Insert--;
+		}
+		Best.Insert(FCandidate{ Value, Order }, Insert);
+
+		if (Best.Num() > K)
+		{
+			Best.Pop(false);
+		}
+		if (Best.Num() == K)
+		{
+			Threshold = Best.Last().Value;
+		}
+	};
+
+	Map.ForEachSpan([&](int32 X, int32 Y, int32 Index, int32 Count)
+	{
+		const float* Values = Data + Index;
+		const int32 FirstBit = (Y + Bounds.MinY) * GridXCount + (X + Bounds.MinX);
+		const int32 FirstOrder = Y * Width + X;
+
+		int32 I = 0;
+		for (; I + 4 <= Count; I += 4)
+		{
+			// >=, since a tie can still get in on order
+			uint32 Lanes = VectorMaskBits(VectorCompareGE(VectorLoad(Values + I), VectorSetFloat1(Threshold)));
+			if (MaskWords)
+			{
+				Lanes &= GetMaskBits4(MaskWords, FirstBit + I);
+			}
+
+			while (Lanes)
+			{
+				const int32 Lane = FMath::CountTrailingZeros(Lanes);
+				Lanes &= Lanes - 1;
+				Offer(Values[I + Lane], FirstOrder + I + Lane);
+			}
+		}
+		for (; I < Count; I++)
+		{
+			if ((Values[I] >= Threshold) && (!MaskWords || GetMaskBit(MaskWords, FirstBit + I)))
+			{
+				Offer(Values[I], FirstOrder + I);
+			}
+		}
+	});
+
+	for (const FCandidate& Candidate : Best)
+	{
+		CellsOut.Emplace(FCellRef((Candidate.Order % Width) + Bounds.MinX, (Candidate.Order / Width) + Bounds.MinY), Candidate.Value);
+	}
+	return CellsOut.Num();
+}
+
+bool FGAGridMapKernels::MaskLess(const FGAGridMap& Map, float Threshold, TBitArray<>& MaskOut)
+{
+	MaskOut.Init(false, Map.XCount * Map.YCount);
+	if (!IsUsable(Map))
+	{
+		return false;
+	}
+
+	const float* Data = Map.Data.GetData();
+	uint32* MaskWords = MaskOut.GetData();
+	const FGridBox& Bounds = Map.GridBounds;
+	const int32 GridXCount = Map.XCount;
+	const VectorRegister4Float ThresholdVec = VectorSetFloat1(Threshold);
+
+	Map.ForEachSpan([&](int32 X, int32 Y, int32 Index, int32 Count)
+	{
+		const float* Values = Data + Index;
+		const int32 FirstBit = (Y + Bounds.MinY) * GridXCount + (X + Bounds.MinX);
+
+		int32 I = 0;
+		for (; I + 4 <= Count; I += 4)
+		{
+			OrMaskBits4(MaskWords, FirstBit + I, uint32(VectorMaskBits(VectorCompareLT(VectorLoad(Values + I), ThresholdVec))));
+		}
+		for (; I < Count; I++)
+		{
+			if (Values[I] < Threshold)
+			{
+				MaskWords[(FirstBit + I) >> 5] |= 1u << ((FirstBit + I) & 31);
+			}
+		}
+	});
+
+	return true;
+}
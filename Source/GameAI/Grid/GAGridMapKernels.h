@@ -0,0 +1,76 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GAGridMap.h"
+
+
+enum class EGAGridMapOp : uint8
+{
+	Add,
+	Multiply,
+	Min,
+	Max
+};
+
+
+// Bulk operations on grid maps.
+//
+// These go straight at the storage, four cells at a time with VectorRegister ops, instead of going through
+// GetValue/SetValue (which check the cell on every call). They work with any layout.
+//
+// Masks are bitsets over the whole grid, row-major, XCount bits per row -- the same shape as
+// AGAGridActor::TraversableBits. A cell takes part in a masked op if its bit is set.
+//
+// None of these work on mapped maps (see FGAGridMap::MapFromFile); Materialize them first.
+
+struct FGAGridMapKernels
+{
+	// Map = Value, everywhere
+	static void Fill(FGAGridMap& Map, float Value);
+
+	// Map = Map op Value, everywhere
+	static void ApplyScalar(FGAGridMap& Map, EGAGridMapOp Op, float Value);
+
+	// Dest = Dest op Source, on the cells both maps cover. The two maps can have different bounds and layouts;
+	// cells of Dest outside of Source are left alone. Returns false if the maps don't overlap at all.
+	static bool Apply(FGAGridMap& Dest, EGAGridMapOp Op, const FGAGridMap& Source);
+
+	static void Add(FGAGridMap& Map, float Value) { ApplyScalar(Map, EGAGridMapOp::Add, Value); }
+	static void Multiply(FGAGridMap& Map, float Value) { ApplyScalar(Map, EGAGridMapOp::Multiply, Value); }
+	static void Min(FGAGridMap& Map, float Value) { ApplyScalar(Map, EGAGridMapOp::Min, Value); }
+	static void Max(FGAGridMap& Map, float Value) { ApplyScalar(Map, EGAGridMapOp::Max, Value); }
+
+	static bool Add(FGAGridMap& Dest, const FGAGridMap& Source) { return Apply(Dest, EGAGridMapOp::Add, Source); }
+	static bool Multiply(FGAGridMap& Dest, const FGAGridMap& Source) { return Apply(Dest, EGAGridMapOp::Multiply, Source); }
+	static bool Min(FGAGridMap& Dest, const FGAGridMap& Source) { return Apply(Dest, EGAGridMapOp::Min, Source); }
+	static bool Max(FGAGridMap& Dest, const FGAGridMap& Source) { return Apply(Dest, EGAGridMapOp::Max, Source); }
+
+	static void Clamp(FGAGridMap& Map, float MinValue, float MaxValue);
+
+	// Sum of every cell (or every masked cell)
+	static float Sum(const FGAGridMap& Map, const TBitArray<>* Mask = nullptr);
+
+	// Scale the map so that its cells add up to TargetSum, e.g. to keep a probability map a probability map.
+	// Returns false (and leaves the map alone) if the cells add up to zero.
+	static bool NormalizeToSum(FGAGridMap& Map, float TargetSum = 1.0f);
+
+	// Map = Map op Value, but only where the mask is set
+	static void ApplyScalarMasked(FGAGridMap& Map, EGAGridMapOp Op, float Value, const TBitArray<>& Mask);
+
+	// Map = Value wherever the mask is NOT set, e.g. to zero out every untraversable cell
+	static void FillUnmasked(FGAGridMap& Map, float Value, const TBitArray<>& Mask);
+
+	// The biggest value on the map (optionally only among masked cells), and where it is.
+	// Ties go to the first cell in row-major order, whatever the layout, so the answer is the same as a plain
+	// X-inside-Y loop with a strict > would give. Returns false if there were no cells to look at.
+	static bool ArgMax(const FGAGridMap& Map, FCellRef& CellOut, float& ValueOut, const TBitArray<>* Mask = nullptr);
+
+	// The K biggest values on the map (optionally only among masked cells), best first, with ties broken the same
+	// way as ArgMax -- so K = 1 gives the same cell. Four cells at a time are checked against the Kth best so far,
+	// and only the ones that could get in are looked at any closer. Returns how many were found.
+	static int32 TopK(const FGAGridMap& Map, int32 K, TArray<TPair<FCellRef, float>>& CellsOut, const TBitArray<>* Mask = nullptr);
+
+	// MaskOut (sized to the whole grid) gets a bit for every cell of Map below Threshold, and nothing else.
+	// E.g. MaskLess(DistanceMap, FLT_MAX, Mask) is every cell Dijkstra reached.
+	static bool MaskLess(const FGAGridMap& Map, float Threshold, TBitArray<>& MaskOut);
+};
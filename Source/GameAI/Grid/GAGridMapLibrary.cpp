@@ -0,0 +1,48 @@
+#include "GAGridMapLibrary.h"
+
+
+bool UGAGridMapLibrary::GetGridMapValue(const FGAGridMap& GridMap, const FCellRef& Cell, float& Value)
+{
+	Value = 0.0f;
+	return GridMap.GetValue(Cell, Value);
+}
+
+bool UGAGridMapLibrary::SetGridMapValue(FGAGridMap& GridMap, const FCellRef& Cell, float Value)
+{
+	return GridMap.SetValue(Cell, Value);
+}
+
+TArray<float> UGAGridMapLibrary::GetGridMapData(const FGAGridMap& GridMap)
+{
+	TArray<float> Values;
+	if (!GridMap.IsValid())
+	{
+		return Values;
+	}
+
+	const int32 Width = GridMap.GridBounds.GetWidth();
+	Values.SetNumUninitialized(GridMap.GridBounds.GetCellCount());
+
+	if (GridMap.IsMapped())
+	{
+		// GetValue goes to the file for us
+		for (int32 Y = 0; Y < GridMap.GridBounds.GetHeight(); Y++)
+		{
+			for (int32 X = 0; X < Width; X++)
+			{
+				FCellRef Cell;
+				GridMap.LocalToCellRef(X, Y, Cell);
+				GridMap.GetValue(Cell, Values[Y * Width + X]);
+			}
+		}
+		return Values;
+	}
+
+	const float* Data = GridMap.Data.GetData();
+	GridMap.ForEachSpan([&Values, Data, Width](int32 X, int32 Y, int32 Index, int32 Count)
+	{
+		FMemory::Memcpy(&Values[Y * Width + X], &Data[Index], Count * sizeof(float));
+	});
+
+	return Values;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Kismet/BlueprintFunctionLibrary.h"
+#include "GAGridActor.h"
+#include "GAGridMap.h"
+#include "GAGridMapLibrary.generated.h"
+
+
+// Blueprint access to grid map values. FGAGridMap::Data isn't a property (see GAGridBuffer.h), so these stand in for it.
+
+UCLASS()
+class UGAGridMapLibrary : public UBlueprintFunctionLibrary
+{
+	GENERATED_BODY()
+
+public:
+	// False if the cell isn't on the map
+	UFUNCTION(BlueprintPure, Category = "GameAI|Grid Map")
+	static bool GetGridMapValue(const FGAGridMap& GridMap, const FCellRef& Cell, float& Value);
+
+	// False if the cell isn't on the map
+	UFUNCTION(BlueprintCallable, Category = "GameAI|Grid Map")
+	static bool SetGridMapValue(UPARAM(ref) FGAGridMap& GridMap, const FCellRef& Cell, float Value);
+
+	// Every value on the map, row by row over GridBounds (whatever the map's layout), so cell (X, Y) is at
+	// (Y - MinY) * Width + (X - MinX). Empty if the map isn't valid.
+	UFUNCTION(BlueprintPure, Category = "GameAI|Grid Map")
+	static TArray<float> GetGridMapData(const FGAGridMap& GridMap);
+};
@@ -0,0 +1,152 @@
+#include "GAGridPyramid.h"
+
+
+void FGAGridPyramid::Init(int32 XCount, int32 YCount)
+{
+	Levels.Reset();
+
+	if ((XCount <= 0) || (YCount <= 0))
+	{
+		return;
+	}
+
+	int32 LevelX = XCount;
+	int32 LevelY = YCount;
+
+	while (true)
+	{
+		FLevel& Level = Levels.AddDefaulted_GetRef();
+		Level.XCount = LevelX;
+		Level.YCount = LevelY;
+		Level.Cells.Init(uint8(EGridCoverage::Blocked), LevelX * LevelY);
+
+		if ((LevelX == 1) && (LevelY == 1))
+		{
+			break;
+		}
+
+		LevelX = (LevelX + 1) / 2;
+		LevelY = (LevelY + 1) / 2;
+	}
+}
+
+void FGAGridPyramid::Reset()
+{
+	Levels.Reset();
+}
+
+void FGAGridPyramid::RebuildParents(const FIntRect& CellRect)
+{
+	FIntRect Rect = CellRect;
+
+	for (int32 LevelIndex = 1; LevelIndex < Levels.Num(); LevelIndex++)
+	{
+		const FLevel& Child = Levels[LevelIndex - 1];
+		FLevel& Parent = Levels[LevelIndex];
+
+		// The parents of the rect we just updated
+		Rect.Min.X = FMath::Max(Rect.Min.X >> 1, 0);
+		Rect.Min.Y = FMath::Max(Rect.Min.Y >> 1, 0);
+		Rect.Max.X = FMath::Min(Rect.Max.X >> 1, Parent.XCount - 1);
+		Rect.Max.Y = FMath::Min(Rect.Max.Y >> 1, Parent.YCount - 1);
+
+		if ((Rect.Min.X > Rect.Max.X) || (Rect.Min.Y > Rect.Max.Y))
+		{
+			return;
+		}
+
+		for (int32 Y = Rect.Min.Y; Y <= Rect.Max.Y; Y++)
+		{
+			const int32 CY0 = Y * 2;
+			const int32 CY1 = CY0 + 1;
+
+			for (int32 X = Rect.Min.X; X <= Rect.Max.X; X++)
+			{
+				const int32 CX0 = X * 2;
+				const int32 CX1 = CX0 + 1;
+
+				// Children off the edge count as blocked
+				uint8 Coverage = Child.Cells[CY0 * Child.XCount + CX0];
+				Coverage |= (CX1 < Child.XCount) ? Child.Cells[CY0 * Child.XCount + CX1] : uint8(EGridCoverage::Blocked);
+				if (CY1 < Child.YCount)
+				{
+					Coverage |= Child.Cells[CY1 * Child.XCount + CX0];
+					Coverage |= (CX1 < Child.XCount) ? Child.Cells[CY1 * Child.XCount + CX1] : uint8(EGridCoverage::Blocked);
+				}
+				else
+				{
+					Coverage |= uint8(EGridCoverage::Blocked);
+				}
+
+				Parent.Cells[Y * Parent.XCount + X] = Coverage;
+			}
+		}
+	}
+}
+
+EGridCoverage FGAGridPyramid::GetRectCoverage(const FIntRect& CellRect) const
+{
+	if (Levels.Num() == 0)
+	{
+		return EGridCoverage::Blocked;
+	}
+
+	const FLevel& Base = Levels[0];
+
+	FIntRect Clipped(
+		FMath::Max(CellRect.Min.X, 0), FMath::Max(CellRect.Min.Y, 0),
+		FMath::Min(CellRect.Max.X, Base.XCount - 1), FMath::Min(CellRect.Max.Y, Base.YCount - 1));
+
+	if ((Clipped.Min.X > Clipped.Max.X) || (Clipped.Min.Y > Clipped.Max.Y))
+	{
+		return EGridCoverage::Blocked;
+	}
+
+	uint8 Coverage = 0;
+	if (Clipped != CellRect)
+	{
+		Coverage |= uint8(EGridCoverage::Blocked);
+	}
+
+	GatherRectCoverage(Levels.Num() - 1, 0, 0, Clipped, Coverage);
+	return EGridCoverage(Coverage);
+}
+
+void FGAGridPyramid::GatherRectCoverage(int32 Level, int32 X, int32 Y, const FIntRect& CellRect, uint8& CoverageInOut) const
+{
+	if (CoverageInOut == uint8(EGridCoverage::Mixed))
+	{
+		// Can't get any more mixed than this
+		return;
+	}
+
+	// The block of grid cells this coarse cell covers
+	const FIntRect Block(X << Level, Y << Level, ((X + 1) << Level) - 1, ((Y + 1) << Level) - 1);
+	if ((Block.Max.X < CellRect.Min.X) || (Block.Min.X > CellRect.Max.X) || (Block.Max.Y < CellRect.Min.Y) || (Block.Min.Y > CellRect.Max.Y))
+	{
+		return;
+	}
+
+	const EGridCoverage Coverage = GetCoverage(Level, X, Y);
+	if (Coverage != EGridCoverage::Mixed)
+	{
+		CoverageInOut |= uint8(Coverage);
+		return;
+	}
+
+	if ((Block.Min.X >= CellRect.Min.X) && (Block.Max.X <= CellRect.Max.X) && (Block.Min.Y >= CellRect.Min.Y) && (Block.Max.Y <= CellRect.Max.Y))
+	{
+		CoverageInOut |= uint8(Coverage);
+		return;
+	}
+
+	// Only partly inside, and not uniform -- look at the children.
+	// Note, level 0 is never mixed, so Level is at least 1 here.
+	for (int32 CY = Y * 2; CY <= Y * 2 + 1; CY++)
+	{
+		for (int32 CX = X * 2; CX <= X * 2 + 1; CX++)
+		{
+			GatherRectCoverage(Level - 1, CX, CY, CellRect, CoverageInOut);
+		}
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GAGridPyramid.generated.h"
+
+
+// What a coarse cell knows about the fine cells underneath it.
+// The values are bit flags (has open cells, has blocked cells), so a parent's coverage is just the OR of its children's.
+UENUM(BlueprintType)
+enum class EGridCoverage : uint8
+{
+	Open = 1,
+	Blocked = 2,
+	Mixed = 3
+};
+
+
+// A mip chain over the grid's traversability.
+//
+// Level 0 is the grid itself, one entry per cell. Every level after that is half the size (rounding up),
+// and each of its cells covers a 2x2 block of the level below -- so a cell at level L covers a
+// (1 << L) x (1 << L) block of grid cells. The last level is a single cell covering the whole grid.
+//
+// Children that hang off the edge of the level below count as blocked, so an Open coarse cell always
+// means every grid cell in its block exists and is traversable.
+//
+// Changes are pushed up incrementally: set the level 0 cells that changed, then RebuildParents over the
+// same rect, which only touches the ancestors of that rect.
+
+class FGAGridPyramid
+{
+public:
+	// Allocate every level for an XCount x YCount grid, with all cells blocked
+	void Init(int32 XCount, int32 YCount);
+
+	void Reset();
+
+	bool IsInitialized() const { return Levels.Num() > 0; }
+
+	int32 GetLevelCount() const { return Levels.Num(); }
+
+	FIntPoint GetLevelSize(int32 Level) const { return FIntPoint(Levels[Level].XCount, Levels[Level].YCount); }
+
+	FORCEINLINE void SetCell(int32 X, int32 Y, bool bOpen)
+	{
+		FLevel& Base = Levels[0];
+		Base.Cells[Y * Base.XCount + X] = uint8(bOpen ? EGridCoverage::Open : EGridCoverage::Blocked);
+	}
+
+	// Recompute every coarse cell above the given (inclusive) level 0 rect
+	void RebuildParents(const FIntRect& CellRect);
+
+	// X and Y are in the level's own cells. Anything off the level is blocked.
+	FORCEINLINE EGridCoverage GetCoverage(int32 Level, int32 X, int32 Y) const
+	{
+		const FLevel& L = Levels[Level];
+		if ((X < 0) || (X >= L.XCount) || (Y < 0) || (Y >= L.YCount))
+		{
+			return EGridCoverage::Blocked;
+		}
+		return EGridCoverage(L.Cells[Y * L.XCount + X]);
+	}
+
+	// Coverage of the block at the given level that contains grid cell (X, Y)
+	FORCEINLINE EGridCoverage GetBlockCoverage(int32 Level, int32 X, int32 Y) const
+	{
+		return GetCoverage(Level, X >> Level, Y >> Level);
+	}
+
+	// Coverage of an arbitrary (inclusive) rect of grid cells. Parts of the rect off the grid count as blocked.
+	// Walks down from the top and stops at the first level where a block is uniform, so a big open or
+	// blocked rect is answered from a handful of coarse cells.
+	EGridCoverage GetRectCoverage(const FIntRect& CellRect) const;
+
+private:
+	struct FLevel
+	{
+		int32 XCount = 0;
+		int32 YCount = 0;
+		TArray<uint8> Cells;
+	};
+
+	void GatherRectCoverage(int32 Level, int32 X, int32 Y, const FIntRect& CellRect, uint8& CoverageInOut) const;
+
+	TArray<FLevel> Levels;
+};
@@ -0,0 +1,445 @@
+#include "GAGridVisibility.h"
+#include "GAGridActor.h"
+#include "Async/ParallelFor.h"
+#include "Serialization/Archive.h"
+#include <atomic>
+
+
+struct FGAGridVisibility::FPendingBake
+{
+	TArray<FCellRef> Representatives;
+	TArray<int32> Targets;
+	TArray<FVector> TargetPositions;
+	TArray<uint64> ValidBits;
+	TArray<TArray<uint64>> RowWords;
+	int32 NextSource = 0;
+	int32 MinLevel = 0;
+	int64 MemoryBudget = 0;
+	int64 BytesUsed = 0;
+	bool bOverBudget = false;
+};
+
+FGAGridVisibility::FGAGridVisibility()
+{
+}
+
+FGAGridVisibility::~FGAGridVisibility()
+{
+}
+
+void FGAGridVisibility::Reset()
+{
+	Key = FGAGridVisibilityKey();
+	Level = 0;
+	LevelXCount = 0;
+	LevelYCount = 0;
+	TilesX = 0;
+	TilesY = 0;
+	TilesPerRow = 0;
+	Directory.Empty();
+	Words.Empty();
+	Pending.Reset();
+}
+
+void FGAGridVisibility::SetLevel(int32 LevelIn, int32 GridXCount, int32 GridYCount)
+{
+	Level = LevelIn;
+	LevelXCount = (GridXCount + (1 << Level) - 1) >> Level;
+	LevelYCount = (GridYCount + (1 << Level) - 1) >> Level;
+	TilesX = (LevelXCount + TileMask) >> TileShift;
+	TilesY = (LevelYCount + TileMask) >> TileShift;
+	TilesPerRow = TilesX * TilesY;
+}
+
+FGAGridVisibilityKey FGAGridVisibility::MakeKey(const AGAGridActor& Grid, int32 MinLevel, int64 MemoryBudget)
+{
+	FGAGridVisibilityKey Result;
+	Result.XCount = Grid.XCount;
+	Result.YCount = Grid.YCount;
+	Result.MinLevel = MinLevel;
+	Result.MemoryBudget = MemoryBudget;
+
+	// Hash whole words, except for the slack bits at the end
+	const TBitArray<>& Bits = Grid.TraversableBits;
+	const int32 WordCount = FMath::DivideAndRoundUp(Bits.Num(), 32);
+	uint32 Hash = 0;
+	for (int32 Word = 0; Word < WordCount; Word++)
+	{
+		uint32 Value = Bits.GetData()[Word];
+		if ((Word == WordCount - 1) && (Bits.Num() & 31))
+		{
+			Value &= (1u << (Bits.Num() & 31)) - 1;
+		}
+		Hash = FCrc::MemCrc32(&Value, sizeof(Value), Hash);
+	}
+	Result.TraversabilityHash = Hash;
+
+	return Result;
+}
+
+bool FGAGridVisibility::Bake(const AGAGridActor& Grid, int32 MinLevel, int64 MemoryBudget)
+{
+	Reset();
+
+	if (!Grid.IsGridReady() || (Grid.TraversableBits.Num() != Grid.XCount * Grid.YCount))
+	{
+		return false;
+	}
+
+	const int32 LevelCount = Grid.GetTraversabilityPyramid().GetLevelCount();
+	for (int32 TryLevel = FMath::Max(MinLevel, 0); TryLevel < LevelCount; TryLevel++)
+	{
+		if (BakeLevel(Grid, TryLevel, MemoryBudget))
+		{
+			Key = MakeKey(Grid, MinLevel, MemoryBudget);
+			return true;
+		}
+
+		UE_LOG(LogTemp, Display, TEXT("FGAGridVisibility: level %d doesn't fit in %lld bytes, trying a coarser one."), TryLevel, MemoryBudget);
+	}
+
+	UE_LOG(LogTemp, Warning, TEXT("FGAGridVisibility: no level fits in %lld bytes."), MemoryBudget);
+	Reset();
+	return false;
+}
+
+bool FGAGridVisibility::BakeLevel(const AGAGridActor& Grid, int32 LevelIn, int64 MemoryBudget)
+{
+	if (!BeginLevel(Grid, LevelIn, MemoryBudget))
+	{
+		return false;
+	}
+
+	BakeSources(Grid, 0, LevelXCount * LevelYCount);
+	return FinishLevel();
+}
+
+bool FGAGridVisibility::BeginLevel(const AGAGridActor& Grid, int32 LevelIn, int64 MemoryBudget)
+{
+	SetLevel(LevelIn, Grid.XCount, Grid.YCount);
+
+	const int32 SourceCount = LevelXCount * LevelYCount;
+	const int64 DirectoryBytes = int64(SourceCount) * TilesPerRow * sizeof(uint32);
+	if (DirectoryBytes > MemoryBudget)
+	{
+		return false;
+	}
+
+	Pending = MakeUnique<FPendingBake>();
+	Pending->MemoryBudget = MemoryBudget;
+	Pending->BytesUsed = DirectoryBytes;
+
+	// Each visibility cell is represented by its traversable grid cell closest to the center of its block.
+	// Cells with nothing traversable in them can't see or be seen.
+	const int32 BlockSize = 1 << Level;
+	TArray<FCellRef>& Representatives = Pending->Representatives;
+	Representatives.Init(FCellRef::Invalid, SourceCount);
+
+	for (int32 LY = 0; LY < LevelYCount; LY++)
+	{
+		for (int32 LX = 0; LX < LevelXCount; LX++)
+		{
+			const float CenterX = (LX << Level) + 0.5f * BlockSize - 0.5f;
+			const float CenterY = (LY << Level) + 0.5f * BlockSize - 0.5f;
+			float BestDistance = FLT_MAX;
+
+			for (int32 Y = LY << Level; Y < FMath::Min((LY + 1) << Level, Grid.YCount); Y++)
+			{
+				for (int32 X = LX << Level; X < FMath::Min((LX + 1) << Level, Grid.XCount); X++)
+				{
+					const float Distance = FMath::Square(X - CenterX) + FMath::Square(Y - CenterY);
+					if (Grid.TraversableBits[Y * Grid.XCount + X] && (Distance < BestDistance))
+					{
+						BestDistance = Distance;
+						Representatives[LY * LevelXCount + LX] = FCellRef(X, Y);
+					}
+				}
+			}
+		}
+	}
+
+	// Everything a ray can be aimed at
+	for (int32 Index = 0; Index < SourceCount; Index++)
+	{
+		if (Representatives[Index].IsValid())
+		{
+			Pending->Targets.Add(Index);
+			Pending->TargetPositions.Add(Grid.GetCellPosition(Representatives[Index]));
+		}
+	}
+
+	// Which bits of each tile are actually on the level. The rest are don't-cares, so that a tile hanging off
+	// the edge can still be all-visible.
+	TArray<uint64>& ValidBits = Pending->ValidBits;
+	ValidBits.SetNumZeroed(TilesPerRow * WordsPerTile);
+	for (int32 LY = 0; LY < LevelYCount; LY++)
+	{
+		for (int32 LX = 0; LX < LevelXCount; LX++)
+		{
+			const int32 Tile = (LY >> TileShift) * TilesX + (LX >> TileShift);
+			const int32 Bit = ((LY & TileMask) << TileShift) | (LX & TileMask);
+			ValidBits[Tile * WordsPerTile + (Bit >> 6)] |= uint64(1) << (Bit & 63);
+		}
+	}
+
+	Directory.SetNumZeroed(SourceCount * TilesPerRow);
+
+	// The mixed tiles go into a per-source list for now, with their directory entries relative to it;
+	// they're stitched together at the end.
+	Pending->RowWords.SetNum(SourceCount);
+	return true;
+}
+
+void FGAGridVisibility::BakeSources(const AGAGridActor& Grid, int32 FirstSource, int32 Count)
+{
+	FPendingBake& Bake = *Pending;
+	if (Bake.bOverBudget || (Count <= 0))
+	{
+		return;
+	}
+
+	std::atomic<int64> BytesUsed(Bake.BytesUsed);
+	std::atomic<bool> bOverBudget(false);
+
+	// Each source bakes its row on its own
+	ParallelFor(Count, [&](int32 Offset)
+	{
+		const int32 Source = FirstSource + Offset;
+		if (bOverBudget.load(std::memory_order_relaxed) || !Bake.Representatives[Source].IsValid())
+		{
+			return;
+		}
+
+		TBitArray<> Hits;
+		Grid.TraceLines(Grid.GetCellPosition(Bake.Representatives[Source]), Bake.TargetPositions, Hits);
+
+		TArray<uint64, TInlineAllocator<64>> RowBits;
+		RowBits.SetNumZeroed(TilesPerRow * WordsPerTile);
+		for (int32 Index = 0; Index < Bake.Targets.Num(); Index++)
+		{
+			if (!Hits[Index])
+			{
+				const int32 LX = Bake.Targets[Index] % LevelXCount;
+				const int32 LY = Bake.Targets[Index] / LevelXCount;
+				const int32 Tile = (LY >> TileShift) * TilesX + (LX >> TileShift);
+				const int32 Bit = ((LY & TileMask) << TileShift) | (LX & TileMask);
+				RowBits[Tile * WordsPerTile + (Bit >> 6)] |= uint64(1) << (Bit & 63);
+			}
+		}
+
+		TArray<uint64>& Mixed = Bake.RowWords[Source];
+		uint32* Entries = &Directory[Source * TilesPerRow];
+
+		for (int32 Tile = 0; Tile < TilesPerRow; Tile++)
+		{
+			const uint64* Bits = &RowBits[Tile * WordsPerTile];
+			const uint64* Valid = &Bake.ValidBits[Tile * WordsPerTile];
+
+			bool bNone = true;
+			bool bAll = true;
+			for (int32 Word = 0; Word < WordsPerTile; Word++)
+			{
+				bNone &= (Bits[Word] & Valid[Word]) == 0;
+				bAll &= (Bits[Word] & Valid[Word]) == Valid[Word];
+			}
+
+			if (bNone)
+			{
+				Entries[Tile] = NoneVisible;
+			}
+			else if (bAll)
+			{
+				Entries[Tile] = AllVisible;
+			}
+			else
+			{
+				Entries[Tile] = FirstMixedEntry + Mixed.Num();
+				Mixed.Append(Bits, WordsPerTile);
+			}
+		}
+
+		const int64 RowBytes = int64(Mixed.Num()) * int64(sizeof(uint64));
+		if (BytesUsed.fetch_add(RowBytes) + RowBytes > Bake.MemoryBudget)
+		{
+			bOverBudget.store(true);
+		}
+	});
+
+	Bake.BytesUsed = BytesUsed.load();
+	Bake.bOverBudget = bOverBudget.load();
+}
+
+bool FGAGridVisibility::FinishLevel()
+{
+	TUniquePtr<FPendingBake> Bake = MoveTemp(Pending);
+	if (!Bake.IsValid() || Bake->bOverBudget)
+	{
+		Directory.Empty();
+		return false;
+	}
+
+	// Stitch the rows together
+	int64 WordCount = 0;
+	for (const TArray<uint64>& Row : Bake->RowWords)
+	{
+		WordCount += Row.Num();
+	}
+	Words.Empty(int32(WordCount));
+
+	const int32 SourceCount = LevelXCount * LevelYCount;
+	for (int32 Source = 0; Source < SourceCount; Source++)
+	{
+		if (Bake->RowWords[Source].Num() == 0)
+		{
+			continue;
+		}
+
+		const uint32 Base = Words.Num();
+		uint32* Entries = &Directory[Source * TilesPerRow];
+		for (int32 Tile = 0; Tile < TilesPerRow; Tile++)
+		{
+			if (Entries[Tile] >= FirstMixedEntry)
+			{
+				Entries[Tile] += Base;
+			}
+		}
+		Words.Append(Bake->RowWords[Source]);
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("FGAGridVisibility: baked %d x %d cells at level %d, %llu bytes (%d mixed tiles)."),
+		LevelXCount, LevelYCount, Level, uint64(GetAllocatedSize()), Words.Num() / WordsPerTile);
+	return true;
+}
+
+bool FGAGridVisibility::BeginBake(const AGAGridActor& Grid, int32 LevelIn, int32 MinLevel, int64 MemoryBudget)
+{
+	Reset();
+
+	if (!Grid.IsGridReady() || (Grid.TraversableBits.Num() != Grid.XCount * Grid.YCount) ||
+		(LevelIn < 0) || (LevelIn >= Grid.GetTraversabilityPyramid().GetLevelCount()))
+	{
+		return false;
+	}
+
+	if (!BeginLevel(Grid, LevelIn, MemoryBudget))
+	{
+		Reset();
+		return false;
+	}
+
+	Pending->MinLevel = MinLevel;
+	return true;
+}
+
+bool FGAGridVisibility::ContinueBake(const AGAGridActor& Grid, int32 MaxSources)
+{
+	if (!Pending.IsValid())
+	{
+		return true;
+	}
+
+	const int32 SourceCount = LevelXCount * LevelYCount;
+	const int32 Count = FMath::Min(FMath::Max(MaxSources, 1), SourceCount - Pending->NextSource);
+	BakeSources(Grid, Pending->NextSource, Count);
+	Pending->NextSource += Count;
+
+	if (!Pending->bOverBudget && (Pending->NextSource < SourceCount))
+	{
+		return false;
+	}
+
+	const int32 MinLevel = Pending->MinLevel;
+	const int64 MemoryBudget = Pending->MemoryBudget;
+	if (FinishLevel())
+	{
+		Key = MakeKey(Grid, MinLevel, MemoryBudget);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Display, TEXT("FGAGridVisibility: level %d doesn't fit in %lld bytes any more."), Level, MemoryBudget);
+		Reset();
+	}
+	return true;
+}
+
+bool FGAGridVisibility::Save(FArchive& Ar) const
+{
+	if (!IsBaked())
+	{
+		return false;
+	}
+
+	uint32 Magic = FGAGridVisibilityKey::FileMagic;
+	int32 Version = FGAGridVisibilityKey::FileVersion;
+	FGAGridVisibilityKey KeyCopy = Key;
+	int32 LevelCopy = Level;
+	int32 XCountCopy = LevelXCount;
+	int32 YCountCopy = LevelYCount;
+
+	Ar << Magic;
+	Ar << Version;
+	Ar << KeyCopy;
+	Ar << LevelCopy;
+	Ar << XCountCopy;
+	Ar << YCountCopy;
+
+	const_cast<TArray<uint32>&>(Directory).BulkSerialize(Ar);
+	const_cast<TArray<uint64>&>(Words).BulkSerialize(Ar);
+
+	return !Ar.IsError();
+}
+
+bool FGAGridVisibility::Load(FArchive& Ar, const FGAGridVisibilityKey& ExpectedKey)
+{
+	Reset();
+
+	uint32 Magic = 0;
+	int32 Version = 0;
+
+	Ar << Magic;
+	Ar << Version;
+	if (Ar.IsError() || (Magic != FGAGridVisibilityKey::FileMagic) || (Version != FGAGridVisibilityKey::FileVersion))
+	{
+		return false;
+	}
+
+	FGAGridVisibilityKey FileKey;
+	int32 LevelIn = 0;
+	int32 XCountIn = 0;
+	int32 YCountIn = 0;
+
+	Ar << FileKey;
+	Ar << LevelIn;
+	Ar << XCountIn;
+	Ar << YCountIn;
+	if (Ar.IsError() || !FileKey.Matches(ExpectedKey) || (LevelIn < 0) || (LevelIn >= 31))
+	{
+		return false;
+	}
+
+	SetLevel(LevelIn, FileKey.XCount, FileKey.YCount);
+	if ((XCountIn != LevelXCount) || (YCountIn != LevelYCount))
+	{
+		Reset();
+		return false;
+	}
+
+	Directory.BulkSerialize(Ar);
+	Words.BulkSerialize(Ar);
+
+	// Make sure every entry points somewhere real before we trust it
+	bool bValid = !Ar.IsError() && (Directory.Num() == LevelXCount * LevelYCount * TilesPerRow);
+	for (int32 Index = 0; bValid && (Index < Directory.Num()); Index++)
+	{
+		bValid = (Directory[Index] < FirstMixedEntry) || (int64(Directory[Index] - FirstMixedEntry) + WordsPerTile <= Words.Num());
+	}
+
+	if (!bValid)
+	{
+		Reset();
+		return false;
+	}
+
+	Key = FileKey;
+	return true;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class AGAGridActor;
+class FArchive;
+
+
+// Everything that decides whether a baked visibility cache file is still good
+struct FGAGridVisibilityKey
+{
+	static constexpr uint32 FileMagic = 0x53564147;		// "GAVS"
+
+	// Bump this whenever the layout of the cache file changes
+	static constexpr int32 FileVersion = 1;
+
+	// Hash of the grid's TraversableBits
+	uint32 TraversabilityHash = 0;
+
+	int32 XCount = 0;
+	int32 YCount = 0;
+	int32 MinLevel = 0;
+	int64 MemoryBudget = 0;
+
+	bool Matches(const FGAGridVisibilityKey& Other) const
+	{
+		return (TraversabilityHash == Other.TraversabilityHash) && (XCount == Other.XCount) && (YCount == Other.YCount) &&
+			(MinLevel == Other.MinLevel) && (MemoryBudget == Other.MemoryBudget);
+	}
+
+	friend FArchive& operator<<(FArchive& Ar, FGAGridVisibilityKey& Key)
+	{
+		Ar << Key.TraversabilityHash;
+		Ar << Key.XCount;
+		Ar << Key.YCount;
+		Ar << Key.MinLevel;
+		Ar << Key.MemoryBudget;
+		return Ar;
+	}
+};
+
+
+// A precomputed cell-to-cell visibility table (a PVS) for a grid.
+//
+// Visibility is baked on the grid's traversability, with the same rays TraceLines uses, from cell center to
+// cell center. It's baked at a pyramid level: at level L a visibility cell is a (1 << L) x (1 << L) block of grid
+// cells, represented by its traversable cell nearest the block's center. Level 0 is exact; coarser levels trade
+// accuracy for memory. The bake starts at MinLevel and goes coarser until the table fits the memory budget.
+//
+// Each source cell has a row of bits, one per target cell. Rows are cut into 16 x 16 tiles of targets, and since
+// visibility is mostly coherent, most tiles are either all visible or all hidden. Those cost one directory entry;
+// only the mixed tiles keep their 256 bits. A lookup is the directory entry, then (for mixed tiles) one word,
+// so IsVisible is O(1) whatever the compression.
+
+class FGAGridVisibility
+{
+public:
+	static constexpr int32 TileShift = 4;
+	static constexpr int32 TileSize = 1 << TileShift;
+	static constexpr int32 TileMask = TileSize - 1;
+	static constexpr int32 WordsPerTile = (TileSize * TileSize) / 64;
+
+	FGAGridVisibility();
+	~FGAGridVisibility();
+
+	// Bake from the grid's current traversability. Returns false if the grid isn't ready, or if nothing fits
+	// in the budget even at the coarsest level.
+	bool Bake(const AGAGridActor& Grid, int32 MinLevel, int64 MemoryBudget);
+
+	void Reset();
+
+	// Time-sliced version of Bake, at a fixed level: BeginBake, then ContinueBake until it returns true, after which
+	// IsBaked says whether it worked. Each call bakes the next MaxSources rows (on worker threads), so a rebake can be
+	// spread over frames. The grid mustn't change in between; start again with BeginBake if it does.
+	bool BeginBake(const AGAGridActor& Grid, int32 LevelIn, int32 MinLevel, int64 MemoryBudget);
+	bool ContinueBake(const AGAGridActor& Grid, int32 MaxSources);
+
+	bool IsBaking() const { return Pending.IsValid(); }
+
+	bool IsBaked() const { return (Directory.Num() > 0) && !Pending.IsValid(); }
+
+	// The pyramid level the table was baked at
+	int32 GetLevel() const { return Level; }
+
+	const FGAGridVisibilityKey& GetKey() const { return Key; }
+
+	SIZE_T GetAllocatedSize() const { return Directory.GetAllocatedSize() + Words.GetAllocatedSize(); }
+
+	// Grid cells in, both must be on the grid
+	FORCEINLINE bool IsVisible(int32 FromX, int32 FromY, int32 ToX, int32 ToY) const
+	{
+		const int32 Source = (FromY >> Level) * LevelXCount + (FromX >> Level);
+		const int32 TX = ToX >> Level;
+		const int32 TY = ToY >> Level;
+
+		const uint32 Entry = Directory[Source * TilesPerRow + (TY >> TileShift) * TilesX + (TX >> TileShift)];
+		if (Entry < FirstMixedEntry)
+		{
+			return Entry == AllVisible;
+		}
+
+		const int32 Bit = ((TY & TileMask) << TileShift) | (TX & TileMask);
+		return ((Words[(Entry - FirstMixedEntry) + (Bit >> 6)] >> (Bit & 63)) & 1) != 0;
+	}
+
+	// The key a bake of this grid would have
+	static FGAGridVisibilityKey MakeKey(const AGAGridActor& Grid, int32 MinLevel, int64 MemoryBudget);
+
+	// File layout:
+	//		uint32 FileMagic, int32 FileVersion, FGAGridVisibilityKey, int32 Level, int32 LevelXCount, int32 LevelYCount
+	//		uint32 Directory[], uint64 Words[]
+	bool Save(FArchive& Ar) const;
+
+	// Fails (and leaves us empty) if the file doesn't match Key
+	bool Load(FArchive& Ar, const FGAGridVisibilityKey& ExpectedKey);
+
+private:
+	// Directory entries. Anything from FirstMixedEntry up is an offset into Words (plus FirstMixedEntry).
+	static constexpr uint32 NoneVisible = 0;
+	static constexpr uint32 AllVisible = 1;
+	static constexpr uint32 FirstMixedEntry = 2;
+
+	// Bake at one level. Returns false if it went over budget.
+	bool BakeLevel(const AGAGridActor& Grid, int32 LevelIn, int64 MemoryBudget);
+
+	// BakeLevel in pieces: set up the level, bake a run of source rows, then stitch the rows together
+	bool BeginLevel(const AGAGridActor& Grid, int32 LevelIn, int64 MemoryBudget);
+	void BakeSources(const AGAGridActor& Grid, int32 FirstSource, int32 Count);
+	bool FinishLevel();
+
+	void SetLevel(int32 LevelIn, int32 GridXCount, int32 GridYCount);
+
+	FGAGridVisibilityKey Key;
+
+	int32 Level = 0;
+	int32 LevelXCount = 0;
+	int32 LevelYCount = 0;
+	int32 TilesX = 0;
+	int32 TilesY = 0;
+	int32 TilesPerRow = 0;
+
+	// TilesPerRow entries per source cell, sources row-major
+	TArray<uint32> Directory;
+
+	// WordsPerTile words per mixed tile, bit ((Y & TileMask) << TileShift) | (X & TileMask) per target
+	TArray<uint64> Words;
+
+	// Everything a bake in progress needs between BeginLevel and FinishLevel (see the .cpp)
+	struct FPendingBake;
+	TUniquePtr<FPendingBake> Pending;
+};
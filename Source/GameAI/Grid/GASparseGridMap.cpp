@@ -0,0 +1,248 @@
+#include "GASparseGridMap.h"
+#include "GAGridActor.h"
+
+
+FGASparseGridMap::FGASparseGridMap() : XCount(INDEX_NONE), YCount(INDEX_NONE), GridBounds(), DefaultValue(0.0f)
+{
+	// we are empty
+}
+
+FGASparseGridMap::FGASparseGridMap(int32 XCountIn, int32 YCountIn, float DefaultValueIn)
+{
+	XCount = XCountIn;
+	YCount = YCountIn;
+	GridBounds = FGridBox(0, XCount - 1, 0, YCount - 1);
+
+	ResetData(DefaultValueIn);
+}
+
+FGASparseGridMap::FGASparseGridMap(const AGAGridActor* Grid, float DefaultValueIn)
+{
+	XCount = Grid->XCount;
+	YCount = Grid->YCount;
+	GridBounds = FGridBox(0, XCount - 1, 0, YCount - 1);
+
+	ResetData(DefaultValueIn);
+}
+
+FGASparseGridMap::FGASparseGridMap(const AGAGridActor* Grid, const FGridBox& GridBoxIn, float DefaultValueIn)
+{
+	XCount = Grid->XCount;
+	YCount = Grid->YCount;
+	GridBounds = GridBoxIn;
+
+	ResetData(DefaultValueIn);
+}
+
+void FGASparseGridMap::ResetData(float DefaultValueIn)
+{
+	DefaultValue = DefaultValueIn;
+	InitTiles();
+}
+
+void FGASparseGridMap::InitTiles()
+{
+	SlotTiles.Reset();
+	TileValues.Reset();
+
+	if (GridBounds.IsValid())
+	{
+		TilesX = FMath::DivideAndRoundUp(GridBounds.GetWidth(), TileSize);
+		TilesY = FMath::DivideAndRoundUp(GridBounds.GetHeight(), TileSize);
+		TileSlots.Init(INDEX_NONE, TilesX * TilesY);
+	}
+	else
+	{
+		TilesX = 0;
+		TilesY = 0;
+		TileSlots.Empty();
+	}
+}
+
+
+bool FGASparseGridMap::CellRefToLocal(const FCellRef& Cell, int32& X, int32& Y) const
+{
+	if (IsValid() && GridBounds.IsValidCell(Cell))
+	{
+		X = Cell.X - GridBounds.MinX;
+		Y = Cell.Y - GridBounds.MinY;
+		return true;
+	}
+	return false;
+}
+
+bool FGASparseGridMap::LocalToCellRef(int32 X, int32 Y, FCellRef& Cell) const
+{
+	if (IsValid())
+	{
+		Cell.X = X + GridBounds.MinX;
+		Cell.Y = Y + GridBounds.MinY;
+		return (Cell.X <= XCount) && (Cell.Y <= YCount);
+	}
+	return false;
+}
+
+
+bool FGASparseGridMap::GetValue(const FCellRef& Cell, float& ValueOut) const
+{
+	int32 X, Y;
+	if (CellRefToLocal(Cell, X, Y))
+	{
+		const int32 Slot = TileSlots[(Y >> TileShift) * TilesX + (X >> TileShift)];
+		ValueOut = (Slot == INDEX_NONE) ? DefaultValue : TileValues[Slot * TileCellCount + ((Y & TileMask) << TileShift) + (X & TileMask)];
+		return true;
+	}
+	return false;
+}
+
+bool FGASparseGridMap::GetMaxValue(float& MaxValueOut) const
+{
+	if (IsValid())
+	{
+		MaxValueOut = -UE_MAX_FLT;
+		int32 AllocatedCellCount = 0;
+
+		ForEachAllocatedTile([&MaxValueOut, &AllocatedCellCount](const FIntRect& Rect, const float* Values)
+		{
+			// Skip the part of edge tiles that hangs off the bounds
+			const int32 X0 = Rect.Min.X & ~TileMask;
+			const int32 Y0 = Rect.Min.Y & ~TileMask;
+			for (int32 Y = Rect.Min.Y; Y <= Rect.Max.Y; Y++)
+			{
+				const float* Row = Values + ((Y - Y0) << TileShift);
+				for (int32 X = Rect.Min.X; X <= Rect.Max.X; X++)
+				{
+					MaxValueOut = FMath::Max(MaxValueOut, Row[X - X0]);
+				}
+			}
+			AllocatedCellCount += (Rect.Max.X - Rect.Min.X + 1) * (Rect.Max.Y - Rect.Min.Y + 1);
+		});
+
+		// Every cell we didn't visit is DefaultValue
+		if (AllocatedCellCount < GridBounds.GetCellCount())
+		{
+			MaxValueOut = FMath::Max(MaxValueOut, DefaultValue);
+		}
+		return true;
+	}
+	return false;
+}
+
+
+bool FGASparseGridMap::SetValue(const FCellRef& Cell, float Value)
+{
+	int32 X, Y;
+	if (CellRefToLocal(Cell, X, Y))
+	{
+		const int32 Tile = (Y >> TileShift) * TilesX + (X >> TileShift);
+		int32 Slot = TileSlots[Tile];
+		if (Slot == INDEX_NONE)
+		{
+			if (Value == DefaultValue)
+			{
+				// Already is
+				return true;
+			}
+			Slot = AllocateTile(Tile);
+		}
+
+		TileValues[Slot * TileCellCount + ((Y & TileMask) << TileShift) + (X & TileMask)] = Value;
+		return true;
+	}
+	return false;
+}
+
+int32 FGASparseGridMap::AllocateTile(int32 Tile)
+{
+	int32& Slot = TileSlots[Tile];
+	if (Slot == INDEX_NONE)
+	{
+		Slot = SlotTiles.Add(Tile);
+
+		const int32 FirstValue = TileValues.AddUninitialized(TileCellCount);
+		for (int32 Index = FirstValue; Index < FirstValue + TileCellCount; Index++)
+		{
+			TileValues[Index] = DefaultValue;
+		}
+	}
+	return Slot;
+}
+
+void FGASparseGridMap::FreeSlot(int32 Slot)
+{
+	const int32 FreedTile = SlotTiles[Slot];
+
+	// Move the last slot into the hole, so the allocated tiles stay packed
+	const int32 LastSlot = SlotTiles.Num() - 1;
+	if (Slot != LastSlot)
+	{
+		FMemory::Memcpy(&TileValues[Slot * TileCellCount], &TileValues[LastSlot * TileCellCount], TileCellCount * sizeof(float));
+		SlotTiles[Slot] = SlotTiles[LastSlot];
+		TileSlots[SlotTiles[Slot]] = Slot;
+	}
+
+	TileSlots[FreedTile] = INDEX_NONE;
+	SlotTiles.RemoveAt(LastSlot, 1, false);
+	TileValues.RemoveAt(LastSlot * TileCellCount, TileCellCount, false);
+}
+
+void FGASparseGridMap::Compact()
+{
+	// Walk backwards, so that the slot moved into a freed one has already been checked
+	for (int32 Slot = SlotTiles.Num() - 1; Slot >= 0; Slot--)
+	{
+		const float* Values = &TileValues[Slot * TileCellCount];
+
+		bool bAllDefault = true;
+		for (int32 Index = 0; (Index < TileCellCount) && bAllDefault; Index++)
+		{
+			bAllDefault = (Values[Index] == DefaultValue);
+		}
+
+		if (bAllDefault)
+		{
+			FreeSlot(Slot);
+		}
+	}
+}
+
+void FGASparseGridMap::Swap(FGASparseGridMap& Other)
+{
+	::Swap(XCount, Other.XCount);
+	::Swap(YCount, Other.YCount);
+	::Swap(GridBounds, Other.GridBounds);
+	::Swap(DefaultValue, Other.DefaultValue);
+	::Swap(TilesX, Other.TilesX);
+	::Swap(TilesY, Other.TilesY);
+	::Swap(TileSlots, Other.TileSlots);
+	::Swap(SlotTiles, Other.SlotTiles);
+	::Swap(TileValues, Other.TileValues);
+}
+
+
+FGAGridMap FGASparseGridMap::ToGridMap() const
+{
+	FGAGridMap Result;
+	Result.XCount = XCount;
+	Result.YCount = YCount;
+	Result.GridBounds = GridBounds;
+	Result.ResetData(DefaultValue);
+
+	if (IsValid())
+	{
+		ForEachAllocatedTile([&Result](const FIntRect& Rect, const float* Values)
+		{
+			const int32 X0 = Rect.Min.X & ~TileMask;
+			const int32 Y0 = Rect.Min.Y & ~TileMask;
+			for (int32 Y = Rect.Min.Y; Y <= Rect.Max.Y; Y++)
+			{
+				for (int32 X = Rect.Min.X; X <= Rect.Max.X; X++)
+				{
+					Result.Data[Result.LocalToIndex(X, Y)] = Values[((Y - Y0) << TileShift) + (X - X0)];
+				}
+			}
+		});
+	}
+
+	return Result;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GAGridMap.h"
+#include "GASparseGridMap.generated.h"
+
+
+// Same idea as FGAGridMap -- a set of float values over (part of) the grid -- but for layers that are
+// mostly one value (usually zero), like occupancy, danger or influence maps.
+//
+// The bounds are cut up into TileSize x TileSize tiles, and a tile only gets memory once some cell in it
+// is set to something other than DefaultValue. Cells in unallocated tiles read back as DefaultValue.
+// Allocated tiles are packed together in one array, so walking them (ForEachAllocatedTile) is a linear scan
+// that never visits the empty parts of the map.
+//
+// The accessors match FGAGridMap, so the two can be swapped for each other.
+
+USTRUCT(BlueprintType)
+struct FGASparseGridMap
+{
+	GENERATED_USTRUCT_BODY()
+
+	static constexpr int32 TileShift = 4;
+	static constexpr int32 TileSize = 1 << TileShift;
+	static constexpr int32 TileMask = TileSize - 1;
+	static constexpr int32 TileCellCount = TileSize * TileSize;
+
+	FGASparseGridMap();
+	FGASparseGridMap(int32 XCountIn, int32 YCountIn, float DefaultValueIn);
+	FGASparseGridMap(const AGAGridActor* Grid, float DefaultValueIn);
+	FGASparseGridMap(const AGAGridActor* Grid, const FGridBox& GridBoxIn, float DefaultValueIn);
+
+	// Set every cell back to DefaultValueIn, freeing all the tiles
+	void ResetData(float DefaultValueIn);
+
+	// The XCount of the GridActor I'm built on
+	UPROPERTY(BlueprintReadOnly)
+	int32 XCount;
+
+	// The YCount of the GridActor I'm built on
+	UPROPERTY(BlueprintReadOnly)
+	int32 YCount;
+
+	// The bounds over which I am defined
+	UPROPERTY(BlueprintReadOnly)
+	FGridBox GridBounds;
+
+	// The value of every cell in an unallocated tile
+	UPROPERTY(BlueprintReadOnly)
+	float DefaultValue;
+
+
+	bool CellRefToLocal(const FCellRef& Cell, int32& X, int32& Y) const;
+
+	bool LocalToCellRef(int32 X, int32 Y, FCellRef& Cell) const;
+
+	bool GetValue(const FCellRef& Cell, float& ValueOut) const;
+
+	bool GetMaxValue(float& MaxValueOut) const;
+
+	// Setting a cell in an unallocated tile to DefaultValue doesn't allocate anything
+	bool SetValue(const FCellRef& Cell, float Value);
+
+	FORCEINLINE bool IsValid() const
+	{
+		return GridBounds.IsValid() && (TileSlots.Num() == TilesX * TilesY);
+	}
+
+	int32 GetAllocatedTileCount() const { return SlotTiles.Num(); }
+
+	// Free any allocated tiles that have gone back to being all DefaultValue
+	void Compact();
+
+	// Trade contents with another map. O(1), no copying.
+	void Swap(FGASparseGridMap& Other);
+
+	// Copy into a dense map, e.g. for the debug view
+	FGAGridMap ToGridMap() const;
+
+	// Visit each allocated tile. Rect is in local cells (inclusive, clipped to the bounds), and cell (X, Y) of
+	// the rect lives at Values[((Y - TileY0) << TileShift) + (X - TileX0)], where (TileX0, TileY0) is the tile's
+	// unclipped min corner, i.e. Rect.Min rounded down to a multiple of TileSize.
+	// Func(const FIntRect& Rect, const float* Values)
+	template<typename FuncType>
+	void ForEachAllocatedTile(FuncType&& Func) const
+	{
+		for (int32 Slot = 0; Slot < SlotTiles.Num(); Slot++)
+		{
+			Func(GetTileRect(SlotTiles[Slot]), &TileValues[Slot * TileCellCount]);
+		}
+	}
+
+	// Same, but the values can be written. Writing DefaultValue doesn't free anything; call Compact for that.
+	template<typename FuncType>
+	void ForEachAllocatedTile(FuncType&& Func)
+	{
+		for (int32 Slot = 0; Slot < SlotTiles.Num(); Slot++)
+		{
+			Func(GetTileRect(SlotTiles[Slot]), &TileValues[Slot * TileCellCount]);
+		}
+	}
+
+private:
+	void InitTiles();
+
+	FIntRect GetTileRect(int32 Tile) const
+	{
+		const int32 X0 = (Tile % TilesX) << TileShift;
+		const int32 Y0 = (Tile / TilesX) << TileShift;
+		return FIntRect(X0, Y0, FMath::Min(X0 + TileSize, GridBounds.GetWidth()) - 1, FMath::Min(Y0 + TileSize, GridBounds.GetHeight()) - 1);
+	}
+
+	// Allocate (or find) the tile, and return its slot
+	int32 AllocateTile(int32 Tile);
+
+	void FreeSlot(int32 Slot);
+
+	int32 TilesX = 0;
+	int32 TilesY = 0;
+
+	// For each tile (row-major over the bounds), its slot in TileValues, or INDEX_NONE if it isn't allocated
+	TArray<int32> TileSlots;
+
+	// For each slot, the tile in it
+	TArray<int32> SlotTiles;
+
+	// TileCellCount values per slot, row-major inside the tile
+	TArray<float> TileValues;
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Math/Float16.h"
+#include "GAGridMap.h"
+
+
+// A grid map that stores something smaller than a float per cell.
+//
+// Lots of layers don't need 32 bits: line of sight is 0 or 1, curve outputs and occupancy probabilities live in
+// [0, 1], and so on. TGAGridMap stores them as uint8 or uint16 fixed-point over a [RangeMin, RangeMax] range, or as
+// half floats, and converts to and from float at the edges. The layout and bounds work exactly like FGAGridMap
+// (and a typed map built on the same grid and box has the same storage shape as the float one), so converting
+// between them is a straight pass over the storage.
+//
+// FGAGridMap stays the type that goes to and from Blueprint; these are for C++ code holding on to big layers
+// (e.g. AGAGridActor::ClearanceMap).
+//
+// AGAGridActor holds one of these, so this header can't include GAGridActor.h. That's why the grid constructors
+// take the grid as a template parameter, and nothing in here touches FCellRef's members.
+
+
+// How each value type is packed. Integer types are fixed-point over the map's range, values outside the range clamp.
+template<typename ValueType>
+struct TGAGridValueCodec
+{
+	static constexpr bool bQuantized = false;
+	static constexpr float MaxCode = 1.0f;
+
+	FORCEINLINE static float Decode(ValueType Value, float Scale, float Bias) { return float(Value); }
+	FORCEINLINE static ValueType Encode(float Value, float InvScale, float Bias) { return ValueType(Value); }
+};
+
+template<>
+struct TGAGridValueCodec<uint8>
+{
+	static constexpr bool bQuantized = true;
+	static constexpr float MaxCode = 255.0f;
+
+	FORCEINLINE static float Decode(uint8 Value, float Scale, float Bias) { return float(Value) * Scale + Bias; }
+	FORCEINLINE static uint8 Encode(float Value, float InvScale, float Bias)
+	{
+		return uint8(FMath::Clamp(FMath::RoundToInt((Value - Bias) * InvScale), 0, 255));
+	}
+};
+
+template<>
+struct TGAGridValueCodec<uint16>
+{
+	static constexpr bool bQuantized = true;
+	static constexpr float MaxCode = 65535.0f;
+
+	FORCEINLINE static float Decode(uint16 Value, float Scale, float Bias) { return float(Value) * Scale + Bias; }
+	FORCEINLINE static uint16 Encode(float Value, float InvScale, float Bias)
+	{
+		return uint16(FMath::Clamp(FMath::RoundToInt((Value - Bias) * InvScale), 0, 65535));
+	}
+};
+
+template<>
+struct TGAGridValueCodec<FFloat16>
+{
+	static constexpr bool bQuantized = false;
+	static constexpr float MaxCode = 1.0f;
+
+	FORCEINLINE static float Decode(FFloat16 Value, float Scale, float Bias) { return Value.GetFloat(); }
+	FORCEINLINE static FFloat16 Encode(float Value, float InvScale, float Bias) { return FFloat16(Value); }
+};
+
+
+template<typename ValueType>
+struct TGAGridMap
+{
+	typedef TGAGridValueCodec<ValueType> CodecType;
+
+	TGAGridMap() : XCount(INDEX_NONE), YCount(INDEX_NONE), Layout(EGridLayout::RowMajor) { SetRange(0.0f, 1.0f); }
+
+	// RangeMin and RangeMax only matter for the integer types. GridType is AGAGridActor.
+	template<typename GridType>
+	TGAGridMap(const GridType* Grid, float InitialValue, float RangeMinIn = 0.0f, float RangeMaxIn = 1.0f)
+		: XCount(Grid->XCount), YCount(Grid->YCount), GridBounds(0, Grid->XCount - 1, 0, Grid->YCount - 1), Layout(Grid->Layout)
+	{
+		SetRange(RangeMinIn, RangeMaxIn);
+		ResetData(InitialValue);
+	}
+
+	template<typename GridType>
+	TGAGridMap(const GridType* Grid, const FGridBox& GridBoxIn, float InitialValue, float RangeMinIn = 0.0f, float RangeMaxIn = 1.0f)
+		: XCount(Grid->XCount), YCount(Grid->YCount), GridBounds(GridBoxIn), Layout(Grid->Layout)
+	{
+		SetRange(RangeMinIn, RangeMaxIn);
+		ResetData(InitialValue);
+	}
+
+	int32 XCount;
+	int32 YCount;
+	FGridBox GridBounds;
+	EGridLayout Layout;
+	FGAGridIndexer Indexer;
+
+	// Laid out the same way as FGAGridMap::Data
+	TArray<ValueType> Data;
+
+	float GetRangeMin() const { return RangeMin; }
+	float GetRangeMax() const { return RangeMax; }
+
+	// The smallest step between two stored values, i.e. the worst-case rounding error is half of this
+	float GetResolution() const { return CodecType::bQuantized ? Scale : 0.0f; }
+
+	void ResetData(float InitialValue)
+	{
+		if (GridBounds.IsValid())
+		{
+			Indexer = FGAGridIndexer::Make(Layout, GridBounds.GetWidth(), GridBounds.GetHeight());
+			Data.Init(Encode(InitialValue), Indexer.GetStorageCount());
+		}
+		else
+		{
+			Indexer = FGAGridIndexer();
+			Data.Empty();
+		}
+	}
+
+	FORCEINLINE bool IsValid() const
+	{
+		return GridBounds.IsValid() && Indexer.Matches(Layout, GridBounds.GetWidth(), GridBounds.GetHeight()) && (Indexer.GetStorageCount() == Data.Num());
+	}
+
+	bool CellRefToLocal(const FCellRef& Cell, int32& X, int32& Y) const
+	{
+		return IsValid() && GridBounds.CellRefToLocal(Cell, X, Y);
+	}
+
+	bool GetValue(const FCellRef& Cell, float& ValueOut) const
+	{
+		int32 X, Y;
+		if (CellRefToLocal(Cell, X, Y))
+		{
+			ValueOut = Decode(Data[Indexer.Index(X, Y)]);
+			return true;
+		}
+		return false;
+	}
+
+	bool SetValue(const FCellRef& Cell, float Value)
+	{
+		int32 X, Y;
+		if (CellRefToLocal(Cell, X, Y))
+		{
+			Data[Indexer.Index(X, Y)] = Encode(Value);
+			return true;
+		}
+		return false;
+	}
+
+	bool GetMaxValue(float& MaxValueOut) const
+	{
+		if (!IsValid())
+		{
+			return false;
+		}
+
+		// Decoding is monotonic, so find the biggest stored value and decode just that one
+		bool bFirst = true;
+		ValueType MaxStored = ValueType();
+		const ValueType* Values = Data.GetData();
+
+		Indexer.ForEachSpan([Values, &MaxStored, &bFirst](int32 X, int32 Y, int32 Index, int32 Count)
+		{
+			for (int32 I = Index; I < Index + Count; I++)
+			{
+				if (bFirst || (float(Values[I]) > float(MaxStored)))
+				{
+					MaxStored = Values[I];
+					bFirst = false;
+				}
+			}
+		});
+
+		MaxValueOut = Decode(MaxStored);
+		return true;
+	}
+
+	FORCEINLINE float Decode(ValueType Value) const { return CodecType::Decode(Value, Scale, RangeMin); }
+	FORCEINLINE ValueType Encode(float Value) const { return CodecType::Encode(Value, InvScale, RangeMin); }
+
+	// Conversion kernels --------------------------------
+
+	// Take on Source's bounds and layout, and quantize its values
+	void FromGridMap(const FGAGridMap& Source)
+	{
+		XCount = Source.XCount;
+		YCount = Source.YCount;
+		GridBounds = Source.GridBounds;
+		Layout = Source.Layout;
+		Indexer = FGAGridIndexer::Make(Layout, GridBounds.GetWidth(), GridBounds.GetHeight());
+
+		if (!Source.IsValid())
+		{
+			Data.Empty();
+			return;
+		}
+
+		Data.SetNumUninitialized(Indexer.GetStorageCount());
+
+		if (Source.IsMapped())
+		{
+			// Not laid out in memory the way we are, so pull it in first
+			FGAGridMap Dense = Source;
+			Dense.Materialize();
+			EncodeSpan(Dense.Data.GetData(), Data.GetData(), Data.Num());
+			return;
+		}
+
+		// Same bounds and layout, so the same storage shape -- one straight pass, padding and all
+		EncodeSpan(Source.Data.GetData(), Data.GetData(), Data.Num());
+	}
+
+	// Write our values out into a float map with the same bounds and layout
+	void ToGridMap(FGAGridMap& Dest) const
+	{
+		Dest.XCount = XCount;
+		Dest.YCount = YCount;
+		Dest.GridBounds = GridBounds;
+		Dest.Layout = Layout;
+		Dest.ResetData(0.0f);
+
+		if (IsValid() && (Dest.Data.Num() == Data.Num()))
+		{
+			DecodeSpan(Data.GetData(), Dest.Data.GetData(), Data.Num());
+		}
+	}
+
+	void EncodeSpan(const float* In, ValueType* Out, int32 Count) const
+	{
+		const float LocalInvScale = InvScale;
+		const float LocalBias = RangeMin;
+		for (int32 Index = 0; Index < Count; Index++)
+		{
+			Out[Index] = CodecType::Encode(In[Index], LocalInvScale, LocalBias);
+		}
+	}
+
+	void DecodeSpan(const ValueType* In, float* Out, int32 Count) const
+	{
+		const float LocalScale = Scale;
+		const float LocalBias = RangeMin;
+		for (int32 Index = 0; Index < Count; Index++)
+		{
+			Out[Index] = CodecType::Decode(In[Index], LocalScale, LocalBias);
+		}
+	}
+
+	SIZE_T GetAllocatedSize() const { return Data.GetAllocatedSize(); }
+
+private:
+	void SetRange(float RangeMinIn, float RangeMaxIn)
+	{
+		RangeMin = RangeMinIn;
+		RangeMax = FMath::Max(RangeMaxIn, RangeMinIn + UE_KINDA_SMALL_NUMBER);
+		Scale = (RangeMax - RangeMin) / CodecType::MaxCode;
+		InvScale = 1.0f / Scale;
+	}
+
+	float RangeMin = 0.0f;
+	float RangeMax = 1.0f;
+	float Scale = 1.0f;
+	float InvScale = 1.0f;
+};
+
+
+// 1 byte per cell -- visibility, masks, [0, 1] curve outputs
+typedef TGAGridMap<uint8> FGAGridMapU8;
+
+// 2 bytes per cell, fixed-point -- probabilities, or distances over a known range
+typedef TGAGridMap<uint16> FGAGridMapU16;
+
+// 2 bytes per cell, half float -- unbounded values where ~3 significant digits will do
+typedef TGAGridMap<FFloat16> FGAGridMapF16;
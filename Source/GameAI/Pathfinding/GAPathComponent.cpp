@@ -11,6 +11,8 @@ UGAPathComponent::UGAPathComponent(const FObjectInitializer& ObjectInitializer)
 	State = GAPS_None;
 	bDestinationValid = false;
 	ArrivalDistance = 100.0f;
+	AgentRadius = 0.0f;
+	bConservativeSmoothing = false;
 
 	// A bit of Unreal magic to make TickComponent below get called
 	PrimaryComponentTick.bCanEverTick = true;
@@ -66,6 +68,53 @@ APawn* UGAPathComponent::GetOwnerPawn()
 }
 
 
+void UGAPathComponent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	GetGridActor();
+	AGAGridActor* Grid = GridActor.Get();
+	if (Grid)
+	{
+		GridCellsChangedHandle = Grid->OnCellsChangedNative.AddUObject(this, &UGAPathComponent::OnGridCellsChanged);
+	}
+}
+
+void UGAPathComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	AGAGridActor* Grid = GridActor.Get();
+	if (Grid)
+	{
+		Grid->OnCellsChangedNative.Remove(GridCellsChangedHandle);
+	}
+	GridCellsChangedHandle.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void UGAPathComponent::OnGridCellsChanged(AGAGridActor* Grid, const TArray<FIntRect>& CellRects)
+{
+	// A* paths get replanned every tick anyway, it's only the distance map paths that can go stale
+	if (!bDistanceMapPathValid)
+	{
+		return;
+	}
+
+	for (const FPathStep& Step : Steps)
+	{
+		for (const FIntRect& CellRect : CellRects)
+		{
+			if ((Step.CellRef.X >= CellRect.Min.X) && (Step.CellRef.X <= CellRect.Max.X) &&
+				(Step.CellRef.Y >= CellRect.Min.Y) && (Step.CellRef.Y <= CellRect.Max.Y))
+			{
+				ClearPath();
+				return;
+			}
+		}
+	}
+}
+
+
 void UGAPathComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	bool Valid = false;
@@ -146,10 +195,62 @@ struct FCellRecord
 	}
 };
 
+// The cells whose component labels stand in for Cell: Cell itself if it's traversable, otherwise its traversable
+// neighbors. Agents often stand on the untraversable edge of a wall, and A* gets out of those through the neighbors.
+static void GetConnectivityCells(const AGAGridActor& Grid, const FCellRef& Cell, TArray<FCellRef, TInlineAllocator<8>>& CellsOut)
+{
+	if (EnumHasAllFlags(Grid.GetCellData(Cell), ECellData::CellDataTraversable))
+	{
+		CellsOut.Add(Cell);
+		return;
+	}
+
+	for (int32 DY = -1; DY <= 1; DY++)
+	{
+		for (int32 DX = -1; DX <= 1; DX++)
+		{
+			FCellRef Neighbor(Cell.X + DX, Cell.Y + DY);
+			if (((DX != 0) || (DY != 0)) && Grid.IsValidCell(Neighbor) && EnumHasAllFlags(Grid.GetCellData(Neighbor), ECellData::CellDataTraversable))
+			{
+				CellsOut.Add(Neighbor);
+			}
+		}
+	}
+}
+
+// False only if A* definitely can't get from Start to Destination. With nothing traversable to check from, we don't know.
+static bool MightBeConnected(const AGAGridActor& Grid, const FCellRef& Start, const FCellRef& Destination)
+{
+	if (!Grid.IsValidCell(Start) || !Grid.IsValidCell(Destination))
+	{
+		return true;
+	}
+
+	TArray<FCellRef, TInlineAllocator<8>> StartCells, DestinationCells;
+	GetConnectivityCells(Grid, Start, StartCells);
+	GetConnectivityCells(Grid, Destination, DestinationCells);
+	if ((StartCells.Num() == 0) || (DestinationCells.Num() == 0))
+	{
+		return true;
+	}
+
+	for (const FCellRef& StartCell : StartCells)
+	{
+		for (const FCellRef& DestinationCell : DestinationCells)
+		{
+			if (Grid.AreCellsConnected(StartCell, DestinationCell))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
 EGAPathState UGAPathComponent::AStar(const FVector &StartPoint, TArray<FPathStep> &StepsOut)
 {
 	const AGAGridActor* Grid = GetGridActor();
-	if (!Grid)
+	if (!Grid || !Grid->IsGridReady())
 	{
 		return GAPS_Invalid;
 	}
@@ -157,6 +258,12 @@ EGAPathState UGAPathComponent::AStar(const FVector &StartPoint, TArray<FPathStep
 	FCellRef StartCellRef = Grid->GetCellRef(StartPoint);
 	if (StartCellRef.IsValid())
 	{
+		if (!MightBeConnected(*Grid, StartCellRef, DestinationCell))
+		{
+			// No point flooding the whole grid to find that out
+			return GAPS_Invalid;
+		}
+
 		TArray<FCellRecord> Heap;
 		TMap<FCellRef, FCellRecord> Closed;
 
@@ -208,7 +315,7 @@ EGAPathState UGAPathComponent::AStar(const FVector &StartPoint, TArray<FPathStep
 			{
 				TArray<FCellRef> Neighbors;
 
-				Grid->GetNeighbors(CurrentRecord.Cell, true, Neighbors);
+				Grid->GetNeighborsWithClearance(CurrentRecord.Cell, AgentRadius, Neighbors);
 
 				for (FCellRef& NCell : Neighbors)
 				{
@@ -263,7 +370,7 @@ bool UGAPathComponent::Dijkstra(const FVector& StartPoint, FGAGridMap& DistanceM
 	bool Result = false;
 
 	const AGAGridActor* Grid = GetGridActor();
-	if (!Grid)
+	if (!Grid || !Grid->IsGridReady())
 	{
 		return false;
 	}
@@ -289,7 +396,7 @@ bool UGAPathComponent::Dijkstra(const FVector& StartPoint, FGAGridMap& DistanceM
 			{
 				TArray<FCellRef> Neighbors;
 
-				Grid->GetNeighbors(CurrentRecord.Cell, true, Neighbors);
+				Grid->GetNeighborsWithClearance(CurrentRecord.Cell, AgentRadius, Neighbors);
 
 				for (FCellRef& NCell : Neighbors)
 				{
@@ -416,12 +523,16 @@ bool UGAPathComponent::BuidPathFromDistanceMap(const FVector& StartPoint, const
 
 		TArray<FPathStep> UnsmoothedSteps;
 
+		TArray<FVector> CellPositions;
+		CellPositions.SetNumUninitialized(Cells.Num());
+		Grid->GetCellPositions(Cells, CellPositions);
+
 		for (int32 Index = Cells.Num() - 1; Index >= 0; Index--)
 		{
 			FPathStep Step;
 
 			Step.CellRef = Cells[Index];
-			Step.Point = FVector2D(Grid->GetCellPosition(Cells[Index]));
+			Step.Point = FVector2D(CellPositions[Index]);
 			UnsmoothedSteps.Add(Step);
 		}
 
@@ -459,19 +570,39 @@ EGAPathState UGAPathComponent::SmoothPath(const FVector& StartPoint, const TArra
 		FCellRef LastCell = Grid->GetCellRef(StartPoint);
 
 		// Find the first step that fails. Note, we leave the last step for after the loop
-		for (int32 StepIndex = 1; StepIndex < StepCount-1; StepIndex++)
+		// The rays from LastPoint are traced a batch at a time. Anything after the first hit in a batch gets
+		// thrown away (LastPoint moves), so the batches are kept small.
+		const int32 BatchSize = 8;
+		TArray<FVector> CellPoints;
+		TBitArray<> Hits;
+
+		int32 StepIndex = 1;
+		while (StepIndex < StepCount - 1)
 		{
-			FVector CellPoint = Grid->GetCellPosition(UnsmoothedSteps[StepIndex].CellRef);
-			FVector HitLocation;
+			const int32 BatchCount = FMath::Min(BatchSize, StepCount - 1 - StepIndex);
 
-			if (Grid->TraceLine(LastPoint, CellPoint, HitLocation))
+			CellPoints.Reset();
+			for (int32 Index = 0; Index < BatchCount; Index++)
 			{
-				// we hit something
-				const FPathStep& StepToAdd = UnsmoothedSteps[StepIndex - 1];
-				SmoothedStepsOut.Add(StepToAdd);
-				LastPoint = FVector(StepToAdd.Point, 0.0f);
-				LastCell = StepToAdd.CellRef;
+				CellPoints.Add(Grid->GetCellPosition(UnsmoothedSteps[StepIndex + Index].CellRef));
 			}
+
+			Grid->TraceLines(LastPoint, CellPoints, Hits, NULL, bConservativeSmoothing);
+
+			int32 FirstHit = Hits.Find(true);
+			if (FirstHit == INDEX_NONE)
+			{
+				StepIndex += BatchCount;
+				continue;
+			}
+
+			// we hit something
+			StepIndex += FirstHit;
+			const FPathStep& StepToAdd = UnsmoothedSteps[StepIndex - 1];
+			SmoothedStepsOut.Add(StepToAdd);
+			LastPoint = FVector(StepToAdd.Point, 0.0f);
+			LastCell = StepToAdd.CellRef;
+			StepIndex++;
 		}
 
 		// We got to the end!
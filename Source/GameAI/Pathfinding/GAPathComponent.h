@@ -66,6 +66,14 @@ class UGAPathComponent : public UActorComponent
 
 	// State Update ------------------------
 
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	// Drop the current path if the grid changed underneath any of its steps
+	void OnGridCellsChanged(AGAGridActor* Grid, const TArray<FIntRect>& CellRects);
+
+	FDelegateHandle GridCellsChangedHandle;
+
 	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
 	EGAPathState RefreshPath();
@@ -88,6 +96,15 @@ class UGAPathComponent : public UActorComponent
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	float ArrivalDistance;
 
+	// Only path through cells with at least this much clearance (see AGAGridActor::GetCellClearance).
+	// 0 means anything traversable will do.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (ClampMin = "0"))
+	float AgentRadius;
+
+	// Don't let path smoothing cut diagonally between two cells if either one is blocked
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	bool bConservativeSmoothing;
+
 	// Destination ------------------------
 
 	UFUNCTION(BlueprintCallable)
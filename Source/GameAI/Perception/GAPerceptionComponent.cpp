@@ -1,6 +1,7 @@
 #include "GAPerceptionComponent.h"
 #include "Kismet/GameplayStatics.h"
 #include "GAPerceptionSystem.h"
+#include "GameAI/Grid/GAGridActor.h"
 
 UGAPerceptionComponent::UGAPerceptionComponent(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
@@ -11,6 +12,9 @@ UGAPerceptionComponent::UGAPerceptionComponent(const FObjectInitializer& ObjectI
 	// Default vision parameters
 	VisionParameters.VisionAngle = 270.0f;
 	VisionParameters.VisionDistance = 20000.0;
+
+	bUseGridLineOfSight = false;
+	bUseVisibilityTable = true;
 }
 
 
@@ -203,17 +207,9 @@ void UGAPerceptionComponent::UpdateTargetData(UGATargetComponent* TargetComponen
 		if (AngleInDegrees <= VisionParameters.VisionAngle/2 && Distance <= VisionParameters.VisionDistance)
 		//if (Distance <= VisionParameters.VisionDistance)
 		{
-			UWorld* World = GetWorld();
-			FHitResult HitResult;
-			FCollisionQueryParams Params;
 			FVector Start = OwnerPawn->GetActorLocation();		// need a ray start
 			FVector End = TargetOwner->GetActorLocation();
-			Params.AddIgnoredActor(OwnerPawn);
-			Params.AddIgnoredActor(TargetOwner);
-			bool bHitSomething = World->LineTraceSingleByChannel(HitResult, Start, End, ECollisionChannel::ECC_Visibility, Params);
-			if (!bHitSomething) { // If bHitSomething is false, then we have a clear LOS
-				clearLosRes = true;
-			}
+			clearLosRes = HasLineOfSight(Start, End, TargetOwner);
 		}
 		TargetData->bClearLos = clearLosRes;
 		
@@ -259,17 +255,70 @@ const bool UGAPerceptionComponent::checkCellVisibility(FVector Target)
 	if (AngleInDegrees <= VisionParameters.VisionAngle / 2 && Distance <= VisionParameters.VisionDistance)
 		//if (Distance <= VisionParameters.VisionDistance)
 	{
-		UWorld* World = GetWorld();
-		FHitResult HitResult;
-		FCollisionQueryParams Params;
 		FVector Start = OwnerPawn->GetActorLocation();		// need a ray start
 		FVector End = Target;
-		Params.AddIgnoredActor(OwnerPawn);
-		bool bHitSomething = World->LineTraceSingleByChannel(HitResult, Start, End, ECollisionChannel::ECC_Visibility, Params);
-		if (!bHitSomething) { // If bHitSomething is false, then we have a clear LOS
-			retVal = true;
+
+		// The occupancy map asks this for a lot of cells every tick, so the baked table is worth a lot here
+		const AGAGridActor* Grid = bUseVisibilityTable ? GetGridActor() : NULL;
+		if (Grid && Grid->GetVisibility().IsBaked())
+		{
+			const FCellRef StartCell = Grid->GetCellRef(Start);
+			const FCellRef EndCell = Grid->GetCellRef(End);
+			// The table has nothing for untraversable cells (e.g. a pawn brushing a wall), so those still trace
+			if (StartCell.IsValid() && EndCell.IsValid() &&
+				EnumHasAllFlags(Grid->GetCellData(StartCell), ECellData::CellDataTraversable) &&
+				EnumHasAllFlags(Grid->GetCellData(EndCell), ECellData::CellDataTraversable))
+			{
+				return Grid->IsCellVisible(StartCell, EndCell);
+			}
 		}
+
+		retVal = HasLineOfSight(Start, End, NULL);
 	}
 
 	return retVal;
+}
+
+const AGAGridActor* UGAPerceptionComponent::GetGridActor() const
+{
+	AGAGridActor* Result = GridActor.Get();
+	if (Result)
+	{
+		return Result;
+	}
+	else
+	{
+		AActor* GenericResult = UGameplayStatics::GetActorOfClass(this, AGAGridActor::StaticClass());
+		if (GenericResult)
+		{
+			Result = Cast<AGAGridActor>(GenericResult);
+			if (Result)
+			{
+				GridActor = Result;
+			}
+		}
+
+		return Result;
+	}
+}
+
+bool UGAPerceptionComponent::HasLineOfSight(const FVector& Start, const FVector& End, const AActor* IgnoredTarget) const
+{
+	const AGAGridActor* Grid = bUseGridLineOfSight ? GetGridActor() : NULL;
+	if (Grid && Grid->IsGridReady())
+	{
+		FVector HitLocation;
+		return !Grid->TraceLineOfSight(Start, End, HitLocation);
+	}
+
+	UWorld* World = GetWorld();
+	FHitResult HitResult;
+	FCollisionQueryParams Params;
+	Params.AddIgnoredActor(GetOwnerPawn());
+	if (IgnoredTarget)
+	{
+		Params.AddIgnoredActor(IgnoredTarget);
+	}
+	bool bHitSomething = World->LineTraceSingleByChannel(HitResult, Start, End, ECollisionChannel::ECC_Visibility, Params);
+	return !bHitSomething;		// If bHitSomething is false, then we have a clear LOS
 }
\ No newline at end of file
@@ -84,6 +84,22 @@ class UGAPerceptionComponent : public UActorComponent
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	FVisionParameters VisionParameters;
 
+	// Answer line of sight from the grid (AGAGridActor::TraceLineOfSight) rather than with physics traces
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	bool bUseGridLineOfSight;
+
+	// If the grid has a baked visibility table (AGAGridActor::BakeVisibility), answer checkCellVisibility from it
+	// instead of tracing. That's one lookup per cell, but it only knows about traversability (no seeing over low
+	// walls), and above level 0 it's per block of cells rather than per cell.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	bool bUseVisibilityTable;
+
+	UPROPERTY()
+	mutable TSoftObjectPtr<AGAGridActor> GridActor;
+
+	UFUNCTION(BlueprintCallable)
+	const AGAGridActor* GetGridActor() const;
+
 	// A map from TargetComponent's TargetGuid to target data
 	// This allows each individual perceiving AI to store a little chunk of data for each perceivable target.
 
@@ -98,4 +114,8 @@ class UGAPerceptionComponent : public UActorComponent
 	const FTargetData *GetTargetData(FGuid TargetGuid) const;
 
 	const bool checkCellVisibility(FVector Target);
+
+private:
+	// Grid or physics, depending on bUseGridLineOfSight. IgnoredTarget (if any) doesn't block physics traces.
+	bool HasLineOfSight(const FVector& Start, const FVector& End, const AActor* IgnoredTarget) const;
 };
\ No newline at end of file
@@ -58,7 +58,7 @@ void UGATargetComponent::OnRegister()
 	const AGAGridActor* Grid = GetGridActor();
 	if (Grid)
 	{
-		OccupancyMap = FGAGridMap(Grid, 0.0f);
+		OccupancyMap = FGASparseGridMap(Grid, 0.0f);
 	}
 }
 
@@ -129,7 +129,7 @@ void UGATargetComponent::TickComponent(float DeltaTime, enum ELevelTick TickType
 	if (bDebugOccupancyMap)
 	{
 		AGAGridActor* Grid = GetGridActor();
-		Grid->DebugGridMap = OccupancyMap;
+		Grid->DebugGridMap = OccupancyMap.ToGridMap();
 		GridActor->RefreshDebugTexture();
 		GridActor->DebugMeshComponent->SetVisibility(true);
 	}
@@ -236,53 +236,76 @@ void UGATargetComponent::OccupancyMapDiffuse()
 	// TODO PART 4
 	// Diffuse the probability in the OMAP
 	const AGAGridActor* Grid = GetGridActor();
-	FGAGridMap DiffuseMap(Grid, 0.0f);
 	if (Grid)
 	{
-		for (int X = 0; X < Grid->XCount; X++)
+		// Reuse last tick's buffers. ResetData keeps the allocations, it just marks every tile as free.
+		FGASparseGridMap& DiffuseMap = OccupancyScratch;
+		if ((DiffuseMap.XCount != Grid->XCount) || (DiffuseMap.YCount != Grid->YCount))
 		{
-			for (int Y = 0; Y < Grid->YCount; Y++) {
-				FCellRef current = FCellRef(X, Y); //For each Cell in the grid
-				ECellData flags = Grid->GetCellData(current);
-				if (flags == ECellData::CellDataTraversable && Grid->IsValidCell(current))
-				{
-					//For every Cell
-					int distroCount = 0;
-					float totalProb = 0.0f;
-					TSet<FCellRef> harvestedCells; //Started the harvest
-					for (int horiz = X - 1; horiz <= X + 1; horiz++)
+			DiffuseMap = FGASparseGridMap(Grid, 0.0f);
+		}
+		else
+		{
+			DiffuseMap.ResetData(0.0f);
+		}
+
+		// Probability only spreads one cell per pass, so the only cells that can end up non-zero are the
+		// ones in (or right next to) a tile that already has some. Everything else stays empty.
+		TArray<FIntRect> Regions;
+		OccupancyMap.ForEachAllocatedTile([&Regions, Grid](const FIntRect& Rect, const float* Values)
+		{
+			Regions.Add(FIntRect(
+				FMath::Max(Rect.Min.X - 1, 0), FMath::Max(Rect.Min.Y - 1, 0),
+				FMath::Min(Rect.Max.X + 1, Grid->XCount - 1), FMath::Min(Rect.Max.Y + 1, Grid->YCount - 1)));
+		});
+
+		for (const FIntRect& Region : Regions)
+		{
+			for (int X = Region.Min.X; X <= Region.Max.X; X++)
+			{
+				for (int Y = Region.Min.Y; Y <= Region.Max.Y; Y++) {
+					FCellRef current = FCellRef(X, Y); //For each Cell in the grid
+					ECellData flags = Grid->GetCellData(current);
+					if (flags == ECellData::CellDataTraversable && Grid->IsValidCell(current))
 					{
-						for (int vert = Y - 1; vert <= Y + 1; vert++)
+						//For every Cell
+						int distroCount = 0;
+						float totalProb = 0.0f;
+						TSet<FCellRef> harvestedCells; //Started the harvest
+						for (int horiz = X - 1; horiz <= X + 1; horiz++)
 						{
-							//For every neighboring FCell
-							FCellRef cellToHarvest = FCellRef(horiz, vert);
-							if (Grid->IsValidCell(current))//As long as its not OOB
+							for (int vert = Y - 1; vert <= Y + 1; vert++)
 							{
-								ECellData flags2 = Grid->GetCellData(cellToHarvest);
-								if (flags2 == ECellData::CellDataTraversable) //And as long as its traversable
+								//For every neighboring FCell
+								FCellRef cellToHarvest = FCellRef(horiz, vert);
+								if (Grid->IsValidCell(cellToHarvest))//As long as its not OOB
 								{
-									distroCount++; //We harvested another cell
-									float harvest;
-									OccupancyMap.GetValue(cellToHarvest, harvest); //Got its value
-									totalProb = totalProb + harvest; //Added it to the total
-									//OccupancyMap.SetValue(cellToHarvest, 0.0f); //Set it to 0
-									harvestedCells.Add(cellToHarvest); //Now we will go through and redistribute.
+									ECellData flags2 = Grid->GetCellData(cellToHarvest);
+									if (flags2 == ECellData::CellDataTraversable) //And as long as its traversable
+									{
+										distroCount++; //We harvested another cell
+										float harvest;
+										OccupancyMap.GetValue(cellToHarvest, harvest); //Got its value
+										totalProb = totalProb + harvest; //Added it to the total
+										//OccupancyMap.SetValue(cellToHarvest, 0.0f); //Set it to 0
+										harvestedCells.Add(cellToHarvest); //Now we will go through and redistribute.
+									}
 								}
 							}
 						}
-					}
-					DiffuseMap.SetValue(current, totalProb/distroCount);
-					/*
-					for (FCellRef cell : harvestedCells) //For each cell we harvested from
-					{
-						float guaranteedEqual = (totalProb / distroCount);
-						OccupancyMap.SetValue(cell, guaranteedEqual); //
-					}
-					*/
+						DiffuseMap.SetValue(current, totalProb/distroCount);
+						/*
+						for (FCellRef cell : harvestedCells) //For each cell we harvested from
+						{
+							float guaranteedEqual = (totalProb / distroCount);
+							OccupancyMap.SetValue(cell, guaranteedEqual); //
+						}
+						*/
 					
+					}
 				}
 			}
 		}
-		OccupancyMap = DiffuseMap;
+		OccupancyMap.Swap(DiffuseMap);
 	}
 }
\ No newline at end of file
@@ -2,7 +2,9 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "GameAI/Grid/GAGridActor.h"
 #include "GameAI/Grid/GAGridMap.h"
+#include "GameAI/Grid/GASparseGridMap.h"
 #include "GATargetComponent.generated.h"
 
 
@@ -58,9 +60,13 @@ class UGATargetComponent : public UActorComponent
 	FTargetCache LastKnownState;
 	
 	// Occupancy Map
+	// Almost all of it is zero almost all the time, so only the tiles with some probability in them are stored
 
 	UPROPERTY(BlueprintReadOnly)
-	FGAGridMap OccupancyMap;
+	FGASparseGridMap OccupancyMap;
+
+	// Diffusion writes into this and then swaps it with OccupancyMap, so that the tile arrays get reused every tick
+	FGASparseGridMap OccupancyScratch;
 
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	bool bDebugOccupancyMap; //Literally had no clue how to change this from blueprint so I just hardcoded it.
@@ -82,6 +88,21 @@ class UGATargetComponent : public UActorComponent
 	UFUNCTION(BlueprintCallable)
 	AGAGridActor *GetGridActor() const;
 
+	// The occupancy map's tiles aren't visible to Blueprint, so read it through these.
+	// Cells outside the map return false.
+	UFUNCTION(BlueprintCallable)
+	bool GetOccupancyValue(const FCellRef& Cell, float& Value) const
+	{
+		return OccupancyMap.GetValue(Cell, Value);
+	}
+
+	// Dense copy of the whole occupancy map. Not cheap on a big grid, so don't do it every tick.
+	UFUNCTION(BlueprintCallable)
+	FGAGridMap GetOccupancyGridMap() const
+	{
+		return OccupancyMap.ToGridMap();
+	}
+
 	// Return TRUE if at least ONE AI has reach Awareness == 1 for this target
 	bool IsKnown() const
 	{
@@ -1,18 +1,180 @@
 #include "GASpatialComponent.h"
 #include "GameAI/Pathfinding/GAPathComponent.h"
 #include "GameAI/Grid/GAGridMap.h"
+#include "GameAI/Grid/GAGridMapKernels.h"
 #include "Kismet/GameplayStatics.h"
 #include "Math/MathFwd.h"
 #include "GASpatialFunction.h"
+#include "GASpatialLayerCache.h"
 #include "ProceduralMeshComponent.h"
 #include "GameAI/Perception/GAPerceptionComponent.h" //Maybe get rid of this
+#include "HAL/IConsoleManager.h"
+#include "Async/ParallelFor.h"
 
 UE_DISABLE_OPTIMIZATION
 
+static TAutoConsoleVariable<int32> CVarSpatialCompiledPlan(
+	TEXT("GameAI.Spatial.CompiledPlan"),
+	1,
+	TEXT("0: evaluate spatial functions one layer at a time. 1: use the compiled plan. 2: do both, and warn if they disagree."));
+
+static TAutoConsoleVariable<int32> CVarSpatialParallel(
+	TEXT("GameAI.Spatial.Parallel"),
+	1,
+	TEXT("Evaluate spatial layers and pick the best cell on worker threads, a chunk of rows at a time. 0 runs it all on the game thread."));
+
+static TAutoConsoleVariable<int32> CVarSpatialCoarseToFineCheck(
+	TEXT("GameAI.Spatial.CoarseToFineCheck"),
+	0,
+	TEXT("When a spatial component is going coarse to fine, also score every cell, and log whether the two found an equally good cell."));
+
+// Rows per task. Enough that each task has some real work in it, few enough that the workers stay balanced.
+static constexpr int32 SpatialRowsPerChunk = 8;
+
+static int32 GetRowChunkCount(const FGridBox& Box)
+{
+	return FMath::DivideAndRoundUp(Box.MaxY - Box.MinY + 1, SpatialRowsPerChunk);
+}
+
+// Func(Chunk, MinY, MaxY) for each chunk of Box's rows, in parallel unless bSingleThread
+template<typename FuncType>
+static void ForEachRowChunk(const FGridBox& Box, bool bSingleThread, FuncType&& Func)
+{
+	ParallelFor(GetRowChunkCount(Box), [&Box, &Func](int32 Chunk)
+	{
+		const int32 MinY = Box.MinY + Chunk * SpatialRowsPerChunk;
+		Func(Chunk, MinY, FMath::Min(MinY + SpatialRowsPerChunk - 1, Box.MaxY));
+	}, bSingleThread || (CVarSpatialParallel.GetValueOnGameThread() == 0));
+}
+
+// Writing cells from several threads is only safe once the map has its own buffer, since the copy-on-write (or
+// the copy out of a mapped file) would otherwise happen on whichever thread got there first
+static void PrepareForParallelWrites(FGAGridMap& Map)
+{
+	if (Map.IsMapped())
+	{
+		Map.Materialize();
+	}
+	Map.Data.MakeUnique();
+}
+
+// Everything the inputs need from the world, gathered once per pass
+struct FSpatialInputContext
+{
+	UWorld* World = NULL;
+	const AGAGridActor* Grid = NULL;
+	FVector TargetPosition = FVector::ZeroVector;
+	FVector Offset = FVector(0.0f, 0.0f, 60.0f);
+	FCollisionQueryParams Params;
+	bool bHasThreat = false;
+	FGASpatialThreat Threat;
+};
+
+static FSpatialInputContext MakeInputContext(const UGASpatialComponent& Component)
+{
+	FSpatialInputContext Context;
+	APawn* PlayerPawn = UGameplayStatics::GetPlayerPawn(&Component, 0);
+
+	Context.World = Component.GetWorld();
+	Context.Grid = Component.GetGridActor();
+	Context.TargetPosition = PlayerPawn ? PlayerPawn->GetActorLocation() : FVector::ZeroVector;
+	Context.Params.AddIgnoredActor(PlayerPawn);
+	Context.Params.AddIgnoredActor(Component.GetOwnerPawn());
+	Context.bHasThreat = Component.GetThreat(Context.Threat);
+	return Context;
+}
+
+// One input at one (reachable) cell
+static float EvaluateInputAtCell(ESpatialInput Input, const FCellRef& CellRef, float CellDistance, const FSpatialInputContext& Context)
+{
+	const AGAGridActor* Grid = Context.Grid;
+
+	switch (Input)
+	{
+	case SI_TargetRange:
+		return FVector::Distance(Grid->GetCellPosition(CellRef), Context.TargetPosition);
+	case SI_PathDistance:
+		return CellDistance;
+	case SI_LOS:
+	{
+		FHitResult HitResult;
+		bool bHitSomething = Context.World->LineTraceSingleByChannel(HitResult, Grid->GetCellPosition(CellRef) + Context.Offset, Context.TargetPosition, ECollisionChannel::ECC_Visibility, Context.Params);
+		return bHitSomething ? 0.0f : 1.0f;
+	}
+	case SI_Clearance:
+		return Grid->GetCellClearance(CellRef);
+	case SI_GridLOS:
+	{
+		FVector HitLocation;
+		return Grid->TraceLineOfSight(Grid->GetCellPosition(CellRef) + Context.Offset, Context.TargetPosition, HitLocation) ? 0.0f : 1.0f;
+	}
+	case SI_Threat:
+		return Context.bHasThreat ? Context.Threat.GetTimeToImpact(Grid->GetCellPosition(CellRef)) : Context.Threat.Horizon;
+	default:
+		return 0.0f;
+	}
+}
+
+const FGAGridMap* FGASpatialInputMaps::Find(ESpatialInput Input) const
+{
+	for (const TPair<ESpatialInput, const FGAGridMap*>& Entry : Maps)
+	{
+		if (Entry.Key == Input)
+		{
+			return Entry.Value;
+		}
+	}
+	return NULL;
+}
+
+void FGASpatialInputMaps::Set(ESpatialInput Input, const FGAGridMap* Map)
+{
+	for (TPair<ESpatialInput, const FGAGridMap*>& Entry : Maps)
+	{
+		if (Entry.Key == Input)
+		{
+			Entry.Value = Map;
+			return;
+		}
+	}
+	Maps.Emplace(Input, Map);
+}
+
+bool FGASpatialInputKey::Matches(const FGASpatialInputKey& Other, ESpatialInput Input) const
+{
+	if ((GridBox.MinX != Other.GridBox.MinX) || (GridBox.MaxX != Other.GridBox.MaxX) || (GridBox.MinY != Other.GridBox.MinY) || (GridBox.MaxY != Other.GridBox.MaxY) ||
+		!(AgentCell == Other.AgentCell) || (GridVersion != Other.GridVersion))
+	{
+		return false;
+	}
+
+	switch (Input)
+	{
+	case SI_TargetRange:
+	case SI_LOS:
+		return (TargetCell == Other.TargetCell);
+	case SI_GridLOS:
+		return (TargetCell == Other.TargetCell) && (bOccluderHeights == Other.bOccluderHeights);
+	case SI_Threat:
+		return ThreatHash == Other.ThreatHash;
+	default:
+		return true;
+	}
+}
+
 UGASpatialComponent::UGASpatialComponent(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
 {
 	SampleDimensions = 8000.0f;		// should cover the bulk of the test map
+	bAsyncLineOfSight = false;
+	GridLineOfSightRefineCount = 0;
+	bCacheSpatialInputs = false;
+	ThreatRadius = 250.0f;		// about the 5 x 5 cells we used to clear around it
+	ThreatHorizon = 10.0f;
+	bAvoidThreat = true;
+	TopCandidateCount = 4;
+	CoarseStride = 1;
+	CoarseRefineCount = 8;
 }
 
 
@@ -123,7 +285,7 @@ bool UGASpatialComponent::ChoosePosition(bool PathfindToPosition, bool Debug)
 	FCellRef LastCell = BestCell;
 	BestCell = FCellRef::Invalid;
 
-	if (Grid == NULL)
+	if ((Grid == NULL) || !Grid->IsGridReady())
 	{
 		return false;
 	}
@@ -145,103 +307,326 @@ bool UGASpatialComponent::ChoosePosition(bool PathfindToPosition, bool Debug)
 	// as if it were a normal instance
 	const UGASpatialFunction* SpatialFunction = SpatialFunctionReference->GetDefaultObject<UGASpatialFunction>();
 
+	// With bAsyncLineOfSight the query is split over two calls: the first one does the gather and sends off the
+	// line of sight traces, and a later one (once physics has answered) does the rest
+	const bool bAsyncLOS = bAsyncLineOfSight && SpatialFunction->GetPlan().NeedsInput(SI_LOS);
+
+	FGridBox GridBox;
+	FVector StartLocation = OwnerPawn->GetActorLocation();
+	FGAGridMap DistanceMap;
+	FGAGridMap LineOfSightMap;
+	APawn* PlayerPawn = UGameplayStatics::GetPlayerPawn(this, 0);
+
+	// What the inputs depend on this time around (see bCacheSpatialInputs). Only good once GridBox is set.
+	auto MakeInputKey = [&]()
+	{
+		FGASpatialInputKey Key;
+		Key.GridBox = GridBox;
+		Key.AgentCell = Grid->GetCellRef(StartLocation);
+		Key.TargetCell = PlayerPawn ? Grid->GetCellRef(PlayerPawn->GetActorLocation()) : FCellRef::Invalid;
+		Key.GridVersion = Grid->GridVersion;
+		Key.bOccluderHeights = Grid->HasOccluderHeights();
+
+		FGASpatialThreat Threat;
+		Key.ThreatHash = GetThreat(Threat) ? Threat.GetHash() : 0;
+		return Key;
+	};
+
+	if (LineOfSightBatch.bActive)
+	{
+		if (!bAsyncLOS)
+		{
+			// Switched off while a batch was in flight. Whatever comes back gets ignored.
+			LineOfSightBatch = FGASpatialLOSBatch();
+		}
+		else if (LineOfSightBatch.Remaining > 0)
+		{
+			if (GFrameCounter - LineOfSightBatch.IssuedFrame <= MaxLineOfSightFrames)
+			{
+				// Still waiting on physics. Keep going wherever we were going, if anywhere.
+				BestCell = LastCell;
+				return LastCell.IsValid();
+			}
+
+			UE_LOG(LogTemp, Warning, TEXT("UGASpatialComponent: line of sight traces never came back, sending them again."));
+			LineOfSightBatch = FGASpatialLOSBatch();
+		}
+		else
+		{
+			// Pick up where the first half left off
+			GridBox = LineOfSightBatch.GridBox;
+			StartLocation = LineOfSightBatch.StartLocation;
+			DistanceMap = MoveTemp(LineOfSightBatch.DistanceMap);
+
+			LineOfSightMap = FGAGridMap(Grid, GridBox, 0.0f);
+			for (int32 Index = 0; Index < LineOfSightBatch.Cells.Num(); Index++)
+			{
+				LineOfSightMap.SetValue(LineOfSightBatch.Cells[Index], LineOfSightBatch.Visible[Index] ? 1.0f : 0.0f);
+			}
+
+			LineOfSightBatch = FGASpatialLOSBatch();
+		}
+	}
+
 	// The below is to create a GridMap (which you will fill in) based on a bounding box centered around the OwnerPawn
 
 	FBox2D Box(EForceInit::ForceInit);
 	FIntRect CellRect;
-	FVector StartLocation = OwnerPawn->GetActorLocation();
 	FVector2D PawnLocation(StartLocation);
 	Box += PawnLocation;
 	Box = Box.ExpandBy(SampleDimensions / 2.0f);
-	if (GridActor->GridSpaceBoundsToRect2D(Box, CellRect))
+	if (LineOfSightMap.IsValid() || GridActor->GridSpaceBoundsToRect2D(Box, CellRect))
 	{
-		// Super annoying, by the way, that FIntRect is not blueprint accessible, because it forces us instead
-		// to make a separate bp-accessible FStruct that represents _exactly the same thing_.
-		FGridBox GridBox(CellRect);
+		if (!LineOfSightMap.IsValid())
+		{
+			// Super annoying, by the way, that FIntRect is not blueprint accessible, because it forces us instead
+			// to make a separate bp-accessible FStruct that represents _exactly the same thing_.
+			GridBox = FGridBox(CellRect);
+
+			// Fill in this distance map using Dijkstra!
+			DistanceMap = FGAGridMap(Grid, GridBox, FLT_MAX);
+
+			// ~~~ STEPS TO FILL IN FOR ASSIGNMENT 3 ~~~
+
+
+			// Step 1: Run Dijkstra's to determine which cells we should even be evaluating (the GATHER phase)
+			// (You should add a Dijkstra() function to the UGAPathComponent())
+			// I would recommend adding a method to the path component which looks something like
+			PathComponentPtr->Dijkstra(StartLocation, DistanceMap);
+
+			if (bAsyncLOS && !(bCacheSpatialInputs && FindCachedInput(SI_LOS, MakeInputKey())))
+			{
+				IssueLineOfSight(GridBox, StartLocation, DistanceMap);
+				BestCell = LastCell;
+				return LastCell.IsValid();
+			}
+		}
 
 		// This is the grid map I'm going to fill with values
 		FGAGridMap GridMap(Grid, GridBox, 0.0f);
 
-		// Fill in this distance map using Dijkstra!
-		FGAGridMap DistanceMap(Grid, GridBox, FLT_MAX);
+		FGASpatialInputMaps InputMaps;
+		if (LineOfSightMap.IsValid())
+		{
+			InputMaps.Set(SI_LOS, &LineOfSightMap);
+		}
 
+		const FGASpatialInputKey InputKey = MakeInputKey();
+		const bool bCacheGridLineOfSight = bCacheSpatialInputs && SpatialFunction->GetPlan().NeedsInput(SI_GridLOS);
+		FGAGridMap* CachedGridLineOfSightMap = bCacheGridLineOfSight ? FindCachedInput(SI_GridLOS, InputKey) : NULL;
 
-		// ~~~ STEPS TO FILL IN FOR ASSIGNMENT 3 ~~~
+		// Grid line of sight is cheap enough to just do up front, in one batch
+		FGAGridMap GridLineOfSightMap;
+		if (SpatialFunction->GetPlan().NeedsInput(SI_GridLOS) && (CachedGridLineOfSightMap == NULL))
+		{
+			BuildGridLineOfSightMap(DistanceMap, GridLineOfSightMap);
+			InputMaps.Set(SI_GridLOS, &GridLineOfSightMap);
+		}
 
+		// Anything that's the same for every agent comes out of the shared cache
+		FGAGridMap TargetRangeMap;
+		UGASpatialLayerCache* LayerCache = UGASpatialLayerCache::GetSpatialLayerCache(this);
+		if (LayerCache && PlayerPawn && SpatialFunction->GetPlan().NeedsInput(SI_TargetRange) &&
+			!(bCacheSpatialInputs && FindCachedInput(SI_TargetRange, InputKey)) &&
+			LayerCache->GetTargetRangeLayer(Grid, GridBox, PlayerPawn->GetActorLocation(), TargetRangeMap))
+		{
+			InputMaps.Set(SI_TargetRange, &TargetRangeMap);
+		}
 
-		// Step 1: Run Dijkstra's to determine which cells we should even be evaluating (the GATHER phase)
-		// (You should add a Dijkstra() function to the UGAPathComponent())
-		// I would recommend adding a method to the path component which looks something like
-		PathComponentPtr->Dijkstra(StartLocation, DistanceMap);
+		// The threat's the same for everyone perceiving it too
+		FGASpatialThreat Threat;
+		FGAGridMap ThreatMap;
+		if (LayerCache && (bAvoidThreat || SpatialFunction->GetPlan().NeedsInput(SI_Threat)) && GetThreat(Threat) &&
+			LayerCache->GetThreatLayer(Grid, GridBox, Threat, ThreatMap))
+		{
+			InputMaps.Set(SI_Threat, &ThreatMap);
+		}
 
-		// Give the last best cell a bonus
-		//GridMap.SetValue(LastCell, SpatialFunction->LastCellBonus);
+		// Whatever hasn't changed since last time is read back, the rest is worked out (or copied from above) and kept
+		if (bCacheSpatialInputs)
+		{
+			UpdateCachedInputs(SpatialFunction->GetPlan(), InputKey, DistanceMap, InputMaps);
+			CachedGridLineOfSightMap = bCacheGridLineOfSight ? FindCachedInput(SI_GridLOS, InputKey) : NULL;
+		}
 
 		// Step 2: For each layer in the spatial function, evaluate and accumulate the layer in GridMap
-		// Note, only evaluate accessible cells found in step 1
-		for (const FFunctionLayer& Layer : SpatialFunction->Layers)
+		// Note, only evaluate accessible cells found in step 1 (or whichever of them Cells has)
+		const int32 PlanMode = CVarSpatialCompiledPlan.GetValueOnGameThread();
+		auto EvaluateCells = [&](const FGAGridMap& Cells, FGAGridMap& Map)
 		{
-			// figure out how to evaluate each layer type, and accumulate the value in the GridMap
-			EvaluateLayer(Layer, DistanceMap, GridMap);
-		}
-		FTargetCache value;
-		FTargetData dummy;
-		PerceptionComponentPtr->GetCurrentTargetState(value, dummy);
-		if (PerceptionComponentPtr->TargetMap.Num() != 0) {
-			FVector rocketLocation = value.Position;
-			FVector rocketVelocity = value.Velocity;
-			//FVector rocketVelocity2D = rocketVelocity.GetSafeNormal2D();
-			//FCellRef currentRocketCell = Grid->GetCellRef(rocketLocation);
-			for (int i = 0; i < 5000; i++) {
-				FVector rocketFutureLoc = rocketLocation + (rocketVelocity * i);
-				FCellRef dodgeCell = Grid->GetCellRef(rocketFutureLoc);
-				for (int x = -2; x <= 2; x++) {
-					for (int y = -2; y <= 2; y++) {
-						FCellRef dodgeCell2 = FCellRef(dodgeCell.X + x, dodgeCell.Y + y);
-						if (dodgeCell != FCellRef::Invalid) {
-							GridMap.SetValue(dodgeCell2, 0.0f);
+			if (PlanMode != 1)
+			{
+				for (const FFunctionLayer& Layer : SpatialFunction->Layers)
+				{
+					// figure out how to evaluate each layer type, and accumulate the value in the GridMap
+					EvaluateLayer(Layer, Cells, Map, InputMaps);
+				}
+			}
+
+			if (PlanMode == 1)
+			{
+				EvaluatePlan(SpatialFunction->GetPlan(), Cells, Map, InputMaps);
+			}
+			else if (PlanMode == 2)
+			{
+				const FGASpatialPlan& Plan = SpatialFunction->GetPlan();
+				FGAGridMap PlanMap(Grid, GridBox, 0.0f);
+				EvaluatePlan(Plan, Cells, PlanMap, InputMaps);
+
+				// Without curve tables the two should match exactly. With them, all we can do is say how far apart they are.
+				float MaxDifference = 0.0f;
+				for (int32 Y = Map.GridBounds.MinY; Y <= Map.GridBounds.MaxY; Y++)
+				{
+					for (int32 X = Map.GridBounds.MinX; X <= Map.GridBounds.MaxX; X++)
+					{
+						float CellDistance, LayerValue, PlanValue;
+						if (!Cells.GetValue(FCellRef(X, Y), CellDistance) || !(CellDistance < FLT_MAX))
+						{
+							continue;
+						}
+
+						Map.GetValue(FCellRef(X, Y), LayerValue);
+						PlanMap.GetValue(FCellRef(X, Y), PlanValue);
+						if ((LayerValue != PlanValue) && (Plan.MaxLUTError == 0.0f))
+						{
+							UE_LOG(LogTemp, Warning, TEXT("UGASpatialComponent: compiled plan gave %f at (%d, %d), layers gave %f."), PlanValue, X, Y, LayerValue);
 						}
+						MaxDifference = FMath::Max(MaxDifference, FMath::Abs(LayerValue - PlanValue));
 					}
 				}
+
+				if (Plan.MaxLUTError > 0.0f)
+				{
+					UE_LOG(LogTemp, Display, TEXT("UGASpatialComponent: compiled plan is within %f of the layers (worst curve table error %f)."), MaxDifference, Plan.MaxLUTError);
+				}
 			}
-		}
-		/*
-		FVector rocketFutureLoc = rocketLocation + rocketVelocity;
-		FCellRef dodgeCell = Grid->GetCellRef(rocketLocation);
-		if(dodgeCell!=FCellRef::Invalid){
-			GridMap.SetValue(dodgeCell, 0.0f);
-		}
-		*/
+		};
 
+		// Stay out of the threat's way: nothing it reaches within the horizon is any good, whatever the layers said
+		auto AvoidThreat = [&](FGAGridMap& Map)
+		{
+			if (!bAvoidThreat || !ThreatMap.IsValid())
+			{
+				return;
+			}
 
-		// Step 3: pick the best cell in GridMap
+			PrepareForParallelWrites(Map);
+			ForEachRowChunk(Map.GridBounds, false, [&](int32 Chunk, int32 MinY, int32 MaxY)
+			{
+				for (int32 Y = MinY; Y <= MaxY; Y++)
+				{
+					for (int32 X = Map.GridBounds.MinX; X <= Map.GridBounds.MaxX; X++)
+					{
+						FCellRef CellRef(X, Y);
 
+						float TimeToImpact;
+						if (ThreatMap.GetValue(CellRef, TimeToImpact) && (TimeToImpact < Threat.Horizon))
+						{
+							Map.SetValue(CellRef, 0.0f);
+						}
+					}
+				}
+			});
+		};
+
+		// Everything that happens to the scores once the layers are done
+		FGAGridMap* RefineMap = CachedGridLineOfSightMap ? CachedGridLineOfSightMap : &GridLineOfSightMap;
+		auto FinishScores = [&](const FGAGridMap& Cells, FGAGridMap& Map)
 		{
-			float BestScore = -FLT_MAX;
+			// Corrections to a cached map stick around for next time
+			if ((GridLineOfSightRefineCount > 0) && RefineMap->IsValid())
+			{
+				RefineGridLineOfSight(*SpatialFunction, PlanMode == 1, Cells, InputMaps, *RefineMap, Map);
+			}
+			AvoidThreat(Map);
+		};
 
-			for (int32 Y = GridMap.GridBounds.MinY; Y <= GridMap.GridBounds.MaxY; Y++)
+		// Step 3 (below): the best cells in Map among the scored ones in Cells, best first
+		const int32 CandidateCount = FMath::Max(TopCandidateCount, 1);
+		auto PickBest = [&](const FGAGridMap& Cells, const FGAGridMap& Map, TArray<TPair<FCellRef, float>>& BestOut)
+		{
+			FGAGridMapKernels::MaskLess(Cells, FLT_MAX, ReachableMask);
+			FGAGridMapKernels::TopK(Map, CandidateCount, BestOut, &ReachableMask);
+
+			// Give the last best cell a bonus, and move it to wherever that puts it. It goes ahead of anything it ties
+			// with, since staying put is the point.
+			float LastDistance, LastValue;
+			if ((SpatialFunction->LastCellBonus != 0.0f) && LastCell.IsValid() && Cells.GetValue(LastCell, LastDistance) &&
+				(LastDistance < FLT_MAX) && Map.GetValue(LastCell, LastValue))
 			{
-				for (int32 X = GridMap.GridBounds.MinX; X <= GridMap.GridBounds.MaxX; X++)
+				BestOut.RemoveAll([&LastCell](const TPair<FCellRef, float>& Candidate) { return Candidate.Key == LastCell; });
+
+				const float Boosted = LastValue + SpatialFunction->LastCellBonus;
+				int32 Insert = 0;
+				while ((Insert < BestOut.Num()) && (BestOut[Insert].Value > Boosted))
 				{
-					FCellRef CellRef(X, Y);
-					float D;
+					Insert++;
+				}
+				BestOut.Insert(TPair<FCellRef, float>(LastCell, Boosted), Insert);
+				BestOut.SetNum(FMath::Min(BestOut.Num(), CandidateCount), false);
+			}
+		};
+
+		// The cells that actually got a score. Everything we can reach, unless we're going coarse to fine.
+		FGAGridMap ScoredMap = DistanceMap;
+		if (CoarseStride > 1)
+		{
+			EvaluateCoarseToFine(DistanceMap, LastCell, GridMap, ScoredMap, EvaluateCells, AvoidThreat);
+		}
+		else
+		{
+			EvaluateCells(DistanceMap, GridMap);
+		}
 
-					DistanceMap.GetValue(CellRef, D);
+		FinishScores(ScoredMap, GridMap);
 
-					if (D < FLT_MAX)
-					{
-						float V;
 
-						GridMap.GetValue(CellRef, V);
+		// Step 3: pick the best cells in GridMap, among the ones we can reach
 
-						if (V > BestScore)
-						{
-							BestScore = V;
-							BestCell = CellRef;
-							Result = true;
-						}
-					}
+		TArray<TPair<FCellRef, float>> Best;
+		PickBest(ScoredMap, GridMap, Best);
+
+		TopCells.Reset();
+		for (const TPair<FCellRef, float>& Candidate : Best)
+		{
+			FGASpatialCandidate& TopCell = TopCells.AddDefaulted_GetRef();
+			TopCell.Cell = Candidate.Key;
+			TopCell.Score = Candidate.Value;
+		}
+
+		if (TopCells.Num() > 0)
+		{
+			BestCell = TopCells[0].Cell;
+			Result = true;
+		}
+
+		// See how the coarse to fine pick compares with scoring everything, after all the same steps
+		if ((CoarseStride > 1) && (CVarSpatialCoarseToFineCheck.GetValueOnGameThread() != 0))
+		{
+			FGAGridMap ExhaustiveMap(Grid, GridBox, 0.0f);
+			EvaluateCells(DistanceMap, ExhaustiveMap);
+			FinishScores(DistanceMap, ExhaustiveMap);
+
+			TArray<TPair<FCellRef, float>> ExhaustiveBest;
+			PickBest(DistanceMap, ExhaustiveMap, ExhaustiveBest);
+
+			FGAGridMapKernels::MaskLess(ScoredMap, FLT_MAX, ReachableMask);
+			const int32 ScoredCount = ReachableMask.CountSetBits();
+			FGAGridMapKernels::MaskLess(DistanceMap, FLT_MAX, ReachableMask);
+			const int32 ReachableCount = ReachableMask.CountSetBits();
+
+			if ((Best.Num() > 0) && (ExhaustiveBest.Num() > 0))
+			{
+				// A different cell with the same score is just as good
+				CoarseToFineChecks++;
+				if ((Best[0].Key == ExhaustiveBest[0].Key) || (Best[0].Value >= ExhaustiveBest[0].Value))
+				{
+					CoarseToFineMatches++;
 				}
+
+				UE_LOG(LogTemp, Display, TEXT("UGASpatialComponent: coarse to fine scored %d of %d cells and picked (%d, %d) at %f, exhaustive picked (%d, %d) at %f. Matched %d of %d so far."),
+					ScoredCount, ReachableCount, Best[0].Key.X, Best[0].Key.Y, Best[0].Value,
+					ExhaustiveBest[0].Key.X, ExhaustiveBest[0].Key.Y, ExhaustiveBest[0].Value, CoarseToFineMatches, CoarseToFineChecks);
 			}
 		}
 
@@ -316,108 +701,521 @@ bool UGASpatialComponent::ChoosePosition(bool PathfindToPosition, bool Debug)
 }
 
 
-void UGASpatialComponent::EvaluateLayer(const FFunctionLayer& Layer, const FGAGridMap &DistanceMap, FGAGridMap &GridMap) const
+void UGASpatialComponent::IssueLineOfSight(const FGridBox& GridBox, const FVector& StartLocation, const FGAGridMap& DistanceMap)
+{
+	UWorld* World = GetWorld();
+	AActor* OwnerPawn = GetOwnerPawn();
+	const AGAGridActor* Grid = GetGridActor();
+	APawn* PlayerPawn = UGameplayStatics::GetPlayerPawn(this, 0);
+	FVector TargetPosition = PlayerPawn ? PlayerPawn->GetActorLocation() : FVector::ZeroVector;
+	FVector Offset(0.0f, 0.0f, 60.0f);
+
+	FCollisionQueryParams Params;
+	Params.AddIgnoredActor(PlayerPawn);
+	Params.AddIgnoredActor(OwnerPawn);
+
+	if (!LineOfSightDelegate.IsBound())
+	{
+		LineOfSightDelegate.BindUObject(this, &UGASpatialComponent::OnLineOfSightTraceDone);
+	}
+
+	LineOfSightBatch = FGASpatialLOSBatch();
+	LineOfSightBatch.bActive = true;
+	LineOfSightBatch.IssuedFrame = GFrameCounter;
+	LineOfSightBatch.GridBox = GridBox;
+	LineOfSightBatch.StartLocation = StartLocation;
+	LineOfSightBatch.DistanceMap = DistanceMap;
+
+	// Same cells the layers would evaluate
+	for (int32 Y = GridBox.MinY; Y <= GridBox.MaxY; Y++)
+	{
+		for (int32 X = GridBox.MinX; X <= GridBox.MaxX; X++)
+		{
+			FCellRef CellRef(X, Y);
+
+			float CellDistance;
+			if (EnumHasAllFlags(Grid->GetCellData(CellRef), ECellData::CellDataTraversable) &&
+				DistanceMap.GetValue(CellRef, CellDistance) && (CellDistance < FLT_MAX))
+			{
+				const int32 Index = LineOfSightBatch.Cells.Add(CellRef);
+				LineOfSightBatch.Handles.Add(World->AsyncLineTraceByChannel(EAsyncTraceType::Single, Grid->GetCellPosition(CellRef) + Offset, TargetPosition,
+					ECollisionChannel::ECC_Visibility, Params, FCollisionResponseParams::DefaultResponseParam, &LineOfSightDelegate, uint32(Index)));
+			}
+		}
+	}
+
+	LineOfSightBatch.Visible.Init(false, LineOfSightBatch.Cells.Num());
+	LineOfSightBatch.Remaining = LineOfSightBatch.Cells.Num();
+}
+
+void UGASpatialComponent::OnLineOfSightTraceDone(const FTraceHandle& Handle, FTraceDatum& Datum)
+{
+	// Make sure it's one of ours, and not from a batch we've since dropped
+	const int32 Index = int32(Datum.UserData);
+	if (!LineOfSightBatch.Handles.IsValidIndex(Index) || !(LineOfSightBatch.Handles[Index] == Handle))
+	{
+		return;
+	}
+
+	LineOfSightBatch.Handles[Index] = FTraceHandle();
+	LineOfSightBatch.Visible[Index] = !((Datum.OutHits.Num() > 0) && Datum.OutHits[0].bBlockingHit);
+	LineOfSightBatch.Remaining--;
+}
+
+
+void UGASpatialComponent::BuildGridLineOfSightMap(const FGAGridMap& DistanceMap, FGAGridMap& MapOut) const
+{
+	const AGAGridActor* Grid = GetGridActor();
+	APawn* PlayerPawn = UGameplayStatics::GetPlayerPawn(this, 0);
+	FVector TargetPosition = PlayerPawn ? PlayerPawn->GetActorLocation() : FVector::ZeroVector;
+	FVector Offset(0.0f, 0.0f, 60.0f);
+
+	MapOut = FGAGridMap(Grid, DistanceMap.GridBounds, 0.0f);
+
+	TArray<FCellRef> Cells;
+	TArray<FVector> CellPositions;
+	for (int32 Y = DistanceMap.GridBounds.MinY; Y <= DistanceMap.GridBounds.MaxY; Y++)
+	{
+		for (int32 X = DistanceMap.GridBounds.MinX; X <= DistanceMap.GridBounds.MaxX; X++)
+		{
+			FCellRef CellRef(X, Y);
+
+			float CellDistance;
+			if (EnumHasAllFlags(Grid->GetCellData(CellRef), ECellData::CellDataTraversable) &&
+				DistanceMap.GetValue(CellRef, CellDistance) && (CellDistance < FLT_MAX))
+			{
+				Cells.Add(CellRef);
+				CellPositions.Add(Grid->GetCellPosition(CellRef) + Offset);
+			}
+		}
+	}
+
+	// Sight goes both ways, so it's one start (the target) and a ray to every cell
+	TBitArray<> Hits;
+	Grid->TraceLinesOfSight(TargetPosition, CellPositions, Hits);
+
+	for (int32 Index = 0; Index < Cells.Num(); Index++)
+	{
+		MapOut.SetValue(Cells[Index], Hits[Index] ? 0.0f : 1.0f);
+	}
+}
+
+void UGASpatialComponent::RefineGridLineOfSight(const UGASpatialFunction& SpatialFunction, bool bUsePlan, const FGAGridMap& DistanceMap,
+	const FGASpatialInputMaps& InputMaps, FGAGridMap& GridLineOfSightMap, FGAGridMap& GridMap) const
 {
 	UWorld* World = GetWorld();
 	AActor* OwnerPawn = GetOwnerPawn();
 	const AGAGridActor* Grid = GetGridActor();
-	APawn *PlayerPawn = UGameplayStatics::GetPlayerPawn(this, 0);
-	FVector TargetPosition = PlayerPawn->GetActorLocation();
+	APawn* PlayerPawn = UGameplayStatics::GetPlayerPawn(this, 0);
+	FVector TargetPosition = PlayerPawn ? PlayerPawn->GetActorLocation() : FVector::ZeroVector;
 	FVector Offset(0.0f, 0.0f, 60.0f);
 
+	FCollisionQueryParams Params;
+	Params.AddIgnoredActor(PlayerPawn);
+	Params.AddIgnoredActor(OwnerPawn);
 
+	// The best cells, best first
+	TArray<TPair<float, FCellRef>> Candidates;
 	for (int32 Y = GridMap.GridBounds.MinY; Y <= GridMap.GridBounds.MaxY; Y++)
 	{
 		for (int32 X = GridMap.GridBounds.MinX; X <= GridMap.GridBounds.MaxX; X++)
 		{
 			FCellRef CellRef(X, Y);
 
-			if (EnumHasAllFlags(Grid->GetCellData(CellRef), ECellData::CellDataTraversable))
+			float CellDistance, Value;
+			if (DistanceMap.GetValue(CellRef, CellDistance) && (CellDistance < FLT_MAX) && GridMap.GetValue(CellRef, Value))
+			{
+				Candidates.Emplace(Value, CellRef);
+			}
+		}
+	}
+	Candidates.Sort([](const TPair<float, FCellRef>& A, const TPair<float, FCellRef>& B) { return A.Key > B.Key; });
+
+	int32 Fixed = 0;
+	for (int32 Index = 0; Index < FMath::Min(GridLineOfSightRefineCount, Candidates.Num()); Index++)
+	{
+		const FCellRef& CellRef = Candidates[Index].Value;
+
+		FHitResult HitResult;
+		const bool bVisible = !World->LineTraceSingleByChannel(HitResult, Grid->GetCellPosition(CellRef) + Offset, TargetPosition, ECollisionChannel::ECC_Visibility, Params);
+
+		float GridValue = 0.0f;
+		GridLineOfSightMap.GetValue(CellRef, GridValue);
+		if (bVisible == (GridValue > 0.5f))
+		{
+			continue;
+		}
+
+		// The grid got it wrong, so score the cell again with the right answer
+		GridLineOfSightMap.SetValue(CellRef, bVisible ? 1.0f : 0.0f);
+
+		FGASpatialInputMaps CellInputMaps = InputMaps;
+		CellInputMaps.Set(SI_GridLOS, &GridLineOfSightMap);
+
+		FGAGridMap CellMap(Grid, FGridBox(CellRef.X, CellRef.X, CellRef.Y, CellRef.Y), 0.0f);
+		if (bUsePlan)
+		{
+			EvaluatePlan(SpatialFunction.GetPlan(), DistanceMap, CellMap, CellInputMaps);
+		}
+		else
+		{
+			for (const FFunctionLayer& Layer : SpatialFunction.Layers)
+			{
+				EvaluateLayer(Layer, DistanceMap, CellMap, CellInputMaps);
+			}
+		}
+
+		float Value = 0.0f;
+		CellMap.GetValue(CellRef, Value);
+		GridMap.SetValue(CellRef, Value);
+		Fixed++;
+	}
+
+	UE_LOG(LogTemp, Verbose, TEXT("UGASpatialComponent: physics disagreed with the grid on %d of the top %d cells."), Fixed, FMath::Min(GridLineOfSightRefineCount, Candidates.Num()));
+}
+
+
+void UGASpatialComponent::EvaluateLayer(const FFunctionLayer& Layer, const FGAGridMap &DistanceMap, FGAGridMap &GridMap, const FGASpatialInputMaps& InputMaps) const
+{
+	// Same inputs as the compiled plan, see EvaluateInputAtCell
+	const FSpatialInputContext Context = MakeInputContext(*this);
+	const AGAGridActor* Grid = Context.Grid;
+
+	const FGAGridMap* InputMap = InputMaps.Find(Layer.Input);
+
+	// Physics traces stay on the game thread
+	PrepareForParallelWrites(GridMap);
+	const bool bSingleThread = (Layer.Input == SI_LOS) && (InputMap == NULL);
+
+	ForEachRowChunk(GridMap.GridBounds, bSingleThread, [&](int32 Chunk, int32 MinY, int32 MaxY)
+	{
+		for (int32 Y = MinY; Y <= MaxY; Y++)
+		{
+			for (int32 X = GridMap.GridBounds.MinX; X <= GridMap.GridBounds.MaxX; X++)
 			{
+				FCellRef CellRef(X, Y);
+
+				if (EnumHasAllFlags(Grid->GetCellData(CellRef), ECellData::CellDataTraversable))
+				{
+					float CellDistance;
+					if (DistanceMap.GetValue(CellRef, CellDistance) &&
+						(CellDistance < FLT_MAX))
+					{
+						// evaluate me!
+
+						float Value = 0.0f;
+
+						if (InputMap)
+						{
+							InputMap->GetValue(CellRef, Value);
+						}
+						else
+						{
+							Value = EvaluateInputAtCell(Layer.Input, CellRef, CellDistance, Context);
+						}
+
+
+						{
+							// Next, run it through the response curve using something like this
+							//float ModifiedValue = Layer.ResponseCurve.GetRichCurveConst()->Eval(Value, Value);
+							float ModifiedValue = Layer.ResponseCurve.GetRichCurveConst()->Eval(Value, 0.0f);
+							float CurrentValue = 0.0f;
+							float ResultValue = 0.0f;
+
+							GridMap.GetValue(CellRef, CurrentValue);
+
+							switch (Layer.Op)
+							{
+							case SO_None:
+								ResultValue = CurrentValue;
+								break;
+							case SO_Add:
+								ResultValue = CurrentValue + ModifiedValue;
+								break;
+							case SO_Multiply:
+								ResultValue = CurrentValue * ModifiedValue;
+								break;
+							}
+
+							GridMap.SetValue(CellRef, ResultValue);
+						}
+
+
+						// HERE ARE SOME ADDITIONAL HINTS
+
+						// Here's how to get the player's pawn
+
+						// Here's how to cast a ray
+
+						// UWorld* World = GetWorld();
+						// FHitResult HitResult;
+						// FCollisionQueryParams Params;
+						// FVector Start = Grid->GetCellPosition(CellRef);		// need a ray start
+						// FVector End = PlayerPawn->GetActorLocation();		// need a ray end
+						// Start.Z = End.Z;		// Hack: we don't have Z information in the grid actor -- take the player's z value and raycast against that
+						// Add any actors that should be ignored by the raycast by calling
+						// Params.AddIgnoredActor(PlayerPawn);			// Probably want to ignore the player pawn
+						// Params.AddIgnoredActor(OwnerPawn);			// Probably want to ignore the AI themself
+						// bool bHitSomething = World->LineTraceSingleByChannel(HitResult, Start, End, ECollisionChannel::ECC_Visibility, Params);
+						// If bHitSomething is false, then we have a clear LOS
+					}
+				}
+			}
+		}
+	});
+}
+
+void UGASpatialComponent::EvaluatePlan(const FGASpatialPlan& Plan, const FGAGridMap& DistanceMap, FGAGridMap& GridMap, const FGASpatialInputMaps& InputMaps) const
+{
+	if (Plan.Steps.Num() == 0)
+	{
+		return;
+	}
+
+	const AGAGridActor* Grid = GetGridActor();
+	const FSpatialInputContext Context = MakeInputContext(*this);
+
+	// Whichever inputs have already been worked out
+	TArray<const FGAGridMap*, TInlineAllocator<4>> SlotMaps;
+	for (ESpatialInput Input : Plan.Inputs)
+	{
+		SlotMaps.Add(InputMaps.Find(Input));
+	}
+
+	// Physics traces stay on the game thread
+	PrepareForParallelWrites(GridMap);
+	const bool bSingleThread = Plan.NeedsInput(SI_LOS) && (InputMaps.Find(SI_LOS) == NULL);
+
+	ForEachRowChunk(GridMap.GridBounds, bSingleThread, [&](int32 Chunk, int32 MinY, int32 MaxY)
+	{
+		TArray<float, TInlineAllocator<4>> InputValues;
+		InputValues.SetNumZeroed(Plan.Inputs.Num());
+
+		for (int32 Y = MinY; Y <= MaxY; Y++)
+		{
+			for (int32 X = GridMap.GridBounds.MinX; X <= GridMap.GridBounds.MaxX; X++)
+			{
+				FCellRef CellRef(X, Y);
+
 				float CellDistance;
-				if (DistanceMap.GetValue(CellRef, CellDistance) &&
-					(CellDistance < FLT_MAX))
+				if (!EnumHasAllFlags(Grid->GetCellData(CellRef), ECellData::CellDataTraversable) ||
+					!DistanceMap.GetValue(CellRef, CellDistance) || !(CellDistance < FLT_MAX))
 				{
-					// evaluate me!
+					continue;
+				}
 
+				// Each input once, however many layers use it
+				for (int32 Slot = 0; Slot < Plan.Inputs.Num(); Slot++)
+				{
 					float Value = 0.0f;
 
-					switch (Layer.Input)
+					if (SlotMaps[Slot])
 					{
-					case SI_None:
-						break;
-					case SI_TargetRange:
+						SlotMaps[Slot]->GetValue(CellRef, Value);
+					}
+					else
 					{
-						FVector CellPosition = Grid->GetCellPosition(CellRef);
-						Value = FVector::Distance(CellPosition, TargetPosition);
+						Value = EvaluateInputAtCell(Plan.Inputs[Slot], CellRef, CellDistance, Context);
 					}
-					break;
-					case SI_PathDistance:
-						Value = CellDistance;
-						break;
-					case SI_LOS:
+
+					InputValues[Slot] = Value;
+				}
+
+				// Then every layer, in order, without going back to the map in between
+				float CurrentValue = 0.0f;
+				GridMap.GetValue(CellRef, CurrentValue);
+
+				for (const FGASpatialPlanStep& Step : Plan.Steps)
+				{
+					const float ModifiedValue = (Step.Slot == INDEX_NONE) ? Step.Constant : Step.Evaluate(InputValues[Step.Slot]);
+
+					switch (Step.Op)
 					{
-						FVector CellPosition = Grid->GetCellPosition(CellRef) + Offset;
-						FHitResult HitResult;
-						FCollisionQueryParams Params;
-						FVector Start = CellPosition;
-						FVector End = TargetPosition;
-						Params.AddIgnoredActor(PlayerPawn);			// Probably want to ignore the player pawn
-						Params.AddIgnoredActor(OwnerPawn);			// Probably want to ignore the AI themself
-						bool bHitSomething = World->LineTraceSingleByChannel(HitResult, Start, End, ECollisionChannel::ECC_Visibility, Params);
-						Value = bHitSomething ? 0.0f : 1.0f;
+					case SO_Add:
+						CurrentValue = CurrentValue + ModifiedValue;
+						break;
+					case SO_Multiply:
+						CurrentValue = CurrentValue * ModifiedValue;
+						break;
+					default:
 						break;
 					}
-					};
+				}
 
+				GridMap.SetValue(CellRef, CurrentValue);
+			}
+		}
+	});
+}
 
-					{
-						// Next, run it through the response curve using something like this
-						//float ModifiedValue = Layer.ResponseCurve.GetRichCurveConst()->Eval(Value, Value);
-						float ModifiedValue = Layer.ResponseCurve.GetRichCurveConst()->Eval(Value, 0.0f);
-						float CurrentValue = 0.0f;
-						float ResultValue = 0.0f;
+void UGASpatialComponent::EvaluateInput(ESpatialInput Input, const FGAGridMap& DistanceMap, FGAGridMap& MapOut) const
+{
+	const AGAGridActor* Grid = GetGridActor();
+	const FSpatialInputContext Context = MakeInputContext(*this);
 
-						GridMap.GetValue(CellRef, CurrentValue);
+	MapOut = FGAGridMap(Grid, DistanceMap.GridBounds, 0.0f);
 
-						switch (Layer.Op)
-						{
-						case SO_None:
-							ResultValue = CurrentValue;
-							break;
-						case SO_Add:
-							ResultValue = CurrentValue + ModifiedValue;
-							break;
-						case SO_Multiply:
-							ResultValue = CurrentValue * ModifiedValue;
-							break;
-						}
+	// Physics traces stay on the game thread
+	PrepareForParallelWrites(MapOut);
 
-						GridMap.SetValue(CellRef, ResultValue);
-					}
+	ForEachRowChunk(MapOut.GridBounds, Input == SI_LOS, [&](int32 Chunk, int32 MinY, int32 MaxY)
+	{
+		for (int32 Y = MinY; Y <= MaxY; Y++)
+		{
+			for (int32 X = MapOut.GridBounds.MinX; X <= MapOut.GridBounds.MaxX; X++)
+			{
+				FCellRef CellRef(X, Y);
 
+				float CellDistance;
+				if (EnumHasAllFlags(Grid->GetCellData(CellRef), ECellData::CellDataTraversable) &&
+					DistanceMap.GetValue(CellRef, CellDistance) && (CellDistance < FLT_MAX))
+				{
+					MapOut.SetValue(CellRef, EvaluateInputAtCell(Input, CellRef, CellDistance, Context));
+				}
+			}
+		}
+	});
+}
 
-					// HERE ARE SOME ADDITIONAL HINTS
+FGAGridMap* UGASpatialComponent::FindCachedInput(ESpatialInput Input, const FGASpatialInputKey& Key)
+{
+	for (FGASpatialCachedInput& Cached : CachedInputs)
+	{
+		if (Cached.Input == Input)
+		{
+			return (Cached.Values.IsValid() && Key.Matches(Cached.Key, Input)) ? &Cached.Values : NULL;
+		}
+	}
+	return NULL;
+}
 
-					// Here's how to get the player's pawn
+void UGASpatialComponent::UpdateCachedInputs(const FGASpatialPlan& Plan, const FGASpatialInputKey& Key, const FGAGridMap& DistanceMap, FGASpatialInputMaps& InputMaps)
+{
+	int32 Reused = 0;
 
-					// Here's how to cast a ray
+	for (ESpatialInput Input : Plan.Inputs)
+	{
+		FGASpatialCachedInput* Cached = CachedInputs.FindByPredicate([Input](const FGASpatialCachedInput& Entry) { return Entry.Input == Input; });
+		if (Cached == NULL)
+		{
+			Cached = &CachedInputs.AddDefaulted_GetRef();
+			Cached->Input = Input;
+		}
 
-					// UWorld* World = GetWorld();
-					// FHitResult HitResult;
-					// FCollisionQueryParams Params;
-					// FVector Start = Grid->GetCellPosition(CellRef);		// need a ray start
-					// FVector End = PlayerPawn->GetActorLocation();		// need a ray end
-					// Start.Z = End.Z;		// Hack: we don't have Z information in the grid actor -- take the player's z value and raycast against that
-					// Add any actors that should be ignored by the raycast by calling
-					// Params.AddIgnoredActor(PlayerPawn);			// Probably want to ignore the player pawn
-					// Params.AddIgnoredActor(OwnerPawn);			// Probably want to ignore the AI themself
-					// bool bHitSomething = World->LineTraceSingleByChannel(HitResult, Start, End, ECollisionChannel::ECC_Visibility, Params);
-					// If bHitSomething is false, then we have a clear LOS
-				}
+		if (Cached->Values.IsValid() && Key.Matches(Cached->Key, Input))
+		{
+			Reused++;
+			continue;
+		}
+
+		if (const FGAGridMap* Fresh = InputMaps.Find(Input))
+		{
+			Cached->Values = *Fresh;
+		}
+		else
+		{
+			EvaluateInput(Input, DistanceMap, Cached->Values);
+		}
+		Cached->Key = Key;
+	}
+
+	// Done adding, so the pointers will stay put
+	for (FGASpatialCachedInput& Cached : CachedInputs)
+	{
+		if (Plan.NeedsInput(Cached.Input))
+		{
+			InputMaps.Set(Cached.Input, &Cached.Values);
+		}
+	}
+
+	UE_LOG(LogTemp, Verbose, TEXT("UGASpatialComponent: reused %d of %d cached inputs."), Reused, Plan.Inputs.Num());
+}
+
+bool UGASpatialComponent::GetThreat(FGASpatialThreat& ThreatOut) const
+{
+	ThreatOut = FGASpatialThreat();
+	ThreatOut.Radius = ThreatRadius;
+	ThreatOut.Horizon = ThreatHorizon;
+
+	// For now the only threat is whoever we're perceiving as our target
+	UGAPerceptionComponent* PerceptionComponentPtr = GetPerceptionComponent();
+	FTargetCache TargetCache;
+	FTargetData TargetData;
+	if (PerceptionComponentPtr && (PerceptionComponentPtr->TargetMap.Num() != 0) && PerceptionComponentPtr->GetCurrentTargetState(TargetCache, TargetData))
+	{
+		ThreatOut.Position = TargetCache.Position;
+		ThreatOut.Velocity = TargetCache.Velocity;
+		return true;
+	}
+
+	return false;
+}
+
+void UGASpatialComponent::EvaluateCoarseToFine(const FGAGridMap& DistanceMap, const FCellRef& LastCell, FGAGridMap& GridMap, FGAGridMap& ScoredMapOut,
+	TFunctionRef<void(const FGAGridMap& Cells, FGAGridMap& Map)> Evaluate, TFunctionRef<void(FGAGridMap& Map)> AvoidThreat)
+{
+	const AGAGridActor* Grid = GetGridActor();
+	const FGridBox& Bounds = DistanceMap.GridBounds;
+	const int32 Stride = FMath::Max(CoarseStride, 1);
+
+	// Every Stride-th cell each way. Lined up on the grid rather than the box, so the samples don't move around with us.
+	FGAGridMap CoarseMap(Grid, Bounds, FLT_MAX);
+	for (int32 Y = FMath::DivideAndRoundUp(Bounds.MinY, Stride) * Stride; Y <= Bounds.MaxY; Y += Stride)
+	{
+		for (int32 X = FMath::DivideAndRoundUp(Bounds.MinX, Stride) * Stride; X <= Bounds.MaxX; X += Stride)
+		{
+			FCellRef CellRef(X, Y);
+
+			float CellDistance;
+			if (DistanceMap.GetValue(CellRef, CellDistance) && (CellDistance < FLT_MAX))
+			{
+				CoarseMap.SetValue(CellRef, CellDistance);
 			}
 		}
 	}
+
+	Evaluate(CoarseMap, GridMap);
+
+	// Samples in the threat's way get zeroed in the end anyway, so don't spend the refinement on them
+	AvoidThreat(GridMap);
+
+	// The best few samples...
+	TArray<TPair<FCellRef, float>> Samples;
+	FGAGridMapKernels::MaskLess(CoarseMap, FLT_MAX, ReachableMask);
+	FGAGridMapKernels::TopK(GridMap, FMath::Max(CoarseRefineCount, 1), Samples, &ReachableMask);
+
+	// ...then everything around them that wasn't a sample itself, plus the last cell we picked so it can still get its bonus
+	FGAGridMap FineMap(Grid, Bounds, FLT_MAX);
+	auto AddFineCell = [&](const FCellRef& CellRef)
+	{
+		float CellDistance, CoarseDistance, FineDistance;
+		if (DistanceMap.GetValue(CellRef, CellDistance) && (CellDistance < FLT_MAX) && !(CoarseMap.GetValue(CellRef, CoarseDistance) && (CoarseDistance < FLT_MAX)) &&
+			FineMap.GetValue(CellRef, FineDistance) && !(FineDistance < FLT_MAX))
+		{
+			FineMap.SetValue(CellRef, CellDistance);
+		}
+	};
+
+	for (const TPair<FCellRef, float>& Sample : Samples)
+	{
+		for (int32 DY = 1 - Stride; DY < Stride; DY++)
+		{
+			for (int32 DX = 1 - Stride; DX < Stride; DX++)
+			{
+				AddFineCell(FCellRef(Sample.Key.X + DX, Sample.Key.Y + DY));
+			}
+		}
+	}
+	if (LastCell.IsValid())
+	{
+		AddFineCell(LastCell);
+	}
+
+	Evaluate(FineMap, GridMap);
+
+	// The two never share a cell, so the smaller of them is whichever one has it
+	ScoredMapOut = CoarseMap;
+	FGAGridMapKernels::Min(ScoredMapOut, FineMap);
 }
 
 UE_ENABLE_OPTIMIZATION
\ No newline at end of file
@@ -4,14 +4,88 @@
 #include "Components/ActorComponent.h"
 #include "GameAI/Grid/GAGridActor.h"
 #include "GameAI/Perception/GAPerceptionComponent.h" //Maybe get rid of this
+#include "GASpatialFunction.h"
+#include "WorldCollision.h"
 #include "GASpatialComponent.generated.h"
 
 class UGASpatialFunction;
 struct FFunctionLayer;
+struct FGASpatialPlan;
+struct FGASpatialThreat;
 class AGAGridActor;
 class UGAPathComponent;
 class UGAPerceptionComponent;
 
+// Inputs that have already been worked out over the whole box, so the layers can just read them.
+// Anything without a map is computed cell by cell.
+struct FGASpatialInputMaps
+{
+	// The map for Input, if we have one
+	const FGAGridMap* Find(ESpatialInput Input) const;
+
+	// Replaces any map Input already had
+	void Set(ESpatialInput Input, const FGAGridMap* Map);
+
+private:
+	TArray<TPair<ESpatialInput, const FGAGridMap*>, TInlineAllocator<8>> Maps;
+};
+
+
+// What an input's values over the box were worked out from (see bCacheSpatialInputs)
+struct FGASpatialInputKey
+{
+	FGridBox GridBox;
+	FCellRef AgentCell;			// Dijkstra starts from this cell, so it decides which cells get evaluated
+	FCellRef TargetCell;
+	int32 GridVersion = INDEX_NONE;
+	bool bOccluderHeights = false;
+	uint32 ThreatHash = 0;
+
+	// Whether values worked out for Other are still good for Input under this key
+	bool Matches(const FGASpatialInputKey& Other, ESpatialInput Input) const;
+};
+
+struct FGASpatialCachedInput
+{
+	ESpatialInput Input = SI_None;
+	FGASpatialInputKey Key;
+	FGAGridMap Values;
+};
+
+
+// The line of sight traces for one ChoosePosition, while physics works through them (see bAsyncLineOfSight)
+struct FGASpatialLOSBatch
+{
+	bool bActive = false;
+	uint64 IssuedFrame = 0;
+
+	// Everything the second half of ChoosePosition needs from the first
+	FGridBox GridBox;
+	FVector StartLocation = FVector::ZeroVector;
+	FGAGridMap DistanceMap;
+
+	// One trace per cell. Handles are cleared as the results come in.
+	TArray<FCellRef> Cells;
+	TArray<FTraceHandle> Handles;
+	TBitArray<> Visible;
+	int32 Remaining = 0;
+};
+
+
+// One of the best cells from a ChoosePosition
+USTRUCT(BlueprintType)
+struct FGASpatialCandidate
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	FCellRef Cell;
+
+	UPROPERTY(BlueprintReadOnly)
+	float Score = 0.0f;
+};
+
+
 // Our spatial component
 // This component is going to help make us make decisions about where to stand
 // Note: this should go on the AI's controller, not the pawn.
@@ -29,6 +103,49 @@ class UGASpatialComponent : public UActorComponent
 	UPROPERTY(BlueprintReadWrite, EditAnywhere)
 	float SampleDimensions;
 
+	// Send the SI_LOS traces off as one async batch rather than tracing them one at a time, and finish the query
+	// once they come back (usually the next frame). Until then ChoosePosition leaves BestCell alone, and only returns
+	// true if there was a BestCell to leave (so the first query returns false until the traces are back).
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	bool bAsyncLineOfSight;
+
+	// SI_GridLOS can be wrong where the grid is too coarse to see the geometry. Double check it with a physics trace
+	// for this many of the best cells, and rescore any it got wrong.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (ClampMin = "0"))
+	int32 GridLineOfSightRefineCount;
+
+	// Keep each input's values from one ChoosePosition to the next, and only work one out again when something it
+	// depends on has changed: our cell, the target's cell, or the grid. When nothing has, only the response curves
+	// and the combine run. Inputs measured from the target are then only as fresh as the cell the target is in.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	bool bCacheSpatialInputs;
+
+	// The threat (for now, our perceived target) is treated as a capsule of this radius swept along its velocity for
+	// ThreatHorizon seconds. SI_Threat is the time until it reaches a cell.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (ClampMin = "0"))
+	float ThreatRadius;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (ClampMin = "0"))
+	float ThreatHorizon;
+
+	// Zero the score of every cell the threat will reach within the horizon, whatever the spatial function says
+	UPROPERTY(BlueprintReadWrite, EditAnywhere)
+	bool bAvoidThreat;
+
+	// Coarse to fine: above 1, score only every CoarseStride-th cell each way first, then the full-resolution
+	// neighborhoods of the best CoarseRefineCount of them. Expensive layers run on a fraction of the cells, but the
+	// best cell can be missed if it's in a spike narrower than the stride. GameAI.Spatial.CoarseToFineCheck
+	// measures how often that happens.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (ClampMin = "1"))
+	int32 CoarseStride;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (ClampMin = "1"))
+	int32 CoarseRefineCount;
+
+	// How many of the best cells to keep in TopCells
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, meta = (ClampMin = "1"))
+	int32 TopCandidateCount;
+
 	// A couple of cached pointers and associated accessors for convenience
 
 	UPROPERTY()
@@ -43,6 +160,11 @@ class UGASpatialComponent : public UActorComponent
 	UPROPERTY(BlueprintReadOnly)
 	FCellRef BestCell;
 
+	// The best TopCandidateCount cells from the last ChoosePosition, best first, with the spatial function's
+	// LastCellBonus already in. BestCell is the first of them.
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FGASpatialCandidate> TopCells;
+
 	UFUNCTION(BlueprintCallable)
 	const AGAGridActor *GetGridActor() const;
 
@@ -63,7 +185,65 @@ class UGASpatialComponent : public UActorComponent
 	UFUNCTION(BlueprintCallable)
 	bool ChoosePosition(bool PathfindToPosition, bool Debug);
 
-	void EvaluateLayer(const FFunctionLayer& Layer, const FGAGridMap& DistanceMap, FGAGridMap& GridMap) const;
+	// Inputs with a map in InputMaps are read from it rather than worked out cell by cell
+	void EvaluateLayer(const FFunctionLayer& Layer, const FGAGridMap& DistanceMap, FGAGridMap& GridMap,
+		const FGASpatialInputMaps& InputMaps = FGASpatialInputMaps()) const;
+
+	// Every layer of the function in a single pass over the cells (see FGASpatialPlan)
+	void EvaluatePlan(const FGASpatialPlan& Plan, const FGAGridMap& DistanceMap, FGAGridMap& GridMap,
+		const FGASpatialInputMaps& InputMaps = FGASpatialInputMaps()) const;
+
+	// Input for every reachable cell in DistanceMap, into a map over its bounds
+	void EvaluateInput(ESpatialInput Input, const FGAGridMap& DistanceMap, FGAGridMap& MapOut) const;
+
+	// SI_GridLOS for every reachable cell in DistanceMap, in one batch of grid traces (1 = visible)
+	void BuildGridLineOfSightMap(const FGAGridMap& DistanceMap, FGAGridMap& MapOut) const;
+
+	// Returns false if there isn't one (ThreatOut still gets our radius and horizon)
+	bool GetThreat(FGASpatialThreat& ThreatOut) const;
+
+	// Of the coarse to fine queries checked against an exhaustive one, the fraction that found a cell as good
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	float GetCoarseToFineMatchRate() const { return (CoarseToFineChecks > 0) ? float(CoarseToFineMatches) / CoarseToFineChecks : 1.0f; }
+
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	bool IsLineOfSightPending() const { return LineOfSightBatch.bActive && (LineOfSightBatch.Remaining > 0); }
+
+private:
+	// Give up on a batch (and send another) if it hasn't come back after this many frames
+	static constexpr uint64 MaxLineOfSightFrames = 8;
+
+	void IssueLineOfSight(const FGridBox& GridBox, const FVector& StartLocation, const FGAGridMap& DistanceMap);
+
+	void OnLineOfSightTraceDone(const FTraceHandle& Handle, FTraceDatum& Datum);
+
+	// Physics check the grid's line of sight for the best GridLineOfSightRefineCount cells (see above)
+	void RefineGridLineOfSight(const UGASpatialFunction& SpatialFunction, bool bUsePlan, const FGAGridMap& DistanceMap,
+		const FGASpatialInputMaps& InputMaps, FGAGridMap& GridLineOfSightMap, FGAGridMap& GridMap) const;
+
+	// The cached values of Input, if they're still good for Key
+	FGAGridMap* FindCachedInput(ESpatialInput Input, const FGASpatialInputKey& Key);
+
+	// Bring the cache up to date for every input Plan reads, and point InputMaps at it. Inputs already in InputMaps
+	// (worked out this call anyway) are copied in rather than evaluated again.
+	void UpdateCachedInputs(const FGASpatialPlan& Plan, const FGASpatialInputKey& Key, const FGAGridMap& DistanceMap, FGASpatialInputMaps& InputMaps);
+
+	// Score the cells of DistanceMap coarse to fine (see CoarseStride) into GridMap. ScoredMapOut is DistanceMap, but
+	// with only the cells that got a score. Evaluate(Cells, Map) scores the reachable cells of Cells into Map, and
+	// AvoidThreat(Map) zeroes whatever the threat reaches, so the samples are ranked on what they'll end up scoring.
+	void EvaluateCoarseToFine(const FGAGridMap& DistanceMap, const FCellRef& LastCell, FGAGridMap& GridMap, FGAGridMap& ScoredMapOut,
+		TFunctionRef<void(const FGAGridMap& Cells, FGAGridMap& Map)> Evaluate, TFunctionRef<void(FGAGridMap& Map)> AvoidThreat);
+
+	FGASpatialLOSBatch LineOfSightBatch;
+
+	TArray<FGASpatialCachedInput> CachedInputs;
+
+	// The cells Dijkstra reached, kept around so the bits don't get reallocated every call
+	TBitArray<> ReachableMask;
+
+	int32 CoarseToFineChecks = 0;
+	int32 CoarseToFineMatches = 0;
 
+	FTraceDelegate LineOfSightDelegate;
 
 };
\ No newline at end of file
@@ -3,5 +3,153 @@
 UGASpatialFunction::UGASpatialFunction(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
 {
+	CurveLUTSize = 256;
+}
+
+
+// Sample Curve into Step's lookup table, and return the worst error between the table and the curve.
+// Leaves the table empty (so the step evaluates the curve) if a table can't stand in for it.
+static float BakeCurveLUT(const FRichCurve& Curve, int32 LUTSize, FGASpatialPlanStep& Step)
+{
+	float MinTime, MaxTime;
+	Curve.GetTimeRange(MinTime, MaxTime);
+
+	// Tables only cover the keys, and clamp outside of them
+	if ((LUTSize < 2) || (Curve.GetNumKeys() < 2) || (MaxTime <= MinTime) ||
+		(Curve.PreInfinityExtrap != RCCE_Constant) || (Curve.PostInfinityExtrap != RCCE_Constant))
+	{
+		return 0.0f;
+	}
+
+	const float StepSize = (MaxTime - MinTime) / float(LUTSize - 1);
+
+	Step.LUT.SetNumUninitialized(LUTSize);
+	for (int32 Index = 0; Index < LUTSize; Index++)
+	{
+		Step.LUT[Index] = Curve.Eval(MinTime + StepSize * Index, 0.0f);
+	}
+	Step.LUTMin = MinTime;
+	Step.LUTInvStep = 1.0f / StepSize;
+
+	// The worst of it is between samples, so check a few points in each gap
+	const int32 ChecksPerGap = 8;
+	float MaxError = 0.0f;
+	for (int32 Check = 0; Check <= (LUTSize - 1) * ChecksPerGap; Check++)
+	{
+		const float Time = MinTime + StepSize * (float(Check) / ChecksPerGap);
+		MaxError = FMath::Max(MaxError, FMath::Abs(Step.Evaluate(Time) - Curve.Eval(Time, 0.0f)));
+	}
+	return MaxError;
+}
+
+// Anything that changes what the curve evaluates to
+static uint32 HashCurve(const FRichCurve& Curve)
+{
+	// Field by field, the keys have padding in them
+	uint32 Hash = GetTypeHash(Curve.GetNumKeys());
+	for (const FRichCurveKey& Key : Curve.GetConstRefOfKeys())
+	{
+		Hash = HashCombine(Hash, GetTypeHash(Key.Time));
+		Hash = HashCombine(Hash, GetTypeHash(Key.Value));
+		Hash = HashCombine(Hash, GetTypeHash(Key.ArriveTangent));
+		Hash = HashCombine(Hash, GetTypeHash(Key.LeaveTangent));
+		Hash = HashCombine(Hash, GetTypeHash(Key.ArriveTangentWeight));
+		Hash = HashCombine(Hash, GetTypeHash(Key.LeaveTangentWeight));
+		Hash = HashCombine(Hash, GetTypeHash((uint32(Key.InterpMode) << 16) | (uint32(Key.TangentMode) << 8) | uint32(Key.TangentWeightMode)));
+	}
+	Hash = HashCombine(Hash, GetTypeHash(uint8(Curve.PreInfinityExtrap)));
+	Hash = HashCombine(Hash, GetTypeHash(uint8(Curve.PostInfinityExtrap)));
+	return HashCombine(Hash, GetTypeHash(Curve.DefaultValue));
+}
+
+
+void UGASpatialFunction::PostLoad()
+{
+	Super::PostLoad();
+	CompilePlan();
+}
+
+#if WITH_EDITOR
+void UGASpatialFunction::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+	CompilePlan();
+}
+#endif
+
+const FGASpatialPlan& UGASpatialFunction::GetPlan() const
+{
+	if (!Plan.bCompiled)
+	{
+		CompilePlan();
+	}
+#if WITH_EDITOR
+	else if (HasStaleExternalCurves())
+	{
+		CompilePlan();
+	}
+#endif
+	return Plan;
+}
+
+bool UGASpatialFunction::HasStaleExternalCurves() const
+{
+	for (const TPair<TWeakObjectPtr<const UCurveFloat>, uint32>& Entry : Plan.ExternalCurves)
+	{
+		const UCurveFloat* Curve = Entry.Key.Get();
+		if ((Curve == NULL) || (HashCurve(Curve->FloatCurve) != Entry.Value))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void UGASpatialFunction::CompilePlan() const
+{
+	const int32 Version = Plan.Version + 1;
+
+	Plan = FGASpatialPlan();
+	Plan.Version = Version;
+
+	CurveLUTErrors.Init(0.0f, Layers.Num());
+
+	for (int32 LayerIndex = 0; LayerIndex < Layers.Num(); LayerIndex++)
+	{
+		const FFunctionLayer& Layer = Layers[LayerIndex];
+
+		// SO_None leaves the value alone, so there's no point working out the layer's input at all
+		if (Layer.Op == SO_None)
+		{
+			continue;
+		}
+
+		FGASpatialPlanStep Step;
+		Step.Op = Layer.Op;
+		Step.Curve = Layer.ResponseCurve.GetRichCurveConst();
+
+		if (const UCurveFloat* ExternalCurve = Layer.ResponseCurve.ExternalCurve)
+		{
+			Plan.ExternalCurves.Emplace(ExternalCurve, HashCurve(ExternalCurve->FloatCurve));
+		}
+
+		if (Layer.Input == SI_None)
+		{
+			// The input is always 0, so the curve's output never changes
+			Step.Constant = Step.Curve->Eval(0.0f, 0.0f);
+		}
+		else
+		{
+			Step.Slot = Plan.Inputs.AddUnique(Layer.Input);
+			CurveLUTErrors[LayerIndex] = BakeCurveLUT(*Step.Curve, CurveLUTSize, Step);
+			Plan.MaxLUTError = FMath::Max(Plan.MaxLUTError, CurveLUTErrors[LayerIndex]);
+		}
+
+		Plan.Steps.Add(MoveTemp(Step));
+	}
+
+	Plan.bCompiled = true;
 
+	UE_LOG(LogTemp, Verbose, TEXT("%s: compiled %d of %d layers, %d inputs, worst curve table error %f."),
+		*GetName(), Plan.Steps.Num(), Layers.Num(), Plan.Inputs.Num(), Plan.MaxLUTError);
 }
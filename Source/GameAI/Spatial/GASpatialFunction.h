@@ -13,7 +13,10 @@ enum ESpatialInput
 	SI_None				UMETA(DisplayName = "None"),
 	SI_TargetRange		UMETA(DisplayName = "Target Range"),
 	SI_PathDistance		UMETA(DisplayName = "PathDistance"),
-	SI_LOS				UMETA(DisplayName = "Line Of Sight")
+	SI_LOS				UMETA(DisplayName = "Line Of Sight"),
+	SI_Clearance		UMETA(DisplayName = "Clearance"),		// distance to the nearest wall
+	SI_GridLOS			UMETA(DisplayName = "Line Of Sight (Grid)"),		// same as SI_LOS, but from the grid's occluder heights, no physics
+	SI_Threat			UMETA(DisplayName = "Threat")		// seconds until the threat's sweep reaches the cell (the threat horizon if it doesn't)
 	// Add others if you want!
 };
 
@@ -52,6 +55,68 @@ struct FFunctionLayer
 };
 
 
+// One layer of a compiled spatial function: Value = Value op Curve(input)
+
+struct FGASpatialPlanStep
+{
+	// Which of the plan's inputs feeds the curve, or INDEX_NONE if the input is SI_None, in which case the
+	// curve's output is always Constant
+	int32 Slot = INDEX_NONE;
+
+	const FRichCurve* Curve = nullptr;
+
+	float Constant = 0.0f;
+
+	ESpatialOp Op = SO_None;
+
+	// The curve sampled evenly over [LUTMin, LUTMin + (LUT.Num() - 1) / LUTInvStep], the time range of its keys.
+	// Inputs outside the range clamp to the ends, same as the curve's constant extrapolation.
+	// Empty if the step evaluates the curve directly.
+	TArray<float> LUT;
+	float LUTMin = 0.0f;
+	float LUTInvStep = 0.0f;
+
+	FORCEINLINE float Evaluate(float Input) const
+	{
+		if (LUT.Num() > 0)
+		{
+			const float T = FMath::Clamp((Input - LUTMin) * LUTInvStep, 0.0f, float(LUT.Num() - 1));
+			const int32 Index = FMath::Min(int32(T), LUT.Num() - 2);
+			return FMath::Lerp(LUT[Index], LUT[Index + 1], T - float(Index));
+		}
+		return Curve->Eval(Input, 0.0f);
+	}
+};
+
+
+// A spatial function boiled down to what evaluating it actually takes. Evaluating a cell means working out
+// each of Inputs once, then running Steps in order, all without touching the grid map in between.
+// Gives the same values as evaluating the layers one at a time, except for steps with a lookup table: those are
+// linear between samples, and can be off by up to MaxLUTError. Set CurveLUTSize to 0 for exact values.
+
+struct FGASpatialPlan
+{
+	// Every input some step reads, each listed once
+	TArray<ESpatialInput, TInlineAllocator<4>> Inputs;
+
+	TArray<FGASpatialPlanStep> Steps;
+
+	// Bumped every time the plan is rebuilt
+	int32 Version = 0;
+
+	// The worst lookup table error of any step
+	float MaxLUTError = 0.0f;
+
+	// Curve assets (FRuntimeFloatCurve::ExternalCurve) the steps read, and a hash of each one's keys when they were
+	// baked. Editing the asset doesn't touch the function, so in the editor GetPlan checks these and recompiles.
+	TArray<TPair<TWeakObjectPtr<const UCurveFloat>, uint32>> ExternalCurves;
+
+	bool bCompiled = false;
+
+	bool NeedsInput(ESpatialInput Input) const { return Inputs.Contains(Input); }
+};
+
+
 // A spatial function is a description of how to combine various inputs (line of sight, distance, path-distance, etc.) 
 // in order to rank an individual location where an AI might want to stand
 
@@ -60,10 +125,39 @@ class UGASpatialFunction: public UObject
 {
 	GENERATED_UCLASS_BODY()
 
+	// Added to the score of the cell we picked last time, so that we don't flip-flop (and re-path) between cells
+	// that score about the same
 	UPROPERTY(EditAnywhere)
 	float LastCellBonus;
 
 	// Our list of layers
 	UPROPERTY(BlueprintReadOnly, EditAnywhere)
 	TArray<FFunctionLayer> Layers;
+
+	// How many samples to bake each response curve into. Lookups are much cheaper than evaluating the curve, but
+	// they're linear between samples. 0 evaluates the curves exactly.
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0"))
+	int32 CurveLUTSize;
+
+	// For each layer, the worst difference between its lookup table and its curve.
+	// Filled in whenever the function is compiled, so you can tell if CurveLUTSize is big enough.
+	UPROPERTY(VisibleAnywhere, Transient)
+	mutable TArray<float> CurveLUTErrors;
+
+	virtual void PostLoad() override;
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+	// The compiled form of Layers. Rebuilt on load and on edit, or on first use if neither has happened.
+	// In the editor, also rebuilt if one of the curve assets it uses has been edited since.
+	const FGASpatialPlan& GetPlan() const;
+
+	void CompilePlan() const;
+
+private:
+	bool HasStaleExternalCurves() const;
+
+	mutable FGASpatialPlan Plan;
 };
\ No newline at end of file
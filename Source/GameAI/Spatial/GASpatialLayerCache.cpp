@@ -0,0 +1,224 @@
+#include "GASpatialLayerCache.h"
+#include "GameAI/Grid/GAGridActor.h"
+#include "Async/ParallelFor.h"
+#include "Engine/World.h"
+
+
+float FGASpatialThreat::GetTimeToImpact(const FVector& Point) const
+{
+	// Solve |Position + Velocity * T - Point| = Radius for the first T >= 0
+	const FVector2D W = FVector2D(Point) - FVector2D(Position);
+	const FVector2D V(Velocity);
+	const double C = W.SizeSquared() - FMath::Square(Radius);
+	if (C <= 0.0)
+	{
+		return 0.0f;
+	}
+
+	const double A = V.SizeSquared();
+	const double B = W | V;
+	const double Discriminant = B * B - A * C;
+	if ((A < UE_KINDA_SMALL_NUMBER) || (B <= 0.0) || (Discriminant < 0.0))
+	{
+		// Not moving, moving away, or going to miss
+		return Horizon;
+	}
+
+	return FMath::Min(float((B - FMath::Sqrt(Discriminant)) / A), Horizon);
+}
+
+uint32 FGASpatialThreat::GetHash() const
+{
+	uint32 Hash = HashCombine(GetTypeHash(Position), GetTypeHash(Velocity));
+	return HashCombine(HashCombine(Hash, GetTypeHash(Radius)), GetTypeHash(Horizon));
+}
+
+// Where the row Y = RowY crosses a capsule (in grid space). The capsule is convex, so that's one span; it's the
+// widest of the spans across its two end circles and the rectangle between them.
+static bool GetCapsuleRowSpan(const FVector2D& P0, const FVector2D& P1, double Radius, double RowY, double& MinXOut, double& MaxXOut)
+{
+	MinXOut = DBL_MAX;
+	MaxXOut = -DBL_MAX;
+
+	for (const FVector2D& Center : { P0, P1 })
+	{
+		const double DY = RowY - Center.Y;
+		if (FMath::Abs(DY) <= Radius)
+		{
+			const double HalfWidth = FMath::Sqrt(FMath::Square(Radius) - FMath::Square(DY));
+			MinXOut = FMath::Min(MinXOut, Center.X - HalfWidth);
+			MaxXOut = FMath::Max(MaxXOut, Center.X + HalfWidth);
+		}
+	}
+
+	const FVector2D Axis = P1 - P0;
+	const double Length = Axis.Size();
+	if (Length > UE_KINDA_SMALL_NUMBER)
+	{
+		const FVector2D Side = FVector2D(-Axis.Y, Axis.X) * (Radius / Length);
+		const FVector2D Corners[] = { P0 + Side, P1 + Side, P1 - Side, P0 - Side };
+
+		for (int32 Edge = 0; Edge < 4; Edge++)
+		{
+			const FVector2D& A = Corners[Edge];
+			const FVector2D& B = Corners[(Edge + 1) & 3];
+			if ((RowY < FMath::Min(A.Y, B.Y)) || (RowY > FMath::Max(A.Y, B.Y)))
+			{
+				continue;
+			}
+
+			if (A.Y == B.Y)
+			{
+				// Lying along the row
+				MinXOut = FMath::Min3(MinXOut, A.X, B.X);
+				MaxXOut = FMath::Max3(MaxXOut, A.X, B.X);
+			}
+			else
+			{
+				const double X = A.X + (B.X - A.X) * (RowY - A.Y) / (B.Y - A.Y);
+				MinXOut = FMath::Min(MinXOut, X);
+				MaxXOut = FMath::Max(MaxXOut, X);
+			}
+		}
+	}
+
+	return MinXOut <= MaxXOut;
+}
+
+
+UGASpatialLayerCache* UGASpatialLayerCache::GetSpatialLayerCache(const UObject* WorldContextObject)
+{
+	UWorld* World = WorldContextObject ? WorldContextObject->GetWorld() : NULL;
+	return World ? World->GetSubsystem<UGASpatialLayerCache>() : NULL;
+}
+
+void UGASpatialLayerCache::Deinitialize()
+{
+	Reset();
+	Super::Deinitialize();
+}
+
+void UGASpatialLayerCache::Reset()
+{
+	Layers.Empty();
+}
+
+bool UGASpatialLayerCache::FindOrBuildLayer(ESpatialInput Input, uint32 Key, const AGAGridActor* Grid, const FGridBox& Box,
+	TFunctionRef<void(FGAGridMap& Map, const FGridBox& Region)> Build, FGAGridMap& LayerOut)
+{
+	if ((Grid == NULL) || !Box.IsValid())
+	{
+		return false;
+	}
+
+	FSharedLayer& Layer = Layers.FindOrAdd(Input);
+	const bool bSameInputs = (Layer.Grid.Get() == Grid) && (Layer.GridVersion == Grid->GridVersion) && (Layer.Key == Key) && Layer.Map.IsValid();
+
+	const FGridBox Old = Layer.Map.GridBounds;
+	if (bSameInputs && (Box.MinX >= Old.MinX) && (Box.MaxX <= Old.MaxX) && (Box.MinY >= Old.MinY) && (Box.MaxY <= Old.MaxY))
+	{
+		ReuseCount++;
+		LayerOut = Layer.Map;
+		return true;
+	}
+
+	if (!bSameInputs)
+	{
+		Layer.Grid = Grid;
+		Layer.GridVersion = Grid->GridVersion;
+		Layer.Key = Key;
+		Layer.Map = FGAGridMap(Grid, Box, 0.0f);
+		Build(Layer.Map, Box);
+	}
+	else
+	{
+		// Still good, just not big enough. Grow it, keeping what we've got and only building the new strips around
+		// it, so that a frame's worth of agents costs about one build of the area they cover between them.
+		const FGridBox New(FMath::Min(Box.MinX, Old.MinX), FMath::Max(Box.MaxX, Old.MaxX), FMath::Min(Box.MinY, Old.MinY), FMath::Max(Box.MaxY, Old.MaxY));
+
+		FGAGridMap Grown(Grid, New, 0.0f);
+		for (int32 Y = Old.MinY; Y <= Old.MaxY; Y++)
+		{
+			for (int32 X = Old.MinX; X <= Old.MaxX; X++)
+			{
+				float Value;
+				Layer.Map.GetValue(FCellRef(X, Y), Value);
+				Grown.SetValue(FCellRef(X, Y), Value);
+			}
+		}
+
+		const FGridBox Strips[] =
+		{
+			FGridBox(New.MinX, New.MaxX, New.MinY, Old.MinY - 1),		// above
+			FGridBox(New.MinX, New.MaxX, Old.MaxY + 1, New.MaxY),		// below
+			FGridBox(New.MinX, Old.MinX - 1, Old.MinY, Old.MaxY),		// left
+			FGridBox(Old.MaxX + 1, New.MaxX, Old.MinY, Old.MaxY),		// right
+		};
+		for (const FGridBox& Strip : Strips)
+		{
+			if (Strip.IsValid())
+			{
+				Build(Grown, Strip);
+			}
+		}
+
+		Layer.Map = MoveTemp(Grown);
+	}
+
+	BuildCount++;
+	LayerOut = Layer.Map;
+	return true;
+}
+
+bool UGASpatialLayerCache::GetTargetRangeLayer(const AGAGridActor* Grid, const FGridBox& Box, const FVector& TargetPosition, FGAGridMap& LayerOut)
+{
+	const uint32 Key = HashCombine(HashCombine(GetTypeHash(TargetPosition.X), GetTypeHash(TargetPosition.Y)), GetTypeHash(TargetPosition.Z));
+
+	return FindOrBuildLayer(SI_TargetRange, Key, Grid, Box, [Grid, &TargetPosition](FGAGridMap& Map, const FGridBox& Region)
+	{
+		// A row per task, so each worker only ever writes its own cells
+		Map.Data.MakeUnique();
+		ParallelFor(Region.GetHeight(), [Grid, &TargetPosition, &Map, &Region](int32 Row)
+		{
+			const int32 Y = Region.MinY + Row;
+			for (int32 X = Region.MinX; X <= Region.MaxX; X++)
+			{
+				FCellRef CellRef(X, Y);
+				Map.SetValue(CellRef, FVector::Distance(Grid->GetCellPosition(CellRef), TargetPosition));
+			}
+		});
+	}, LayerOut);
+}
+
+bool UGASpatialLayerCache::GetThreatLayer(const AGAGridActor* Grid, const FGridBox& Box, const FGASpatialThreat& Threat, FGAGridMap& LayerOut)
+{
+	return FindOrBuildLayer(SI_Threat, Threat.GetHash(), Grid, Box, [Grid, &Threat](FGAGridMap& Map, const FGridBox& Region)
+	{
+		const FVector2D P0 = Grid->WorldToGrid(Threat.Position);
+		const FVector2D P1 = P0 + Grid->WorldToGridVector(Threat.Velocity) * Threat.Horizon;
+		const double Radius = (Grid->CellScale > 0.0f) ? Threat.Radius / Grid->CellScale : 0.0;
+
+		Map.Data.MakeUnique();
+		ParallelFor(Region.GetHeight(), [Grid, &Threat, &Map, &Region, &P0, &P1, Radius](int32 Row)
+		{
+			const int32 Y = Region.MinY + Row;
+			for (int32 X = Region.MinX; X <= Region.MaxX; X++)
+			{
+				Map.SetValue(FCellRef(X, Y), Threat.Horizon);
+			}
+
+			// Cell centers are at +0.5
+			double MinX, MaxX;
+			if (GetCapsuleRowSpan(P0, P1, Radius, Y + 0.5, MinX, MaxX))
+			{
+				const int32 FirstX = FMath::Max(Region.MinX, FMath::CeilToInt32(MinX - 0.5));
+				const int32 LastX = FMath::Min(Region.MaxX, FMath::FloorToInt32(MaxX - 0.5));
+				for (int32 X = FirstX; X <= LastX; X++)
+				{
+					FCellRef CellRef(X, Y);
+					Map.SetValue(CellRef, Threat.GetTimeToImpact(Grid->GetCellPosition(CellRef)));
+				}
+			}
+		});
+	}, LayerOut);
+}
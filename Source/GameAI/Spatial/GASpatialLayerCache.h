@@ -0,0 +1,78 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GameAI/Grid/GAGridMap.h"
+#include "GASpatialFunction.h"
+#include "GASpatialLayerCache.generated.h"
+
+class AGAGridActor;
+
+
+// Something dangerous heading in a straight line, and how far ahead to worry about it.
+// Its sweep over the horizon is a capsule: every point within Radius of the segment Position -> Position + Velocity * Horizon.
+struct FGASpatialThreat
+{
+	FVector Position = FVector::ZeroVector;
+	FVector Velocity = FVector::ZeroVector;
+	float Radius = 0.0f;
+	float Horizon = 0.0f;		// seconds
+
+	// Seconds until the threat comes within Radius of Point (on the ground plane), or Horizon if it doesn't by then
+	float GetTimeToImpact(const FVector& Point) const;
+
+	uint32 GetHash() const;
+};
+
+
+// Spatial layers that only depend on shared state (where the player is, say), not on the agent asking for them.
+// Every agent would compute exactly the same values, so instead they're computed once into a shared map, and each
+// agent reads its cells out of that.
+//
+// A layer is keyed by a hash of whatever it depends on, and only rebuilt when the key changes. If an agent asks for
+// cells the layer doesn't cover yet, it's rebuilt over both boxes, so that between them the agents converge on one
+// map that covers everyone.
+
+UCLASS()
+class UGASpatialLayerCache : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	static UGASpatialLayerCache* GetSpatialLayerCache(const UObject* WorldContextObject);
+
+	virtual void Deinitialize() override;
+
+	// The shared layer for Input, covering at least Box. Build(Map, Region) fills in the cells of Map inside Region.
+	// LayerOut shares the cache's values (copy-on-write), so it stays valid even if the layer is rebuilt later.
+	// Returns false if Box isn't valid.
+	bool FindOrBuildLayer(ESpatialInput Input, uint32 Key, const AGAGridActor* Grid, const FGridBox& Box,
+		TFunctionRef<void(FGAGridMap& Map, const FGridBox& Region)> Build, FGAGridMap& LayerOut);
+
+	// SI_TargetRange: each cell's distance to TargetPosition
+	bool GetTargetRangeLayer(const AGAGridActor* Grid, const FGridBox& Box, const FVector& TargetPosition, FGAGridMap& LayerOut);
+
+	// SI_Threat: each cell's time to impact. Only the cells under the threat's capsule are worked out; each row's
+	// span of them comes straight from the capsule's outline, and everything else is just Horizon.
+	bool GetThreatLayer(const AGAGridActor* Grid, const FGridBox& Box, const FGASpatialThreat& Threat, FGAGridMap& LayerOut);
+
+	// Throw everything away
+	void Reset();
+
+	int32 GetBuildCount() const { return BuildCount; }
+	int32 GetReuseCount() const { return ReuseCount; }
+
+private:
+	struct FSharedLayer
+	{
+		TWeakObjectPtr<const AGAGridActor> Grid;
+		int32 GridVersion = 0;
+		uint32 Key = 0;
+		FGAGridMap Map;
+	};
+
+	TMap<ESpatialInput, FSharedLayer> Layers;
+
+	int32 BuildCount = 0;
+	int32 ReuseCount = 0;
+};